@@ -0,0 +1,238 @@
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+using std::cout;
+using std::cerr;
+using std::endl;
+
+#ifdef	HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef	EXAMPLE_CODE
+#include <sparam.hpp>
+#include <xparam.hpp>
+#else
+#include "pparam/sparam.hpp"
+#include "pparam/xparam.hpp"
+#endif
+using namespace pparam;
+
+/*
+ * pparam-import: load an inventory of hosts from XML into a database.
+ *
+ *	pparam-import [-e sqlite|logstore] [-b batch] hosts.xml database
+ *	pparam-import -g count hosts.xml
+ *
+ * Second form writes a sample document of "count" hosts.
+ */
+
+class Nic : public XMixParam
+{
+public:
+	Nic() :
+		XMixParam("nic"),
+		name("name"),
+		mac("mac")
+	{
+		addParam(&name);
+		addParam(&mac);
+	}
+	bool key(string &_key)
+	{
+		_key = name.value();
+
+		return true;
+	}
+	string get_key() const
+	{
+		return name.value();
+	}
+
+	XTextParam	name;
+	XTextParam	mac;
+};
+
+class Nics : public XSetParam<Nic, string>
+{
+public:
+	Nics() :
+		XSetParam<Nic, string>("nics")
+	{ }
+};
+
+class Tag : public XTextParam
+{
+public:
+	Tag() :
+		XTextParam("tag")
+	{ }
+	using XTextParam::operator=;
+};
+
+class Tags : public XSetParam<Tag>
+{
+public:
+	Tags() :
+		XSetParam<Tag>("tags")
+	{ }
+};
+
+class Host : public XMixParam
+{
+public:
+	Host() :
+		XMixParam("host"),
+		name("name"),
+		address("address"),
+		cpus("cpus", 1, 1024),
+		memory("memory", 0, -1)
+	{
+		addParam(&name);
+		addParam(&address);
+		addParam(&cpus);
+		addParam(&memory);
+		addParam(&nics);
+		addParam(&tags);
+		addDBIndex("address");
+	}
+	bool key(string &_key)
+	{
+		_key = name.value();
+
+		return true;
+	}
+	string get_key() const
+	{
+		return name.value();
+	}
+
+	XTextParam		name;
+	XTextParam		address;
+	XIntParam<XInt>		cpus;
+	XIntParam<XULong>	memory;
+	Nics			nics;
+	Tags			tags;
+};
+
+class Hosts : public XSetParam<Host, string>
+{
+public:
+	Hosts() :
+		XSetParam<Host, string>("hosts")
+	{ }
+};
+
+/* Write hosts one by one, document is never held in memory. */
+static void generate(unsigned long count, const string &fileName)
+{
+	std::ofstream out(fileName.c_str());
+	if (!out)
+		throw Exception("Can't create '" + fileName + "'.",
+				TracePoint("pparam-import"));
+	out << "<hosts>" << endl;
+	for (unsigned long i = 0; i < count; i++) {
+		Host host;
+		Nic nic;
+		Tag tag;
+
+		host.name = "host-" + std::to_string(i);
+		host.address = "10." + std::to_string((i >> 16) & 255) + "."
+				+ std::to_string((i >> 8) & 255) + "."
+				+ std::to_string(i & 255);
+		host.cpus = (XInt) (1 << (i % 6));
+		host.memory = (XULong) (1 << (i % 6)) * 1024;
+		for (int j = 0; j < 2; j++) {
+			nic.name = "eth" + std::to_string(j);
+			nic.mac = "52:54:00:00:" + std::to_string(j) + "0:"
+					+ std::to_string(i % 100);
+			host.nics.addT(nic);
+		}
+		tag = (i % 2) ? "web" : "db";
+		host.tags.addT(tag);
+		tag = "rack-" + std::to_string(i % 40);
+		host.tags.addT(tag);
+		out << host.xml(false, 1, true);
+	}
+	out << "</hosts>" << endl;
+	if (!out)
+		throw Exception("Can't write '" + fileName + "'.",
+				TracePoint("pparam-import"));
+}
+
+static void usage()
+{
+	cerr << "usage: pparam-import [-e sqlite|logstore] [-b batch] "
+		"hosts.xml database" << endl
+		<< "       pparam-import -g count hosts.xml" << endl;
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	string engineName = "sqlite";
+	XUInt batchSize = 10000;
+	long count = -1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e:b:g:")) != -1) {
+		switch (opt) {
+		case 'e':
+			engineName = optarg;
+			break;
+		case 'b':
+			batchSize = strtoul(optarg, NULL, 10);
+			break;
+		case 'g':
+			count = strtol(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	try {
+		if (count >= 0) {
+			if (argc - optind != 1)
+				usage();
+			generate(count, argv[optind]);
+			return 0;
+		}
+		if (argc - optind != 2)
+			usage();
+
+		std::unique_ptr<XDBEngine> engine;
+		if (engineName == "sqlite")
+			engine.reset(new SQLiteDBEngine());
+		else if (engineName == "logstore")
+			engine.reset(new LogDBEngine());
+		else
+			usage();
+		engine->connect(argv[optind + 1]);
+
+		Hosts hosts;
+		hosts.setDBEngine(engine.get());
+		XDBImportStats stats = hosts.dbImportXml(argv[optind], batchSize,
+			[](const XDBImportStats &s) {
+				cerr << "\r" << s.items << " hosts, "
+					<< s.bytes / (1 << 20) << " MB, "
+					<< (unsigned long) s.itemsPerSecond()
+					<< " hosts/s" << std::flush;
+			});
+		cerr << endl;
+		cout << stats.items << " hosts imported in " << stats.seconds
+			<< " s (" << (unsigned long) stats.itemsPerSecond()
+			<< " hosts/s, "
+			<< (stats.seconds > 0 ?
+				stats.bytes / stats.seconds / (1 << 20) : 0)
+			<< " MB/s)" << endl;
+		engine->disconnect();
+	} catch (Exception &exception) {
+		cerr << exception.what() << endl;
+
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <unistd.h>
+using std::cout;
+using std::cerr;
+using std::endl;
+
+#ifdef	HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef	EXAMPLE_CODE
+#include <sparam.hpp>
+#include <xparam.hpp>
+#else
+#include "pparam/sparam.hpp"
+#include "pparam/xparam.hpp"
+#endif
+using namespace pparam;
+
+/*
+ * xset-alloc-bench: compare load, iterate and clear times of a set with
+ * heap (XHeapAlloc) and slab (XSlabAlloc) allocation of its members.
+ *
+ *	xset-alloc-bench [-n members] [-r rounds]
+ */
+
+class Disk : public XMixParam
+{
+public:
+	Disk() :
+		XMixParam("disk"),
+		name("name"),
+		size("size", 0, -1),
+		bus("bus")
+	{
+		addParam(&name);
+		addParam(&size);
+		addParam(&bus);
+	}
+	bool key(string &_key)
+	{
+		_key = name.value();
+
+		return true;
+	}
+	string get_key() const
+	{
+		return name.value();
+	}
+
+	XTextParam		name;
+	XIntParam<XULong>	size;
+	XTextParam		bus;
+};
+
+template <typename Alloc>
+class Disks : public XSetParam<Disk, string, std::vector<XParam *>,
+				XOrderedSMap, Alloc>
+{
+public:
+	Disks() :
+		XSetParam<Disk, string, std::vector<XParam *>,
+				XOrderedSMap, Alloc>("disks")
+	{ }
+};
+
+struct Times {
+	Times() : load(0), iterate(0), clear(0) { }
+	double load, iterate, clear;
+};
+
+static double since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename Alloc>
+static Times run(const XParam::XmlNode *root, int rounds)
+{
+	Times times;
+	Disks<Alloc> disks;
+	XULLong total = 0;
+
+	for (int i = 0; i < rounds; i++) {
+		auto start = std::chrono::steady_clock::now();
+		*(XParam *) &disks = root;
+		times.load += since(start);
+
+		start = std::chrono::steady_clock::now();
+		for (auto iter = disks.begin(); iter != disks.end(); ++iter)
+			total += static_cast<Disk *>(*iter)->size.get_value();
+		times.iterate += since(start);
+
+		start = std::chrono::steady_clock::now();
+		disks.clear();
+		times.clear += since(start);
+	}
+	if (total == 0)
+		cerr << "no members loaded" << endl;
+	times.load /= rounds;
+	times.iterate /= rounds;
+	times.clear /= rounds;
+
+	return times;
+}
+
+static void print(const string &name, const Times &times)
+{
+	cout << name << "\tload " << times.load << " ms\titerate "
+		<< times.iterate << " ms\tclear " << times.clear << " ms"
+		<< endl;
+}
+
+static void usage()
+{
+	cerr << "usage: xset-alloc-bench [-n members] [-r rounds]" << endl;
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	long count = 200000;
+	int rounds = 3;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = strtol(optarg, NULL, 10);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (count <= 0 || rounds <= 0)
+		usage();
+
+	try {
+		/* Build the document once, both sets load the same tree. */
+		Disks<XHeapAlloc> source;
+		Disk disk;
+		for (long i = 0; i < count; i++) {
+			disk.name = "disk-" + std::to_string(i);
+			disk.size = (XULong) (i % 1024 + 1) << 20;
+			disk.bus = (i % 2) ? "virtio" : "scsi";
+			source.addT(disk);
+		}
+		XParam::XmlParser parser;
+		parser.parse_memory(source.xml());
+		source.clear();
+		const XParam::XmlNode *root =
+			parser.get_document()->get_root_node();
+
+		cout << count << " members, " << rounds << " rounds" << endl;
+		print("heap", run<XHeapAlloc>(root, rounds));
+		print("slab", run<XSlabAlloc>(root, rounds));
+	} catch (Exception &exception) {
+		cerr << exception.what() << endl;
+
+		return 1;
+	}
+
+	return 0;
+}
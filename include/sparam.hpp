@@ -30,6 +30,8 @@
 #include <string>
 #include <uuid/uuid.h>
 
+#include "xdblog.hpp"
+#include "xdbmemory.hpp"
 #include "xparam.hpp"
 
 namespace pparam
@@ -917,6 +919,11 @@ public:
     virtual void setNetmask(const string &iNetmask);
     virtual int getNetmask() const;
     virtual string getNetmaskString() const;
+    /**
+     * get IPv4 address as a compact 32 bit number
+     * \return 0 if address isn't IPv4
+     */
+    unsigned int getAddressCompact() const;
     virtual bool checkNetworkAvailability(string IPAddress) const;
     ~IPxParam()
     {
@@ -1172,6 +1179,7 @@ public:
     PortParam(const PortParam &port) : XSingleParam(port.get_pname())
     {
         notSign = port.notSign;
+        portRange = port.portRange;
         from = port.from;
         to = port.to;
         portString = port.portString;
@@ -1305,7 +1313,7 @@ class DBEngineParam;
 class DBEngineTypes
 {
 public:
-    enum DBType { SQLite, MAX };
+    enum DBType { SQLite, Memory, LogStore, MAX };
     static const string typeString[MAX];
 };
 
@@ -1474,6 +1482,85 @@ protected:
     SQLiteDBEngine *sqlitedb;
 };
 
+/**
+ * \class MemoryDBEngineParam
+ * DBEngineParam of MemoryDBEngine, connection string is the snapshot
+ * file (":memory:" for none).
+ */
+class MemoryDBEngineParam : public DBEngineParam
+{
+public:
+    MemoryDBEngineParam(const string &pname) : DBEngineParam(pname)
+    {
+        memorydb = new MemoryDBEngine();
+        dbe = (XDBEngine *)memorydb;
+        dbetype.set_type(DBEngineTypes::Memory);
+    }
+    MemoryDBEngineParam(MemoryDBEngineParam &&_dep) :
+        DBEngineParam(std::move(_dep)), memorydb(_dep.memorydb)
+    {
+        _dep.memorydb = NULL;
+    }
+    using DBEngineParam::operator=;
+    MemoryDBEngine *memoryDBEngine() { return memorydb; }
+    void memoryDBEngine(MemoryDBEngine *xdb)
+    {
+        dbe = (XDBEngine *)xdb;
+        memorydb = xdb;
+    }
+    XDBEngine *DBEngine() { return (XDBEngine *)memorydb; }
+    void DBEngine(XDBEngine *xdb)
+    {
+        MemoryDBEngine *memorydb = dynamic_cast<MemoryDBEngine *>(xdb);
+        if (memorydb == NULL)
+            throw Exception("cannot cast XDBEngine to MemoryDBEngine", TracePoint("sparam"));
+        memoryDBEngine(memorydb);
+    }
+    virtual void type(Type &_type) const { _type.set_type(DBEngineTypes::Memory); }
+
+protected:
+    MemoryDBEngine *memorydb;
+};
+
+/**
+ * \class LogDBEngineParam
+ * DBEngineParam of LogDBEngine, connection string is the directory of
+ * segment files.
+ */
+class LogDBEngineParam : public DBEngineParam
+{
+public:
+    LogDBEngineParam(const string &pname) : DBEngineParam(pname)
+    {
+        logdb = new LogDBEngine();
+        dbe = (XDBEngine *)logdb;
+        dbetype.set_type(DBEngineTypes::LogStore);
+    }
+    LogDBEngineParam(LogDBEngineParam &&_dep) : DBEngineParam(std::move(_dep)), logdb(_dep.logdb)
+    {
+        _dep.logdb = NULL;
+    }
+    using DBEngineParam::operator=;
+    LogDBEngine *logDBEngine() { return logdb; }
+    void logDBEngine(LogDBEngine *xdb)
+    {
+        dbe = (XDBEngine *)xdb;
+        logdb = xdb;
+    }
+    XDBEngine *DBEngine() { return (XDBEngine *)logdb; }
+    void DBEngine(XDBEngine *xdb)
+    {
+        LogDBEngine *logdb = dynamic_cast<LogDBEngine *>(xdb);
+        if (logdb == NULL)
+            throw Exception("cannot cast XDBEngine to LogDBEngine", TracePoint("sparam"));
+        logDBEngine(logdb);
+    }
+    virtual void type(Type &_type) const { _type.set_type(DBEngineTypes::LogStore); }
+
+protected:
+    LogDBEngine *logdb;
+};
+
 /**
  * \class EmailParam
  * \author Seyed Alireza Kahduyi(alireza.kahduyi@cloudavid.com)
@@ -0,0 +1,266 @@
+/**
+ * \file xdbbuffered.hpp
+ * defines base of database engines that buffer transactions.
+ *
+ * Copyright 2010-2022 Cloud Avid Co. (www.cloudavid.com)
+ *
+ * xparam is part of PParam.
+ *
+ * PParam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PParam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PParam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <pthread.h>
+
+#include "xdbengine.hpp"
+
+namespace pparam
+{
+
+/** Inverses of applied writes, they run in reverse order to undo them. */
+typedef vector<std::function<void()> > XDBUndoLog;
+
+/**
+ * \class XDBBufferedEngine
+ * Base of engines that keep their tables themselves and buffer
+ * transactions of each thread (MemoryDBEngine, LogDBEngine).
+ *
+ * Writes are operations on "Context", state of the commit that runs
+ * them (e.g. its undo log). Out of transactions they're applied at once,
+ * inside transactions they're buffered per thread and applied together
+ * when the outermost transaction or batch commits, under the write lock.
+ * Transactions inside a batch are levels of its buffer, so rolling one
+ * back drops operations that are buffered since it opened.
+ *
+ * Derived engines implement apply(); they take the read lock to read
+ * tables.
+ */
+template <typename Context> class XDBBufferedEngine : public XDBEngine
+{
+public:
+    virtual ~XDBBufferedEngine()
+    {
+        delete (Transaction *)pthread_getspecific(transactionBufferTSMKey);
+        pthread_key_delete(transactionBufferTSMKey);
+        pthread_rwlock_destroy(&lock);
+    }
+
+    virtual void startTransaction()
+    {
+        Transaction *tr = (Transaction *)pthread_getspecific(transactionBufferTSMKey);
+        if (tr == NULL)
+            pthread_setspecific(transactionBufferTSMKey, new Transaction);
+        else if (!tr->levels.empty())
+            tr->levels.push_back(std::make_pair(tr->ops.size(), false));
+    }
+    virtual void commitTransaction()
+    {
+        Transaction *tr = (Transaction *)pthread_getspecific(transactionBufferTSMKey);
+        if (tr == NULL)
+            return;
+        if (!tr->levels.empty()) {
+            // a batch itself is committed by endBatch()
+            if (!tr->levels.back().second)
+                tr->levels.pop_back();
+            return;
+        }
+        pthread_setspecific(transactionBufferTSMKey, NULL);
+        std::unique_ptr<Transaction> guard(tr);
+        ScopedLock lguard(&lock, true);
+        apply(tr->ops);
+    }
+    virtual void rollbackTransaction()
+    {
+        Transaction *tr = (Transaction *)pthread_getspecific(transactionBufferTSMKey);
+        if (tr != NULL && !tr->levels.empty()) {
+            if (!tr->levels.back().second) {
+                tr->ops.resize(tr->levels.back().first);
+                tr->levels.pop_back();
+                countRollback();
+            }
+            return;
+        }
+        if (tr != NULL)
+            countRollback();
+        delete tr;
+        pthread_setspecific(transactionBufferTSMKey, NULL);
+    }
+    virtual void beginBatch()
+    {
+        Transaction *tr = (Transaction *)pthread_getspecific(transactionBufferTSMKey);
+        if (tr == NULL) {
+            tr = new Transaction;
+            pthread_setspecific(transactionBufferTSMKey, tr);
+        } else if (tr->levels.empty())
+            throw Exception("Batch can't be opened inside a transaction.",
+                            TracePoint(engineName));
+        tr->levels.push_back(std::make_pair(tr->ops.size(), true));
+    }
+    virtual void endBatch(bool commit)
+    {
+        Transaction *tr = (Transaction *)pthread_getspecific(transactionBufferTSMKey);
+        int level = (tr == NULL) ? -1 : (int)tr->levels.size() - 1;
+        while (level >= 0 && !tr->levels[level].second)
+            level--;
+        if (level < 0)
+            throw Exception("No batch is open.", TracePoint(engineName));
+        if (!commit) {
+            tr->ops.resize(tr->levels[level].first);
+            countRollback();
+        }
+        tr->levels.resize(level);
+        if (level == 0)
+            commitTransaction();
+    }
+
+    virtual bool isOnTransaction()
+    {
+        return pthread_getspecific(transactionBufferTSMKey) != NULL;
+    }
+    virtual string DBTypetoString(DBFieldTypes t)
+    {
+        switch (t) {
+        case DBBOOLEAN:
+            return "BOOLEAN";
+        case DBFLOAT:
+            return "FLOAT";
+        case DBTEXT:
+            return "TEXT";
+        case DBDATETIME:
+            return "DATETIME";
+        case DBINTEGER:
+            return "INTEGER";
+        default:
+            return "";
+        }
+    }
+
+protected:
+    typedef XDBUndoLog UndoLog;
+    typedef std::function<void(Context &)> Operation;
+    /** Buffered writes of a thread. */
+    struct Transaction {
+        vector<Operation> ops;
+        /**
+         * Open batches and transactions inside them: size of "ops" when
+         * they opened and whether it's a batch.
+         */
+        vector<std::pair<size_t, bool> > levels;
+    };
+
+    /**
+     * Holds read or write lock of engine in its scope.
+     */
+    class ScopedLock
+    {
+    public:
+        ScopedLock(pthread_rwlock_t *_lock, bool write) : lock(_lock)
+        {
+            if (write)
+                pthread_rwlock_wrlock(lock);
+            else
+                pthread_rwlock_rdlock(lock);
+        }
+        ~ScopedLock() { pthread_rwlock_unlock(lock); }
+
+    protected:
+        pthread_rwlock_t *lock;
+    };
+
+    // special results of columnIndex()
+    static const int NO_COLUMN = -1;
+    static const int KEY_COLUMN = -2;
+    static const int PARENT_KEY_COLUMN = -3;
+
+    /**
+     * \param _engineName name of engine in trace points of its exceptions.
+     */
+    XDBBufferedEngine(const string &_engineName) : engineName(_engineName)
+    {
+        pthread_rwlock_init(&lock, NULL);
+        pthread_key_create(&transactionBufferTSMKey, cleanTBuffer);
+    }
+
+    static void cleanTBuffer(void *ptr)
+    {
+        // transaction of an exited thread that never committed.
+        delete (Transaction *)ptr;
+    }
+    /** Run "op" now, or buffer it if thread is on transaction. */
+    void perform(const Operation &op)
+    {
+        Transaction *tr = (Transaction *)pthread_getspecific(transactionBufferTSMKey);
+        if (tr != NULL) {
+            tr->ops.push_back(op);
+            return;
+        }
+        ScopedLock guard(&lock, true);
+        apply(vector<Operation>(1, op));
+    }
+    /**
+     * Run operations as one commit, caller holds write lock. If one of
+     * them fails, changes of all of them are undone.
+     */
+    virtual void apply(const vector<Operation> &ops) = 0;
+
+    static string rowKey(const string &pkey, const string &parentKey)
+    {
+        string key = pkey;
+        key += '\0';
+        key += parentKey;
+        return key;
+    }
+    /** Keys of rows addressed by pkey (and parent, if not empty). */
+    template <typename Table>
+    vector<string> findRows(Table &table, const string &pkey, const string &parentName,
+                            const string &parentKey)
+    {
+        vector<string> keys;
+        if (!parentName.empty() && table.parentName != parentName)
+            throw Exception("Parent of table is not '" + parentName + "'.",
+                            TracePoint(engineName));
+        if (!parentName.empty() || table.parentName.empty()) {
+            string key = rowKey(pkey, parentKey);
+            if (table.rows.count(key))
+                keys.push_back(key);
+            return keys;
+        }
+        // key without parent may match rows of several parents
+        for (auto iter = table.rows.begin(); iter != table.rows.end(); ++iter)
+            if (iter->second.pkey == pkey)
+                keys.push_back(iter->first);
+        return keys;
+    }
+    template <typename Table>
+    int columnIndex(const Table &table, const string &field, bool keys = false)
+    {
+        for (unsigned int i = 0; i < table.columns.size(); i++)
+            if (table.columns[i] == field)
+                return i;
+        if (keys && field == table.name + "_key")
+            return KEY_COLUMN;
+        if (keys && !table.parentName.empty() && field == table.parentName + "_key")
+            return PARENT_KEY_COLUMN;
+        throw Exception("no such column: " + field, TracePoint(engineName));
+        return NO_COLUMN;
+    }
+
+    const string engineName;
+    pthread_rwlock_t lock;
+    pthread_key_t transactionBufferTSMKey;
+};
+
+} // namespace pparam
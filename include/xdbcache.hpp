@@ -0,0 +1,201 @@
+/**
+ * \file xdbcache.hpp
+ * defines read-through cache decorator of database engines.
+ *
+ * Copyright 2010-2022 Cloud Avid Co. (www.cloudavid.com)
+ *
+ * xparam is part of PParam.
+ *
+ * PParam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PParam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PParam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <pthread.h>
+#include <set>
+
+#include "xdbengine.hpp"
+#include "xhashmap.hpp"
+
+namespace pparam
+{
+
+/**
+ * \class XDBCacheStats
+ * Counters of XDBCache.
+ */
+struct XDBCacheStats {
+    unsigned long long hits;
+    unsigned long long misses;
+    /** entries dropped because cache was full */
+    unsigned long long evictions;
+    /** entries dropped because of writes */
+    unsigned long long invalidations;
+    /** current number of entries */
+    size_t entries;
+};
+
+/**
+ * \class XDBCache
+ * XDBEngine decorator that caches loaded rows and value lists.
+ *
+ * loadXParamRow() and loadXParamValueListByParent() (so key lists too)
+ * are answered from a LRU cache of at most "capacity" entries, keyed by
+ * table, key and parent. Writes through this engine invalidate exactly
+ * the entries they may change; writes inside a transaction invalidate
+ * again at commit, because other threads may reload old rows before the
+ * commit.
+ *
+ * Writes that don't pass through this engine aren't seen, call clear()
+ * after them. execute() can't be analyzed, so it clears everything.
+ * getData() and query() are never cached.
+ */
+class XDBCache : public XDBEngine
+{
+public:
+    /**
+     * \param _engine underlying engine, it's not owned by cache.
+     * \param _capacity maximum number of cached entries.
+     */
+    XDBCache(XDBEngine *_engine, size_t _capacity = 10000);
+    virtual ~XDBCache();
+
+    virtual void connect(string connectionString);
+    virtual void disconnect();
+    virtual void execute(string command);
+
+    virtual void startTransaction();
+    virtual void commitTransaction();
+    virtual void rollbackTransaction();
+    virtual void beginBatch();
+    virtual void endBatch(bool commit);
+
+    virtual void saveXParam(string pname, string pkey, string parentName, string parentKey,
+                            stringList fields, stringList values);
+    virtual void saveXParam(string pname, string pkey, stringList fields, stringList values);
+    virtual void updateXParam(string pname, string pkey, string parentName, string parentKey,
+                              stringList fields, stringList values);
+    virtual void updateXParam(string pname, string pkey, stringList fields, stringList values);
+    virtual void removeXParam(string pname, string pkey, string parentName, string parentKey);
+    virtual void removeXParam(string pname, string pkey);
+    virtual void removeXParamByParent(string pname, string parentName, string parentKey);
+    virtual void removeXParamByValue(string pname, string parentName, string parentKey,
+                                     string fieldName, string value);
+    virtual void createXParamStructure(string pname, string parentName, stringList fields,
+                                       vector<DBFieldTypes> fieldTypes);
+    virtual void createXParamStructure(string pname, stringList fields,
+                                       vector<DBFieldTypes> fieldTypes);
+    virtual void destroyXParamStructure(string pname);
+    virtual void createXParamIndex(string pname, stringList fields, bool unique = false);
+    virtual void deferIndexes(bool defer) { engine->deferIndexes(defer); }
+
+    virtual int loadXParamRow(string pname, string pkey, string parentName, string parentKey,
+                              stringList &fields, stringList &values);
+    virtual int loadXParamRow(string pname, string pkey, stringList &fields, stringList &values);
+    virtual int loadXParamValueListByParent(string pname, string parentName, string parentKey,
+                                            string fieldName, stringList &values);
+    virtual void getData(string selectstmt, vector<vector<string> > &results,
+                         vector<string> &columns);
+    virtual void getData(string selectstmt, const stringList &params,
+                         vector<vector<string> > &results, vector<string> &columns);
+    using XDBEngine::query;
+    virtual void query(string selectstmt, const stringList &params, XDBRowVisitor &visitor);
+    virtual bool backup(string dest) { return engine->backup(dest); }
+    virtual void cleanup() { engine->cleanup(); }
+    virtual bool isOnTransaction() { return engine->isOnTransaction(); }
+    virtual unsigned long getRollbacks() { return engine->getRollbacks(); }
+    virtual string DBTypetoString(DBFieldTypes t) { return engine->DBTypetoString(t); }
+    virtual bool isConnected() { return engine->isConnected(); }
+
+    /** Drop all of the cached entries. */
+    void clear();
+    XDBCacheStats stats();
+    void resetStats();
+    XDBEngine *getEngine() { return engine; }
+
+protected:
+    struct Entry {
+        string table, pkey, parentName, parentKey;
+        /** row entry: result of loadXParamRow */
+        int found;
+        stringList fields, values;
+        /** list entry: value lists of parent, by field name */
+        std::map<string, stringList> lists;
+        std::list<string>::iterator lru;
+        /** keys of "index" that refer to this entry */
+        stringList indexes;
+    };
+    /** What a write may change. */
+    struct Invalidation {
+        enum Type { ROW, PARENT, TABLE, ALL } type;
+        string table, pkey, parentName, parentKey;
+    };
+    /** Invalidations of thread's transaction, repeated at commit. */
+    struct Pending {
+        Pending() : batches(0) {}
+        vector<Invalidation> invalidations;
+        /** number of open batches */
+        int batches;
+    };
+
+    static string rowKey(const string &pname, const string &pkey, const string &parentName,
+                         const string &parentKey);
+    static string listKey(const string &pname, const string &parentName,
+                          const string &parentKey);
+    static void cleanTBuffer(void *ptr);
+    /** Apply invalidations of "pending" and delete it. */
+    void applyPending(Pending *pending);
+
+    void invalidate(Invalidation::Type type, const string &pname, const string &pkey = "",
+                    const string &parentName = "", const string &parentKey = "");
+    /** apply invalidation, caller should hold "lock". */
+    void apply(const Invalidation &inv);
+    /** caller should hold "lock". */
+    void erase(const string &key);
+    /** erase entries of "index[ikey]", caller should hold "lock". */
+    void eraseIndexed(const string &ikey);
+    /**
+     * Add new entry, caller should hold "lock".
+     *
+     * Entry is indexed by fields of "proto", which become its fields.
+     */
+    void insert(const string &key, Entry &proto);
+    void touch(Entry &entry);
+
+    XDBEngine *engine;
+    size_t capacity;
+    std::mutex lock;
+    XHashMap<string, Entry> entries;
+    /** keys of entries, most recently used first */
+    std::list<string> lru;
+    /**
+     * Keys of entries that each invalidation may drop:
+     * "T<table>" all entries of table, "K<table,key>" rows by key,
+     * "P<table,parent>" rows by parent, "N<table>" rows loaded without
+     * parent and "S<table>" value lists.
+     */
+    std::map<string, std::set<string> > index;
+    /**
+     * Incremented by every invalidation, loads that raced with a write
+     * don't fill the cache.
+     */
+    unsigned long long generation;
+    XDBCacheStats counters;
+    /** Pending of thread's transaction */
+    pthread_key_t transactionTSMKey;
+};
+
+} // namespace pparam
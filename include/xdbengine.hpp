@@ -22,9 +22,18 @@
  */
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <pthread.h>
 #include <sqlite3.h>
+#include <thread>
 
 #include "exception.hpp"
 
@@ -43,6 +52,93 @@ typedef vector<string> stringList;
 
 enum DBFieldTypes { DBINTEGER, DBFLOAT, DBTEXT, DBDATETIME, DBBOOLEAN };
 
+/**
+ * \class XDBRow
+ * One row of a streamed result.
+ *
+ * Values point into the engine's buffers, they are valid only while the
+ * visitor is visiting this row; copy them to keep them.
+ */
+class XDBRow
+{
+public:
+    virtual int size() const = 0;
+    /** Name of column "index". */
+    virtual const char *column(int index) const = 0;
+    /** Value of column "index", NULL values are empty strings. */
+    virtual const char *value(int index) const = 0;
+    virtual size_t length(int index) const = 0;
+    string operator[](int index) const { return string(value(index), length(index)); }
+    virtual ~XDBRow() {}
+};
+
+/**
+ * \class XDBRowVisitor
+ * Receives rows of XDBEngine::query() one by one.
+ */
+class XDBRowVisitor
+{
+public:
+    /**
+     * \return false to stop the query.
+     */
+    virtual bool visit(const XDBRow &row) = 0;
+    virtual ~XDBRowVisitor() {}
+};
+
+/**
+ * \class XDBRowFunction
+ * Adapts a function (e.g. lambda) to XDBRowVisitor.
+ */
+class XDBRowFunction : public XDBRowVisitor
+{
+public:
+    XDBRowFunction(std::function<bool(const XDBRow &)> _func) : func(_func) {}
+    virtual bool visit(const XDBRow &row) { return func(row); }
+
+protected:
+    std::function<bool(const XDBRow &)> func;
+};
+
+/**
+ * \class XDBRowLoader
+ * Receives values of rows loaded by an XDBRowReader.
+ */
+class XDBRowLoader
+{
+public:
+    /**
+     * Names of value columns of the following rows, reader calls it on
+     * its first row and when columns of table change. Loaders of a
+     * reader share what they bind.
+     */
+    virtual void bindFields(const stringList &fields) = 0;
+    /** Value of "index"th field of bindFields() in current row. */
+    virtual void loadValue(unsigned int index, const char *value) = 0;
+    virtual ~XDBRowLoader() {}
+};
+
+/**
+ * \class XDBRowReader
+ * Loads rows of a table by their keys, like XDBEngine::loadXParamRow().
+ *
+ * Statement and columns of rows are prepared once, so loading many rows
+ * of a table doesn't build statements or look up names per row.
+ */
+class XDBRowReader
+{
+public:
+    /**
+     * Pass row of "pkey" (under "parentKey", if reader has a parent) to
+     * "loader".
+     * \return 1 if row is found, else 0.
+     */
+    virtual int load(const string &pkey, const string &parentKey, XDBRowLoader &loader) = 0;
+    virtual ~XDBRowReader() {}
+};
+
+class XDBExecutor;
+
 /**
  * \class XDBEngine
  * abstract class, defines common attributes/functions of database engines.
@@ -50,6 +146,7 @@ enum DBFieldTypes { DBINTEGER, DBFLOAT, DBTEXT, DBDATETIME, DBBOOLEAN };
 class XDBEngine
 {
 public:
+    virtual ~XDBEngine();
     virtual void connect(string connectionString) = 0;
     virtual void disconnect() = 0;
     virtual void execute(string command) = 0;
@@ -57,6 +154,20 @@ public:
     virtual void startTransaction() = 0;
     virtual void commitTransaction() = 0;
     virtual void rollbackTransaction() = 0;
+    /**
+     * Open a batch, use XDBBatch instead of calling it directly.
+     *
+     * Inside a batch startTransaction() opens a savepoint and
+     * commitTransaction()/rollbackTransaction() release or roll it back,
+     * so top-level writes join the batch. Batches nest; only the
+     * outermost one commits.
+     */
+    virtual void beginBatch() = 0;
+    /**
+     * Close the innermost batch, savepoints left open inside it are closed
+     * with it.
+     */
+    virtual void endBatch(bool commit) = 0;
 
     virtual void saveXParam(string pname, string pkey, string parentName, string parentKey,
                             stringList fields, stringList values) = 0;
@@ -67,11 +178,31 @@ public:
     virtual void removeXParam(string pname, string pkey, string parentName, string parentKey) = 0;
     virtual void removeXParam(string pname, string pkey) = 0;
     virtual void removeXParamByParent(string pname, string parentName, string parentKey) = 0;
+    /**
+     * Remove rows of a child of specified parent that their "fieldName"
+     * column is equal to "value".
+     *
+     * Single-valued members of a set don't have any key, so their value
+     * is the only way to address them.
+     */
+    virtual void removeXParamByValue(string pname, string parentName, string parentKey,
+                                     string fieldName, string value) = 0;
     virtual void createXParamStructure(string pname, string parentName, stringList fields,
                                        vector<DBFieldTypes> fieldTypes) = 0;
     virtual void createXParamStructure(string pname, stringList fields,
                                        vector<DBFieldTypes> fieldTypes) = 0;
     virtual void destroyXParamStructure(string pname) = 0;
+    /**
+     * Create an index on "fields" of "pname" table, if it doesn't exist.
+     */
+    virtual void createXParamIndex(string pname, stringList fields, bool unique = false) = 0;
+    /**
+     * Hold index creation until deferIndexes(false), bulk loads are
+     * faster when indexes are built once after loading.
+     *
+     * Engines without real indexes ignore it.
+     */
+    virtual void deferIndexes(bool defer) {}
 
     virtual int loadXParamRow(string pname, string pkey, string parentName, string parentKey,
                               stringList &fields, stringList &values) = 0;
@@ -79,6 +210,15 @@ public:
                               stringList &values) = 0;
     virtual int loadXParamValueListByParent(string pname, string parentName, string parentKey,
                                             string fieldName, stringList &values) = 0;
+    /**
+     * Reader of rows of "pname" table, children of "parentName" if it's
+     * not empty.
+     *
+     * Engines that can step their results override this, default reader
+     * goes through loadXParamRow().
+     */
+    virtual std::unique_ptr<XDBRowReader> rowReader(const string &pname,
+                                                    const string &parentName);
     virtual int loadXParamKeyListByParent(string pname, string parentName, string parentKey,
                                           stringList &values)
     {
@@ -86,11 +226,264 @@ public:
     }
     virtual void getData(string selectstmt, vector<vector<string> > &results,
                          vector<string> &columns) = 0;
+    /**
+     * Run a select statement with "?" placeholders, "params" are bound
+     * to placeholders in order.
+     *
+     * Engines that reuse prepared statements override this, default
+     * implementation puts quoted values in place of placeholders.
+     */
+    virtual void getData(string selectstmt, const stringList &params,
+                         vector<vector<string> > &results, vector<string> &columns);
+    /**
+     * Run a select statement and pass its rows to "visitor" one by one.
+     *
+     * Engines that can step their results override this to run in
+     * constant memory, default implementation goes through getData().
+     */
+    virtual void query(string selectstmt, const stringList &params, XDBRowVisitor &visitor);
+    void query(string selectstmt, XDBRowVisitor &visitor)
+    {
+        this->query(selectstmt, stringList(), visitor);
+    }
     virtual bool backup(string dest) = 0;
     virtual void cleanup() = 0;
+    /** Calling thread has an open transaction or batch. */
     virtual bool isOnTransaction() = 0;
     virtual string DBTypetoString(DBFieldTypes t) = 0;
     virtual bool isConnected() = 0;
+    /**
+     * Number of rollbacks (of transactions, batches and their savepoints)
+     * of this engine.
+     *
+     * Rollbacks may undo writes that are done before them, so tracked
+     * data of XParams (see _XMixParam::dbTrack()) that is taken before
+     * the last rollback isn't trusted.
+     * Decorators add rollbacks of their engine.
+     */
+    virtual unsigned long getRollbacks() { return rollbacks; }
+
+    /**
+     * Executor of asynchronous operations (dbSaveAsync() ...), it's
+     * created on first use.
+     */
+    XDBExecutor *executor();
+
+protected:
+    /**
+     * Run queued asynchronous operations and stop executor.
+     *
+     * Engines call it first in their destructor, operations need the
+     * whole engine.
+     */
+    void stopExecutor();
+    /** Engines call it when they roll back any write, see getRollbacks(). */
+    void countRollback() { rollbacks++; }
+
+private:
+    std::unique_ptr<XDBExecutor> asyncExecutor;
+    std::mutex asyncExecutorLock;
+    std::atomic<unsigned long> rollbacks{0};
+};
+
+/**
+ * \class XDBExecutor
+ * Thread that runs database operations of an engine asynchronously.
+ *
+ * Operations run in the order they are submitted. Writes that are queued
+ * together run in one batch (XDBBatch), so concurrent callers share
+ * commits; if the batch fails to commit, all of its writes fail. Reads
+ * run alone, so they see writes that were submitted before them.
+ *
+ * \code
+ * std::future<void> saved = vm.dbSaveAsync();
+ * ...
+ * saved.get(); // throws if save failed
+ * \endcode
+ *
+ * A thread that has a transaction or batch open may hold the engine
+ * until it's closed (SQLiteDBEngine does), so operations it submits then
+ * run inline, as part of its transaction, instead of being queued.
+ */
+class XDBExecutor
+{
+public:
+    /**
+     * \param _maxBatch maximum number of writes in one batch.
+     */
+    XDBExecutor(XDBEngine *_engine, size_t _maxBatch = 256);
+    /** Run queued operations and stop. */
+    ~XDBExecutor();
+    XDBExecutor(const XDBExecutor &) = delete;
+    XDBExecutor &operator=(const XDBExecutor &) = delete;
+
+    /**
+     * Queue "task", future is ready when it's done (and committed, for
+     * writes). Exception of task is thrown by future.
+     *
+     * Inside a transaction or batch of calling thread, "task" runs before
+     * submit() returns, and its writes commit with that transaction.
+     * \param write task writes to database, so it may be batched.
+     */
+    std::future<void> submit(std::function<void()> task, bool write = true);
+    /** Number of queued operations. */
+    size_t pending();
+
+protected:
+    struct Task {
+        std::function<void()> run;
+        bool write;
+        std::promise<void> done;
+    };
+
+    void worker();
+    /** Run "tasks" in one batch and fulfill them. */
+    void runWrites(vector<Task> &tasks);
+
+    XDBEngine *engine;
+    size_t maxBatch;
+    std::deque<Task> queue;
+    std::mutex lock;
+    std::condition_variable queueCond;
+    bool stopping;
+    std::thread workerThread;
+};
+
+/**
+ * \class XDBBatch
+ * Scope that groups writes of its lifetime into one transaction.
+ *
+ * Top-level dbSave()/dbUpdate()/dbDelete() calls inside the scope join the
+ * batch instead of committing by themselves, so bulk loads pay for one
+ * commit. Batches nest.
+ *
+ * The batch commits when it goes out of scope, or rolls back when it's
+ * left by an exception.
+ *
+ * \code
+ * {
+ *     XDBBatch batch(engine);
+ *     for (...)
+ *         vm.dbSave();
+ * }
+ * \endcode
+ */
+class XDBBatch
+{
+public:
+    XDBBatch(XDBEngine *_engine);
+    /**
+     * Commit batch if it's open, or roll it back when an exception is
+     * being thrown. Failure of commit is thrown.
+     */
+    ~XDBBatch() noexcept(false);
+    XDBBatch(const XDBBatch &) = delete;
+    XDBBatch &operator=(const XDBBatch &) = delete;
+
+    void commit();
+    void rollback();
+    bool isOpen() { return open; }
+
+protected:
+    XDBEngine *engine;
+    bool open;
+    /** uncaught exceptions when batch opened */
+    int exceptions;
+};
+
+/**
+ * \class XDBImportStats
+ * Progress of a bulk import (XSetParam::dbImportXml).
+ */
+struct XDBImportStats {
+    XDBImportStats() : items(0), bytes(0), seconds(0) {}
+    /** saved members, each one is a row plus rows of its children */
+    unsigned long long items;
+    /** bytes of document read */
+    unsigned long long bytes;
+    double seconds;
+    double itemsPerSecond() const { return seconds > 0 ? items / seconds : 0; }
+};
+
+/**
+ * \class XDBBackupProgress
+ * State of a running backup, in database pages.
+ */
+struct XDBBackupProgress {
+    XDBBackupProgress() : remaining(0), total(0), restarts(0) {}
+    int remaining;
+    int total;
+    /** times backup started over, because source was changed */
+    int restarts;
+};
+
+/**
+ * \class XDBBackupOptions
+ * Options of SQLiteDBEngine::backupAsync().
+ */
+struct XDBBackupOptions {
+    XDBBackupOptions() : pagesPerStep(64), bytesPerSecond(0), stepDelay(1) {}
+    /** pages copied by each step, source is read-locked during a step. */
+    int pagesPerStep;
+    /** I/O rate limit, 0 means unlimited. */
+    size_t bytesPerSecond;
+    /** milliseconds to sleep between steps, so writers can get the lock. */
+    int stepDelay;
+    /** called by backup thread after each step. */
+    std::function<void(const XDBBackupProgress &)> progress;
+};
+
+/**
+ * \class XDBBackupTask
+ * Handle of a backup that runs on its own thread.
+ *
+ * Backup is written to "<dest>.tmp" and renamed to "dest" when it's
+ * complete, so "dest" is never left half written.
+ * Destroying the handle cancels the backup and waits for its thread.
+ */
+class XDBBackupTask
+{
+public:
+    ~XDBBackupTask();
+
+    /** Stop the backup, future() holds an Exception afterwards. */
+    void cancel();
+    bool isDone() { return finished; }
+    XDBBackupProgress getProgress();
+    /**
+     * Ready when backup finishes, holds an Exception if backup failed or
+     * was canceled.
+     */
+    std::shared_future<void> future() { return done; }
+    /** Wait for backup to finish, throws Exception if it failed. */
+    void wait() { done.get(); }
+
+protected:
+    friend class SQLiteDBEngine;
+    /**
+     * \param _source connection to copy from.
+     * \param _ownsSource close "_source" when backup finishes.
+     */
+    XDBBackupTask(sqlite3 *_source, bool _ownsSource, const string &_dest,
+                  const XDBBackupOptions &_options);
+    void run();
+    /** Cancel and wait for backup thread. */
+    void stop();
+    /** Sleep "ms" milliseconds, or until canceled. */
+    void sleep(long ms);
+
+    sqlite3 *source;
+    bool ownsSource;
+    string dest;
+    XDBBackupOptions options;
+    std::atomic<bool> canceled, finished;
+    std::mutex lock;
+    std::condition_variable cancelCond;
+    XDBBackupProgress progress;
+    std::promise<void> result;
+    std::shared_future<void> done;
+    std::mutex workerLock;
+    std::thread worker;
 };
 
 class SQLiteDBEngine : public XDBEngine
@@ -106,6 +499,16 @@ public:
     virtual void startTransaction();
     virtual void commitTransaction();
     virtual void rollbackTransaction();
+    /**
+     * Batches are SQLite savepoints, statements inside them run
+     * immediately. If a statement fails inside a savepoint of a
+     * transaction, changes are rolled back to that savepoint.
+     *
+     * A batch (or transaction) belongs to the thread that opened it,
+     * writes and transactions of other threads wait until it's closed.
+     */
+    virtual void beginBatch();
+    virtual void endBatch(bool commit);
 
     virtual void saveXParam(string pname, string pkey, string parentName, string parentKey,
                             stringList fields, stringList values);
@@ -116,29 +519,133 @@ public:
     virtual void removeXParam(string pname, string pkey, string parentName, string parentKey);
     virtual void removeXParam(string pname, string pkey);
     virtual void removeXParamByParent(string pname, string parentName, string parentKey);
+    virtual void removeXParamByValue(string pname, string parentName, string parentKey,
+                                     string fieldName, string value);
     virtual void createXParamStructure(string pname, string parentName, stringList fields,
                                        vector<DBFieldTypes> fieldTypes);
     virtual void createXParamStructure(string pname, stringList fields,
                                        vector<DBFieldTypes> fieldTypes);
     virtual void destroyXParamStructure(string pname);
+    virtual void createXParamIndex(string pname, stringList fields, bool unique = false);
+    virtual void deferIndexes(bool defer);
 
     virtual int loadXParamRow(string pname, string pkey, string parentName, string parentKey,
                               stringList &fields, stringList &values);
     virtual int loadXParamRow(string pname, string pkey, stringList &fields, stringList &values);
     virtual int loadXParamValueListByParent(string pname, string parentName, string parentKey,
                                             string fieldName, stringList &values);
+    virtual std::unique_ptr<XDBRowReader> rowReader(const string &pname,
+                                                    const string &parentName);
     virtual void getData(string selectstmt, vector<vector<string> > &results,
                          vector<string> &columns);
-    virtual bool isOnTransaction() { return onTransaction; }
+    virtual void getData(string selectstmt, const stringList &params,
+                         vector<vector<string> > &results, vector<string> &columns);
+    using XDBEngine::query;
+    virtual void query(string selectstmt, const stringList &params, XDBRowVisitor &visitor);
+    virtual bool isOnTransaction() { return connectionOwner == std::this_thread::get_id(); }
     virtual bool isConnected() { return isconnected; }
+    /**
+     * Copy database to "dest", blocks until it's done.
+     */
     virtual bool backup(string dest);
+    /**
+     * Copy database to "dest" on a background thread.
+     *
+     * File databases are read by a separate read-only connection, so
+     * this engine is never blocked and writers are blocked only during
+     * a step. When another connection changes the database, SQLite
+     * restarts the copy by itself; it's reported by "restarts".
+     * In-memory databases are copied from this engine's connection, so
+     * disconnect() cancels their backups.
+     */
+    std::shared_ptr<XDBBackupTask> backupAsync(string dest,
+                                               const XDBBackupOptions &options = XDBBackupOptions());
     virtual void cleanup();
     virtual string DBTypetoString(DBFieldTypes t);
 
 protected:
+    /**
+     * Get prepared statement of "sql" from statement cache, or prepare it.
+     *
+     * Statement is taken out of cache while in use, so threads never
+     * share it. Give it back by releaseStatement().
+     */
+    sqlite3_stmt *prepareStatement(const string &sql);
+    /**
+     * Prepare "sql" and bind "params" to it.
+     */
+    sqlite3_stmt *prepareStatement(const string &sql, const stringList &params);
+    void releaseStatement(const string &sql, sqlite3_stmt *stmt);
+    void clearStatements();
+    /**
+     * Run a write statement with "params" bound to its placeholders,
+     * statement is kept in statement cache.
+     *
+     * Buffered transactions can't hold bound statements, don't use it
+     * while "onTransaction".
+     */
+    void executeStatement(const string &sql, const stringList &params);
+    /**
+     * Reader of rows that keeps a cached statement until it's destroyed.
+     */
+    class RowReader;
+    /** Roll back failed transaction inside a batch to its savepoint. */
+    void rollbackFailedLevel();
+    /** name of savepoint of level "level" of batchLevels */
+    static string savepoint(unsigned int level);
+    /** Roll back to savepoint of level "level" and release it. */
+    void rollbackTo(unsigned int level);
+    /**
+     * Take "connectionLock" for the thread that opened a transaction or
+     * batch, or give it back when the last one is closed. Caller holds
+     * "connectionLock".
+     */
+    void updateOwner();
+
+    /**
+     * Holds "connectionLock" during an operation, and updates owner of
+     * connection when operation is done.
+     */
+    class ConnectionGuard
+    {
+    public:
+        ConnectionGuard(SQLiteDBEngine *_engine) : engine(_engine)
+        {
+            engine->connectionLock.lock();
+        }
+        ~ConnectionGuard()
+        {
+            engine->updateOwner();
+            engine->connectionLock.unlock();
+        }
+
+    protected:
+        SQLiteDBEngine *engine;
+    };
+
     sqlite3 *dbp;
     pthread_key_t transactionBufferTSMKey;
     bool onTransaction, isconnected;
+    /** Prepared statements keyed by their text. */
+    std::map<string, sqlite3_stmt *> statements;
+    /** guards "statements" */
+    pthread_mutex_t statementsLock;
+    /** open savepoints, true for batches, false for their transactions */
+    vector<bool> batchLevels;
+    /**
+     * A connection has one transaction, so statements of other threads
+     * would join an open transaction/batch. Writes hold this lock, and
+     * thread of an open transaction/batch holds it until it's closed.
+     */
+    std::recursive_mutex connectionLock;
+    /** thread that holds "connectionLock" for an open transaction/batch */
+    std::atomic<std::thread::id> connectionOwner;
+    /** CREATE INDEX statements held by deferIndexes() */
+    bool indexesDeferred;
+    stringList deferredIndexes;
+    /** backups that read from "dbp" */
+    vector<std::weak_ptr<XDBBackupTask> > backups;
+    std::mutex backupsLock;
 };
 
 class XDBCondition
@@ -194,18 +701,22 @@ public:
         else
             addCondition(field + " NOT BETWEEN '" + startv + "' AND '" + endv + "'");
     }
+    /**
+     * Values of list overloads are quoted here, pass them unquoted; the
+     * string overload takes an SQL list as is.
+     */
     virtual void addConditionIn(string field, vector<string> values, int num, bool inverse = false)
     {
         std::stringstream buff;
         for (unsigned int i = 0; i < values.size(); i++)
-            buff << values[i];
+            buff << (i == 0 ? "" : ",") << literal(values[i]);
         this->addConditionIn(field, buff.str(), inverse);
     }
     virtual void addConditionIn(string field, string *values, int num, bool inverse = false)
     {
         std::stringstream buff;
         for (int i = 0; i < num; i++)
-            buff << values[i];
+            buff << (i == 0 ? "" : ",") << literal(values[i]);
         this->addConditionIn(field, buff.str(), inverse);
     }
     virtual void addConditionIn(string field, string values, bool inverse = false)
@@ -224,13 +735,134 @@ public:
     }
     virtual void setConditions(string conditions)
     {
-        _conditions.clear();
+        this->clearConditions();
         _conditions << conditions;
     }
     virtual string getConditions() { return _conditions.str(); }
-    virtual void clearConditions() { _conditions.clear(); }
+    virtual void clearConditions()
+    {
+        _conditions.str("");
+        _conditions.clear();
+    }
 
 protected:
+    /** "value" as a quoted SQL literal, its quotes are doubled. */
+    static string literal(const string &value)
+    {
+        string quoted = "'";
+        for (unsigned int i = 0; i < value.size(); i++)
+            quoted += (value[i] == '\'') ? "''" : string(1, value[i]);
+        return quoted + "'";
+    }
+
     std::stringstream _conditions;
 };
+
+/**
+ * \class XDBExpr
+ * Condition of a query as an expression tree.
+ *
+ * Unlike XDBCondition, values are not put in SQL text. compile() emits
+ * "?" placeholders and collects values separately, so queries with the
+ * same shape have the same text and engines can reuse their plans.
+ *
+ * \code
+ * XDBExpr cond = XDBExpr::equal("vm.state", "running") &&
+ *                !XDBExpr::in("vm.owner", owners);
+ * vms.dbQuery(cond);
+ * \endcode
+ */
+class XDBExpr
+{
+public:
+    enum Type { EMPTY, EQ, NE, GT, GE, LT, LE, LIKE, IN, BETWEEN, AND, OR, NOT };
+
+    /** Empty expression, matches everything. */
+    XDBExpr() : type(EMPTY) {}
+
+    static XDBExpr equal(const string &field, const string &value);
+    static XDBExpr notEqual(const string &field, const string &value);
+    static XDBExpr greaterThan(const string &field, const string &value);
+    static XDBExpr greaterThanOrEqual(const string &field, const string &value);
+    static XDBExpr lessThan(const string &field, const string &value);
+    static XDBExpr lessThanOrEqual(const string &field, const string &value);
+    static XDBExpr like(const string &field, const string &pattern);
+    static XDBExpr in(const string &field, const stringList &values);
+    static XDBExpr between(const string &field, const string &startv, const string &endv);
+
+    XDBExpr operator&&(const XDBExpr &expr) const { return combine(AND, expr); }
+    XDBExpr operator||(const XDBExpr &expr) const { return combine(OR, expr); }
+    XDBExpr operator!() const;
+
+    /**
+     * Generate SQL of expression.
+     * \param [out] params values of placeholders are appended to it.
+     * \return SQL text with "?" placeholders.
+     */
+    string compile(stringList &params) const;
+    bool empty() const { return type == EMPTY; }
+    Type getType() const { return type; }
+
+protected:
+    XDBExpr(Type _type, const string &_field, const stringList &_values) :
+        type(_type), field(_field), values(_values)
+    {
+    }
+    XDBExpr combine(Type _type, const XDBExpr &expr) const;
+
+    Type type;
+    string field;
+    stringList values;
+    /** operands of AND, OR and NOT. */
+    vector<XDBExpr> operands;
+};
+
+/**
+ * \class XDBPageCursor
+ * Position of a keyset-paginated query, see XSetParam::dbQueryPage().
+ *
+ * A default cursor starts from the first page. Cursor of the next page
+ * remembers order value and key of last row of its page, so next page is
+ * found by an index seek instead of skipping rows; cost of a page doesn't
+ * depend on its number.
+ *
+ * token() makes a printable string of cursor for clients, fromToken()
+ * reads it back.
+ */
+class XDBPageCursor
+{
+public:
+    /** Cursor of first page. */
+    XDBPageCursor() : started(false), end(false), descending(false) {}
+    /** Cursor of page after row ("value", "key") of order "orderBy". */
+    XDBPageCursor(const string &_orderBy, bool _descending, const string &_value,
+                  const string &_key) :
+        started(true),
+        end(false), descending(_descending), orderBy(_orderBy), value(_value), key(_key)
+    {
+    }
+    /** Cursor after last page. */
+    static XDBPageCursor endCursor();
+
+    bool isStart() const { return !started; }
+    bool isEnd() const { return end; }
+    bool isDescending() const { return descending; }
+    const string &getOrderBy() const { return orderBy; }
+    const string &getValue() const { return value; }
+    const string &getKey() const { return key; }
+
+    /**
+     * Condition of rows after this cursor.
+     * \param orderColumn column of order, "" if rows are ordered by key.
+     * \param keyColumn column of key.
+     */
+    XDBExpr condition(const string &orderColumn, const string &keyColumn) const;
+    string token() const;
+    /** Throws Exception if "token" is malformed. */
+    static XDBPageCursor fromToken(const string &token);
+
+protected:
+    bool started, end, descending;
+    string orderBy, value, key;
+};
 } // namespace pparam
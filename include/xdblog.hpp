@@ -0,0 +1,238 @@
+/**
+ * \file xdblog.hpp
+ * defines log-structured database engine.
+ *
+ * Copyright 2010-2022 Cloud Avid Co. (www.cloudavid.com)
+ *
+ * xparam is part of PParam.
+ *
+ * PParam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PParam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PParam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "xdbbuffered.hpp"
+#include "xhashmap.hpp"
+
+namespace pparam
+{
+
+/** Records of a commit of LogDBEngine, written as one frame. */
+struct LogDBFrame {
+    string body;
+    XDBUndoLog undo;
+    /** segment and offset of body */
+    unsigned int segment;
+    unsigned long long base;
+};
+
+/**
+ * \class LogDBEngine
+ * XDBEngine that appends rows to log files.
+ *
+ * Connection string is a directory of segment files. Every commit (or
+ * single write) is appended to the active segment as one checksummed
+ * frame of records, so a write costs one sequential append. Frames that
+ * were cut by a crash are dropped at recovery.
+ *
+ * Only locations of rows are kept in memory: a hash index maps
+ * (table, key, parent key) to offset of latest record of row, rows of
+ * each parent are kept in insertion order.
+ *
+ * Active segment is sealed when it grows beyond "segmentSize". Updated
+ * and removed rows leave dead records behind; a background thread
+ * rewrites live records of sealed segments into a new segment and
+ * deletes them when more than "compactRatio" of their bytes are dead
+ * (cleanup() compacts at once).
+ *
+ * connect() rebuilds the index by scanning segments, or loads the index
+ * checkpoint that disconnect() writes. backup() writes a compacted copy
+ * of database to a directory.
+ *
+ * Like MemoryDBEngine, it doesn't understand SQL and transactions are
+ * buffered per thread.
+ */
+class LogDBEngine : public XDBBufferedEngine<LogDBFrame>
+{
+public:
+    /**
+     * \param _segmentSize size of segment files.
+     * \param _syncWrites fsync every commit; without it a power failure
+     *        may lose last commits, but never corrupts database.
+     * \param _compactRatio ratio of dead bytes that triggers compaction.
+     */
+    LogDBEngine(size_t _segmentSize = 64 << 20, bool _syncWrites = true,
+                double _compactRatio = 0.5);
+    virtual ~LogDBEngine();
+
+    virtual void connect(string connectionString);
+    virtual void disconnect();
+    virtual void execute(string command);
+
+    virtual void saveXParam(string pname, string pkey, string parentName, string parentKey,
+                            stringList fields, stringList values);
+    virtual void saveXParam(string pname, string pkey, stringList fields, stringList values);
+    virtual void updateXParam(string pname, string pkey, string parentName, string parentKey,
+                              stringList fields, stringList values);
+    virtual void updateXParam(string pname, string pkey, stringList fields, stringList values);
+    virtual void removeXParam(string pname, string pkey, string parentName, string parentKey);
+    virtual void removeXParam(string pname, string pkey);
+    virtual void removeXParamByParent(string pname, string parentName, string parentKey);
+    virtual void removeXParamByValue(string pname, string parentName, string parentKey,
+                                     string fieldName, string value);
+    virtual void createXParamStructure(string pname, string parentName, stringList fields,
+                                       vector<DBFieldTypes> fieldTypes);
+    virtual void createXParamStructure(string pname, stringList fields,
+                                       vector<DBFieldTypes> fieldTypes);
+    virtual void destroyXParamStructure(string pname);
+    virtual void createXParamIndex(string pname, stringList fields, bool unique = false);
+
+    virtual int loadXParamRow(string pname, string pkey, string parentName, string parentKey,
+                              stringList &fields, stringList &values);
+    virtual int loadXParamRow(string pname, string pkey, stringList &fields, stringList &values);
+    virtual int loadXParamValueListByParent(string pname, string parentName, string parentKey,
+                                            string fieldName, stringList &values);
+    virtual void getData(string selectstmt, vector<vector<string> > &results,
+                         vector<string> &columns);
+    virtual bool backup(string dest);
+    virtual void cleanup();
+    virtual bool isConnected() { return isconnected; }
+
+    /** Compact all of the sealed segments now. */
+    void compact();
+    /** Ratio of dead bytes in sealed segments. */
+    double garbageRatio();
+
+protected:
+    typedef LogDBFrame Frame;
+    /** Where a record is stored. */
+    struct Location {
+        Location() : segment(0), offset(0), length(0) {}
+        unsigned int segment;
+        unsigned long long offset;
+        unsigned int length;
+        bool operator==(const Location &loc) const
+        {
+            return segment == loc.segment && offset == loc.offset;
+        }
+    };
+    struct Row {
+        /** key as stored, rows without key get an internal one */
+        string pkey, parentKey;
+        Location location;
+        /** insertion order in table */
+        unsigned long long seq;
+    };
+    struct Table {
+        Table() : seq(0) {}
+        string name, parentName;
+        stringList columns;
+        vector<DBFieldTypes> columnTypes;
+        /** location of record that created table */
+        Location location;
+        /** rows keyed by rowKey(pkey, parentKey) */
+        XHashMap<string, Row> rows;
+        /** row keys of each parent, in insertion order */
+        XHashMap<string, std::map<unsigned long long, string> > children;
+        unsigned long long seq;
+    };
+    struct Segment {
+        Segment() : fd(-1), size(0), live(0) {}
+        int fd;
+        unsigned long long size;
+        /** bytes of live records */
+        unsigned long long live;
+    };
+    /** Live records to be copied by compaction or backup. */
+    struct Image {
+        /** schema of tables, their rows are in "rows" */
+        vector<Table> tables;
+        /** key and location of rows of each table, in insertion order */
+        vector<vector<std::pair<string, Location> > > rows;
+        /** descriptors of segments that hold the records */
+        std::map<unsigned int, int> fds;
+    };
+
+    /** Run operations and write their frame, caller holds write lock. */
+    virtual void apply(const vector<Operation> &ops);
+    Table &table(const string &pname);
+    /** Append "record" to frame. */
+    static Location append(Frame &frame, const string &record);
+    /** Read record at "location", "frame" holds records that aren't written yet. */
+    string readRecord(const Location &location, const Frame *frame = NULL);
+    /** Read values of row. */
+    stringList readRow(const Table &table, const Row &row, const Frame *frame = NULL);
+
+    // primitives, they append records and record their inverse in frame
+    void putRow(Frame &frame, Table &table, const string &pkey, const string &parentKey,
+                const stringList &values);
+    void eraseRow(Frame &frame, Table &table, const string &key);
+
+    // index maintenance, used by primitives and recovery
+    void indexRow(Table &table, const string &pkey, const string &parentKey,
+                  const Location &location);
+    void unindexRow(Table &table, const string &key);
+    /** Count record as live ("sign" 1) or dead (-1). */
+    void addLive(const Location &location, int sign);
+
+    string segmentPath(unsigned int id);
+    /** Seal active segment and open a new one. */
+    void rollSegment();
+    void writeFrame(const string &body);
+    /** Scan frames of segment into index. */
+    void replaySegment(unsigned int id, unsigned long long from, bool last);
+    void replayRecord(const string &record, const Location &location);
+    void recover();
+    void writeCheckpoint();
+    bool loadCheckpoint();
+    /** Recount live bytes of segments from index. */
+    void recount();
+    /** Live records, caller holds lock. */
+    void takeImage(Image &image);
+    /**
+     * Write "image" to "fd" as segment "segment", which resets older
+     * segments.
+     * \param [out] tableLocations new locations of tables.
+     * \param [out] locations new locations of rows, in image order.
+     * \return size of segment.
+     */
+    unsigned long long writeImage(int fd, unsigned int segment, const Image &image,
+                                  vector<Location> &tableLocations,
+                                  vector<vector<Location> > &locations);
+    void compactor();
+
+    std::map<string, Table> tables;
+    std::map<unsigned int, Segment> segments;
+    unsigned int activeSegment;
+    size_t segmentSize;
+    bool syncWrites;
+    double compactRatio;
+    string directory;
+    bool isconnected;
+    /** sequence for keys of rows without key */
+    unsigned long long anonymousSeq;
+
+    /** only one compaction runs at a time */
+    std::mutex compactLock;
+    std::mutex compactorLock;
+    std::condition_variable compactorCond;
+    bool stopCompactor;
+    std::thread compactorThread;
+};
+
+} // namespace pparam
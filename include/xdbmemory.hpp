@@ -0,0 +1,133 @@
+/**
+ * \file xdbmemory.hpp
+ * defines in-memory database engine.
+ *
+ * Copyright 2010-2022 Cloud Avid Co. (www.cloudavid.com)
+ *
+ * xparam is part of PParam.
+ *
+ * PParam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PParam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PParam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <map>
+
+#include "xdbbuffered.hpp"
+#include "xhashmap.hpp"
+
+namespace pparam
+{
+
+/**
+ * \class MemoryDBEngine
+ * XDBEngine that keeps tables in memory.
+ *
+ * Each table is a hash map keyed by (key, parent key) plus a map from
+ * parent keys to their rows, so every XParam operation is a hash lookup.
+ * Rows of a parent are kept in insertion order, same as SQLite returns
+ * them.
+ *
+ * It's meant for tests and runtime-only data:
+ * - It doesn't understand SQL, execute()/getData()/query() throw.
+ * - connect() loads the snapshot file if it exists, disconnect() and
+ *   backup() write snapshot files. Empty connection string (or
+ *   ":memory:") means no file at all.
+ *
+ * Transactions are buffered per thread and applied at commit under the
+ * write lock; if an operation fails, applied ones are undone. Batches
+ * are buffered the same way, so failures are found when the outermost
+ * batch commits, and roll back all of it.
+ *
+ * createXParamIndex() only checks its fields, lookups by key and by
+ * parent key are hashed already and no other lookup exists.
+ */
+class MemoryDBEngine : public XDBBufferedEngine<XDBUndoLog>
+{
+public:
+    MemoryDBEngine();
+    virtual ~MemoryDBEngine();
+
+    virtual void connect(string connectionString);
+    virtual void disconnect();
+    virtual void execute(string command);
+
+    virtual void saveXParam(string pname, string pkey, string parentName, string parentKey,
+                            stringList fields, stringList values);
+    virtual void saveXParam(string pname, string pkey, stringList fields, stringList values);
+    virtual void updateXParam(string pname, string pkey, string parentName, string parentKey,
+                              stringList fields, stringList values);
+    virtual void updateXParam(string pname, string pkey, stringList fields, stringList values);
+    virtual void removeXParam(string pname, string pkey, string parentName, string parentKey);
+    virtual void removeXParam(string pname, string pkey);
+    virtual void removeXParamByParent(string pname, string parentName, string parentKey);
+    virtual void removeXParamByValue(string pname, string parentName, string parentKey,
+                                     string fieldName, string value);
+    virtual void createXParamStructure(string pname, string parentName, stringList fields,
+                                       vector<DBFieldTypes> fieldTypes);
+    virtual void createXParamStructure(string pname, stringList fields,
+                                       vector<DBFieldTypes> fieldTypes);
+    virtual void destroyXParamStructure(string pname);
+    virtual void createXParamIndex(string pname, stringList fields, bool unique = false);
+
+    virtual int loadXParamRow(string pname, string pkey, string parentName, string parentKey,
+                              stringList &fields, stringList &values);
+    virtual int loadXParamRow(string pname, string pkey, stringList &fields, stringList &values);
+    virtual int loadXParamValueListByParent(string pname, string parentName, string parentKey,
+                                            string fieldName, stringList &values);
+    virtual void getData(string selectstmt, vector<vector<string> > &results,
+                         vector<string> &columns);
+    virtual bool backup(string dest);
+    virtual void cleanup();
+    virtual bool isConnected() { return isconnected; }
+
+protected:
+    struct Row {
+        string pkey, parentKey;
+        stringList values;
+        /** insertion order in table */
+        unsigned long long seq;
+    };
+    struct Table {
+        Table() : seq(0) {}
+        string name, parentName;
+        stringList columns;
+        vector<DBFieldTypes> columnTypes;
+        /** rows keyed by rowKey(pkey, parentKey) */
+        XHashMap<string, Row> rows;
+        /** row keys of each parent, in insertion order */
+        XHashMap<string, std::map<unsigned long long, string> > children;
+        unsigned long long seq;
+    };
+
+    /** Run operations on tables, caller holds write lock. */
+    virtual void apply(const vector<Operation> &ops);
+    Table &table(const string &pname);
+
+    // primitives, they record their inverse in "undo"
+    void insertRow(const string &pname, Row row, UndoLog &undo);
+    void eraseRow(const string &pname, const string &key, UndoLog &undo);
+    void setValue(const string &pname, const string &key, int column, const string &value,
+                  UndoLog &undo);
+
+    void loadSnapshot(const string &fileName);
+    void writeSnapshot(const string &fileName);
+
+    std::map<string, Table> tables;
+    string fileName;
+    bool isconnected;
+    /** sequence for keys of rows without key */
+    unsigned long long anonymousSeq;
+};
+
+} // namespace pparam
@@ -0,0 +1,321 @@
+/**
+ * \file xdbprofiler.hpp
+ * defines instrumentation decorator of database engines.
+ *
+ * Copyright 2010-2022 Cloud Avid Co. (www.cloudavid.com)
+ *
+ * xparam is part of PParam.
+ *
+ * PParam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PParam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PParam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+
+#include "sparam.hpp"
+#include "xdbengine.hpp"
+#include "xparam.hpp"
+
+namespace pparam
+{
+
+/**
+ * \class XDBLatencyHistogram
+ * Log-linear histogram of latencies in nanoseconds (like HdrHistogram).
+ *
+ * Each power of two is split into 16 buckets, so recorded values are
+ * kept with 1/16 relative precision in constant memory.
+ */
+class XDBLatencyHistogram
+{
+public:
+    XDBLatencyHistogram();
+    void record(unsigned long long value);
+    void merge(const XDBLatencyHistogram &histogram);
+    void reset();
+    unsigned long long count() const { return total; }
+    unsigned long long min() const { return total ? minValue : 0; }
+    unsigned long long max() const { return maxValue; }
+    double mean() const { return total ? (double)sum / total : 0; }
+    /**
+     * Value that "percent" percent of recorded values are not greater
+     * than, e.g. percentile(99).
+     */
+    unsigned long long percentile(double percent) const;
+
+protected:
+    static const int SUB_BUCKETS = 16;
+    static const int BUCKETS = 61 * SUB_BUCKETS;
+    static int bucketOf(unsigned long long value);
+    /** smallest value of bucket */
+    static unsigned long long lowerBound(int bucket);
+
+    unsigned long long counts[BUCKETS];
+    unsigned long long total, sum, minValue, maxValue;
+};
+
+/**
+ * \class XDBOperationStats
+ * Counters of one operation on one table.
+ */
+struct XDBOperationStats {
+    XDBOperationStats() : count(0), errors(0), rows(0), bytes(0) {}
+    string operation;
+    /** empty for SQL statements and commits */
+    string table;
+    unsigned long long count;
+    unsigned long long errors;
+    /** rows written or read */
+    unsigned long long rows;
+    /** bytes of values written or read */
+    unsigned long long bytes;
+    XDBLatencyHistogram latency;
+};
+
+/**
+ * \class XDBSlowQuery
+ * Entry of slow-query log.
+ */
+struct XDBSlowQuery {
+    std::chrono::system_clock::time_point time;
+    string operation, table;
+    /** key of row, or SQL statement */
+    string detail;
+    std::chrono::nanoseconds latency;
+    bool failed;
+};
+
+class XDBProfilerParam;
+
+/**
+ * \class XDBProfiler
+ * XDBEngine decorator that measures operations of its engine.
+ *
+ * Count, errors, rows, bytes and latency histogram of each operation are
+ * kept per table. Operations slower than a threshold are kept in a
+ * bounded slow-query log. Results are available as structures, text
+ * (report()) or an XParam tree (snapshot()).
+ *
+ * Disabled profiler only checks a flag before calling its engine.
+ *
+ * \code
+ * XDBProfiler profiler(&sqlite);
+ * profiler.setSlowThreshold(std::chrono::milliseconds(10));
+ * vms.setDBEngine(&profiler);
+ * ...
+ * cout << profiler.report();
+ * \endcode
+ */
+class XDBProfiler : public XDBEngine
+{
+public:
+    enum Operation {
+        SAVE,
+        UPDATE,
+        REMOVE,
+        LOAD_ROW,
+        LOAD_BY_PARENT,
+        GET_DATA,
+        EXECUTE,
+        COMMIT,
+        MAX_OPERATION
+    };
+    static const string operationString[MAX_OPERATION];
+
+    /**
+     * \param _engine underlying engine, it's not owned by profiler.
+     */
+    XDBProfiler(XDBEngine *_engine, bool _enabled = true);
+    virtual ~XDBProfiler();
+
+    virtual void connect(string connectionString) { engine->connect(connectionString); }
+    virtual void disconnect() { engine->disconnect(); }
+    virtual void execute(string command);
+
+    virtual void startTransaction() { engine->startTransaction(); }
+    virtual void commitTransaction();
+    virtual void rollbackTransaction() { engine->rollbackTransaction(); }
+    virtual void beginBatch() { engine->beginBatch(); }
+    virtual void endBatch(bool commit);
+
+    virtual void saveXParam(string pname, string pkey, string parentName, string parentKey,
+                            stringList fields, stringList values);
+    virtual void saveXParam(string pname, string pkey, stringList fields, stringList values);
+    virtual void updateXParam(string pname, string pkey, string parentName, string parentKey,
+                              stringList fields, stringList values);
+    virtual void updateXParam(string pname, string pkey, stringList fields, stringList values);
+    virtual void removeXParam(string pname, string pkey, string parentName, string parentKey);
+    virtual void removeXParam(string pname, string pkey);
+    virtual void removeXParamByParent(string pname, string parentName, string parentKey);
+    virtual void removeXParamByValue(string pname, string parentName, string parentKey,
+                                     string fieldName, string value);
+    virtual void createXParamStructure(string pname, string parentName, stringList fields,
+                                       vector<DBFieldTypes> fieldTypes)
+    {
+        engine->createXParamStructure(pname, parentName, fields, fieldTypes);
+    }
+    virtual void createXParamStructure(string pname, stringList fields,
+                                       vector<DBFieldTypes> fieldTypes)
+    {
+        engine->createXParamStructure(pname, fields, fieldTypes);
+    }
+    virtual void destroyXParamStructure(string pname) { engine->destroyXParamStructure(pname); }
+    virtual void createXParamIndex(string pname, stringList fields, bool unique = false)
+    {
+        engine->createXParamIndex(pname, fields, unique);
+    }
+    virtual void deferIndexes(bool defer) { engine->deferIndexes(defer); }
+
+    virtual int loadXParamRow(string pname, string pkey, string parentName, string parentKey,
+                              stringList &fields, stringList &values);
+    virtual int loadXParamRow(string pname, string pkey, stringList &fields, stringList &values);
+    virtual int loadXParamValueListByParent(string pname, string parentName, string parentKey,
+                                            string fieldName, stringList &values);
+    virtual void getData(string selectstmt, vector<vector<string> > &results,
+                         vector<string> &columns);
+    virtual void getData(string selectstmt, const stringList &params,
+                         vector<vector<string> > &results, vector<string> &columns);
+    using XDBEngine::query;
+    virtual void query(string selectstmt, const stringList &params, XDBRowVisitor &visitor);
+    virtual bool backup(string dest) { return engine->backup(dest); }
+    virtual void cleanup() { engine->cleanup(); }
+    virtual bool isOnTransaction() { return engine->isOnTransaction(); }
+    virtual unsigned long getRollbacks() { return engine->getRollbacks(); }
+    virtual string DBTypetoString(DBFieldTypes t) { return engine->DBTypetoString(t); }
+    virtual bool isConnected() { return engine->isConnected(); }
+
+    void enable(bool _enabled = true) { enabled = _enabled; }
+    bool isEnabled() { return enabled; }
+    /**
+     * Log operations that take "threshold" or more, zero disables the log.
+     * \param logSize number of kept entries, older ones are dropped.
+     */
+    void setSlowThreshold(std::chrono::nanoseconds threshold, size_t logSize = 100);
+    /** Stats of operations, ordered by operation and table. */
+    vector<XDBOperationStats> stats();
+    /** Stats of an operation on all of the tables. */
+    XDBOperationStats total(Operation operation);
+    /** Slow-query log, oldest first. */
+    vector<XDBSlowQuery> slowQueries();
+    void resetStats();
+    /** Stats and slow-query log as a text table, latencies in microseconds. */
+    string report();
+    /** Stats and slow-query log as an XParam tree. */
+    void snapshot(XDBProfilerParam &param);
+    XDBEngine *getEngine() { return engine; }
+
+protected:
+    /** Rows and bytes of an operation, filled by measured function. */
+    struct Volume {
+        Volume() : rows(0), bytes(0) {}
+        unsigned long long rows, bytes;
+    };
+
+    /**
+     * Run "run" and record it, exceptions are recorded as errors and
+     * thrown again.
+     */
+    void measure(Operation operation, const string &table, const string &detail,
+                 const std::function<void(Volume &)> &run);
+    void record(Operation operation, const string &table, const string &detail,
+                std::chrono::nanoseconds latency, const Volume &volume, bool failed);
+    static unsigned long long bytesOf(const stringList &values);
+
+    XDBEngine *engine;
+    std::atomic<bool> enabled;
+    std::mutex lock;
+    /** stats keyed by operation and table */
+    std::map<std::pair<int, string>, XDBOperationStats> counters;
+    std::chrono::nanoseconds slowThreshold;
+    size_t slowLogSize;
+    std::deque<XDBSlowQuery> slowLog;
+};
+
+/**
+ * \class XDBOperationParam
+ * XParam of XDBOperationStats, latencies are in microseconds.
+ */
+class XDBOperationParam : public XMixParam
+{
+public:
+    XDBOperationParam();
+    XDBOperationParam &operator=(const XDBOperationStats &stats);
+    bool key(string &_key)
+    {
+        _key = get_key();
+        return true;
+    }
+    string get_key() const { return operation.value() + "/" + table.value(); }
+
+    XTextParam operation;
+    XTextParam table;
+    XIntParam<XULLong> count;
+    XIntParam<XULLong> errors;
+    XIntParam<XULLong> rows;
+    XIntParam<XULLong> bytes;
+    XFloatParam mean;
+    XIntParam<XULLong> p50;
+    XIntParam<XULLong> p90;
+    XIntParam<XULLong> p99;
+    XIntParam<XULLong> max;
+};
+
+class XDBOperationParams : public XSetParam<XDBOperationParam, string>
+{
+public:
+    XDBOperationParams() : XSetParam<XDBOperationParam, string>("operations") {}
+};
+
+/**
+ * \class XDBSlowQueryParam
+ * XParam of XDBSlowQuery, latency is in microseconds.
+ */
+class XDBSlowQueryParam : public XMixParam
+{
+public:
+    XDBSlowQueryParam();
+    XDBSlowQueryParam &operator=(const XDBSlowQuery &query);
+
+    XTextParam time;
+    XTextParam operation;
+    XTextParam table;
+    XIntParam<XULLong> latency;
+    BoolParam failed;
+    XTextParam detail;
+};
+
+class XDBSlowQueryParams : public XSetParam<XDBSlowQueryParam>
+{
+public:
+    XDBSlowQueryParams() : XSetParam<XDBSlowQueryParam>("slow_queries") {}
+};
+
+/**
+ * \class XDBProfilerParam
+ * XParam tree of XDBProfiler, see XDBProfiler::snapshot().
+ */
+class XDBProfilerParam : public XMixParam
+{
+public:
+    XDBProfilerParam(const string &pname = "db_profile");
+
+    XDBOperationParams operations;
+    XDBSlowQueryParams slowQueries;
+};
+
+} // namespace pparam
@@ -0,0 +1,210 @@
+/**
+ * \file xdbwritebehind.hpp
+ * defines write-behind decorator of database engines.
+ *
+ * Copyright 2010-2022 Cloud Avid Co. (www.cloudavid.com)
+ * \author ali esmaeilpour (esmaeilpour@cloudavid.com)
+ *
+ * xparam is part of PParam.
+ *
+ * PParam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PParam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PParam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+
+#include "xdbengine.hpp"
+
+namespace pparam
+{
+
+/**
+ * \class XDBWriteBehind
+ * XDBEngine decorator that moves writes off the calling thread.
+ *
+ * Mutations are queued in a bounded queue and a dedicated writer thread
+ * applies them to the underlying engine, packing queued transactions into
+ * one large transaction (group commit). A group is committed when
+ * "batchSize" operations are queued or "delay" milliseconds passed from
+ * the oldest queued one, whichever comes first.
+ *
+ * Transactions started by a thread are buffered for that thread and are
+ * queued as one unit on commitTransaction(), so they are applied
+ * atomically. Batches are buffered the same way and queued when the
+ * outermost one commits. Producers block while the queue is full.
+ *
+ * Reads see pending writes: a read of a table with queued writes waits
+ * until they are committed. getData() can't know the tables it reads, so
+ * it waits for everything.
+ *
+ * Errors of queued writes are not reported to the writer, they are
+ * reported by the next flush() or sync().
+ */
+class XDBWriteBehind : public XDBEngine
+{
+public:
+    /**
+     * \param _engine underlying engine, it's not owned by decorator.
+     * \param _queueSize maximum number of queued operations.
+     * \param _batchSize number of operations that triggers a commit.
+     * \param _delay maximum age (in milliseconds) of a queued operation.
+     */
+    XDBWriteBehind(XDBEngine *_engine, size_t _queueSize = 65536, size_t _batchSize = 1024,
+                   unsigned int _delay = 20);
+    virtual ~XDBWriteBehind();
+
+    virtual void connect(string connectionString);
+    virtual void disconnect();
+    virtual void execute(string command);
+
+    virtual void startTransaction();
+    virtual void commitTransaction();
+    virtual void rollbackTransaction();
+    virtual void beginBatch();
+    virtual void endBatch(bool commit);
+
+    virtual void saveXParam(string pname, string pkey, string parentName, string parentKey,
+                            stringList fields, stringList values);
+    virtual void saveXParam(string pname, string pkey, stringList fields, stringList values);
+    virtual void updateXParam(string pname, string pkey, string parentName, string parentKey,
+                              stringList fields, stringList values);
+    virtual void updateXParam(string pname, string pkey, stringList fields, stringList values);
+    virtual void removeXParam(string pname, string pkey, string parentName, string parentKey);
+    virtual void removeXParam(string pname, string pkey);
+    virtual void removeXParamByParent(string pname, string parentName, string parentKey);
+    virtual void removeXParamByValue(string pname, string parentName, string parentKey,
+                                     string fieldName, string value);
+    virtual void createXParamStructure(string pname, string parentName, stringList fields,
+                                       vector<DBFieldTypes> fieldTypes);
+    virtual void createXParamStructure(string pname, stringList fields,
+                                       vector<DBFieldTypes> fieldTypes);
+    virtual void destroyXParamStructure(string pname);
+    virtual void createXParamIndex(string pname, stringList fields, bool unique = false);
+    /**
+     * Deferring applies to the indexes still queued too; resuming waits for the queued writes,
+     * so the held indexes are built over them.
+     */
+    virtual void deferIndexes(bool defer);
+
+    virtual int loadXParamRow(string pname, string pkey, string parentName, string parentKey,
+                              stringList &fields, stringList &values);
+    virtual int loadXParamRow(string pname, string pkey, stringList &fields, stringList &values);
+    virtual int loadXParamValueListByParent(string pname, string parentName, string parentKey,
+                                            string fieldName, stringList &values);
+    virtual int loadXParamKeyListByParent(string pname, string parentName, string parentKey,
+                                          stringList &values);
+    virtual void getData(string selectstmt, vector<vector<string> > &results,
+                         vector<string> &columns);
+    virtual void getData(string selectstmt, const stringList &params,
+                         vector<vector<string> > &results, vector<string> &columns);
+    using XDBEngine::query;
+    virtual void query(string selectstmt, const stringList &params, XDBRowVisitor &visitor);
+    virtual bool backup(string dest);
+    virtual void cleanup();
+    virtual bool isOnTransaction();
+    virtual string DBTypetoString(DBFieldTypes t);
+    virtual bool isConnected();
+    virtual unsigned long getRollbacks()
+    {
+        return XDBEngine::getRollbacks() + engine->getRollbacks();
+    }
+
+    /**
+     * Wait until all of the writes queued before this call are committed.
+     *
+     * Throws an exception if any queued write failed since last flush.
+     */
+    void flush();
+    /**
+     * Return a future that becomes ready when all of the writes queued
+     * before this call are committed.
+     *
+     * The future holds an exception if any queued write failed.
+     */
+    std::future<void> sync();
+    /**
+     * Number of queued (not yet committed) operations.
+     */
+    size_t pending();
+    XDBEngine *getEngine() { return engine; }
+
+protected:
+    struct Operation {
+        enum Type {
+            EXECUTE,
+            SAVE,
+            UPDATE,
+            REMOVE,
+            REMOVE_BY_PARENT,
+            REMOVE_BY_VALUE,
+            CREATE,
+            DESTROY,
+            INDEX
+        } type;
+        string pname, pkey, parentName, parentKey;
+        stringList fields, values;
+        vector<DBFieldTypes> fieldTypes;
+    };
+    /**
+     * A transaction (or a single write) that would be applied atomically.
+     */
+    struct Group {
+        vector<Operation> ops;
+        std::shared_ptr<std::promise<void> > barrier;
+        /**
+         * Open batches and transactions inside them: size of "ops" when
+         * they opened and whether it's a batch.
+         */
+        vector<std::pair<size_t, bool> > levels;
+    };
+
+    void enqueue(Operation &op);
+    void enqueue(Group *group);
+    void apply(const Operation &op);
+    void writer();
+    void waitFor(unsigned long long target);
+    bool hasPendingWrites(const string &pname);
+    /** collect and clear errors, caller should hold "lock". */
+    string takeErrors();
+    static void cleanTransaction(void *ptr);
+
+    XDBEngine *engine;
+    size_t queueSize, batchSize;
+    unsigned int delay;
+
+    std::mutex lock;
+    /** held by writer while applying a batch. */
+    std::mutex engineLock;
+    std::condition_variable queueCond, spaceCond, doneCond;
+    std::deque<Group *> queue;
+    size_t queuedOps;
+    /** number of pending operations per table, "" counts raw commands. */
+    std::map<string, size_t> pendingTables;
+    /** sequence of last queued/committed group. */
+    unsigned long long queuedSeq, committedSeq;
+    bool flushRequested, stopping;
+    stringList errors;
+    std::thread writerThread;
+
+    pthread_key_t transactionTSMKey;
+};
+
+} // namespace pparam
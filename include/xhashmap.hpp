@@ -0,0 +1,372 @@
+/**
+ * \file xhashmap.hpp
+ * defines an open-addressing hash map.
+ *
+ * Copyright 2010-2022 Cloud Avid Co. (www.cloudavid.com)
+ *
+ * xhashmap is part of PParam.
+ *
+ * PParam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PParam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PParam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace pparam
+{
+
+/**
+ * \class XHashMap
+ * Hash map with open addressing and linear probing.
+ *
+ * All of the entries live in one array, so lookups touch one or two
+ * cache lines instead of walking bucket lists. Interface is a subset of
+ * std::map/std::unordered_map, so they are interchangeable in our
+ * containers.
+ *
+ * Erased entries leave tombstones, so erase() never moves other entries:
+ * it's safe to erase while iterating. Insertion may rehash and
+ * invalidates iterators.
+ *
+ * find(), count_of() and erase_key() accept any key type that "Hash" and
+ * "Pred" accept (e.g. "const char *" for string keys).
+ */
+template <typename Key, typename T, typename Hash = std::hash<Key>,
+          typename Pred = std::equal_to<Key>>
+class XHashMap
+{
+public:
+    typedef Key key_type;
+    typedef T mapped_type;
+    typedef std::pair<const Key, T> value_type;
+    typedef size_t size_type;
+    typedef Hash hasher;
+    typedef Pred key_equal;
+
+protected:
+    enum SlotState : unsigned char { EMPTY, FULL, DELETED };
+    struct Slot {
+        SlotState state;
+        alignas(value_type) unsigned char data[sizeof(value_type)];
+
+        Slot() : state(EMPTY) {}
+        value_type *ptr() { return reinterpret_cast<value_type *>(data); }
+        const value_type *ptr() const { return reinterpret_cast<const value_type *>(data); }
+    };
+
+    template <typename V, typename S>
+    class basic_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef V value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef V *pointer;
+        typedef V &reference;
+
+        basic_iterator() : slot(NULL), last(NULL) {}
+        basic_iterator(S *_slot, S *_last) : slot(_slot), last(_last) { skip(); }
+        /** iterator to const_iterator conversion */
+        template <typename V2, typename S2>
+        basic_iterator(const basic_iterator<V2, S2> &iter) : slot(iter.slot), last(iter.last)
+        {
+        }
+
+        reference operator*() const { return *slot->ptr(); }
+        pointer operator->() const { return slot->ptr(); }
+        basic_iterator &operator++()
+        {
+            ++slot;
+            skip();
+            return *this;
+        }
+        basic_iterator operator++(int)
+        {
+            basic_iterator tmp(*this);
+            ++(*this);
+            return tmp;
+        }
+        bool operator==(const basic_iterator &iter) const { return slot == iter.slot; }
+        bool operator!=(const basic_iterator &iter) const { return slot != iter.slot; }
+
+    protected:
+        void skip()
+        {
+            while (slot != last && slot->state != FULL)
+                ++slot;
+        }
+
+        S *slot;
+        S *last;
+        friend class XHashMap;
+        template <typename V2, typename S2>
+        friend class basic_iterator;
+    };
+
+public:
+    typedef basic_iterator<value_type, Slot> iterator;
+    typedef basic_iterator<const value_type, const Slot> const_iterator;
+
+    XHashMap() : elements(0), used(0) {}
+    XHashMap(const XHashMap &map) : elements(0), used(0)
+    {
+        reserve(map.size());
+        for (const_iterator iter = map.begin(); iter != map.end(); ++iter)
+            insert(*iter);
+    }
+    XHashMap(XHashMap &&map) : elements(0), used(0) { swap(map); }
+    XHashMap &operator=(const XHashMap &map)
+    {
+        if (this != &map) {
+            XHashMap tmp(map);
+            swap(tmp);
+        }
+        return *this;
+    }
+    XHashMap &operator=(XHashMap &&map)
+    {
+        swap(map);
+        return *this;
+    }
+    ~XHashMap() { clear(); }
+
+    size_type size() const { return elements; }
+    bool empty() const { return elements == 0; }
+    size_type bucket_count() const { return slots.size(); }
+
+    iterator begin() { return iterator(slots.data(), slots.data() + slots.size()); }
+    iterator end()
+    {
+        return iterator(slots.data() + slots.size(), slots.data() + slots.size());
+    }
+    const_iterator begin() const
+    {
+        return const_iterator(slots.data(), slots.data() + slots.size());
+    }
+    const_iterator end() const
+    {
+        return const_iterator(slots.data() + slots.size(), slots.data() + slots.size());
+    }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    template <typename K>
+    iterator find(const K &key)
+    {
+        size_t index = lookup(key);
+        return index == npos ? end() : make_iterator(index);
+    }
+    template <typename K>
+    const_iterator find(const K &key) const
+    {
+        size_t index = lookup(key);
+        if (index == npos)
+            return end();
+        return const_iterator(slots.data() + index, slots.data() + slots.size());
+    }
+    template <typename K>
+    size_type count_of(const K &key) const
+    {
+        return lookup(key) == npos ? 0 : 1;
+    }
+    size_type count(const Key &key) const { return count_of(key); }
+
+    T &operator[](const Key &key) { return emplace(key, T()).first->second; }
+    T &at(const Key &key)
+    {
+        size_t index = lookup(key);
+        if (index == npos)
+            throw std::out_of_range("XHashMap::at");
+        return slots[index].ptr()->second;
+    }
+
+    std::pair<iterator, bool> insert(const value_type &value)
+    {
+        return emplace(value.first, value.second);
+    }
+    template <typename K, typename V>
+    std::pair<iterator, bool> emplace(K &&key, V &&value)
+    {
+        size_t index = lookup(key);
+        if (index != npos)
+            return std::make_pair(make_iterator(index), false);
+        if ((used + 1) * 4 > slots.size() * 3)
+            rehash((elements + 1) * 2);
+        index = probe(key);
+        Slot &slot = slots[index];
+        if (slot.state == EMPTY)
+            ++used;
+        new (slot.data) value_type(std::forward<K>(key), std::forward<V>(value));
+        slot.state = FULL;
+        ++elements;
+        return std::make_pair(make_iterator(index), true);
+    }
+
+    /**
+     * \return iterator to the element after erased one.
+     */
+    iterator erase(const_iterator pos)
+    {
+        Slot *slot = const_cast<Slot *>(pos.slot);
+        destroy(*slot);
+        return iterator(slot + 1, slots.data() + slots.size());
+    }
+    iterator erase(iterator pos) { return erase(const_iterator(pos)); }
+    template <typename K>
+    size_type erase_key(const K &key)
+    {
+        size_t index = lookup(key);
+        if (index == npos)
+            return 0;
+        destroy(slots[index]);
+        return 1;
+    }
+    size_type erase(const Key &key) { return erase_key(key); }
+
+    void clear()
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+            if (slots[i].state == FULL)
+                slots[i].ptr()->~value_type();
+        std::vector<Slot>().swap(slots);
+        elements = used = 0;
+    }
+    /**
+     * Make room for "n" elements, so inserting them doesn't rehash.
+     */
+    void reserve(size_type n)
+    {
+        if (n * 4 > slots.size() * 3)
+            rehash(n);
+    }
+    void swap(XHashMap &map)
+    {
+        slots.swap(map.slots);
+        std::swap(elements, map.elements);
+        std::swap(used, map.used);
+        std::swap(hash, map.hash);
+        std::swap(equal, map.equal);
+    }
+
+protected:
+    static const size_t npos = (size_t)-1;
+
+    iterator make_iterator(size_t index)
+    {
+        return iterator(slots.data() + index, slots.data() + slots.size());
+    }
+    /** Fibonacci hashing, spreads sequential keys over the table. */
+    template <typename K>
+    size_t home(const K &key) const
+    {
+        uint64_t h = (uint64_t)hash(key) * 11400714819323198485ull;
+        return (size_t)(h >> 32) & (slots.size() - 1);
+    }
+    template <typename K>
+    size_t lookup(const K &key) const
+    {
+        if (elements == 0)
+            return npos;
+        size_t mask = slots.size() - 1;
+        for (size_t i = home(key);; i = (i + 1) & mask) {
+            const Slot &slot = slots[i];
+            if (slot.state == EMPTY)
+                return npos;
+            if (slot.state == FULL && equal(slot.ptr()->first, key))
+                return i;
+        }
+    }
+    /** first free slot for a key that isn't in table. */
+    template <typename K>
+    size_t probe(const K &key) const
+    {
+        size_t mask = slots.size() - 1;
+        size_t i = home(key);
+        while (slots[i].state == FULL)
+            i = (i + 1) & mask;
+        return i;
+    }
+    void destroy(Slot &slot)
+    {
+        slot.ptr()->~value_type();
+        slot.state = DELETED;
+        --elements;
+    }
+    /**
+     * Rebuild table with room for "n" elements, drops tombstones too.
+     */
+    void rehash(size_type n)
+    {
+        size_t capacity = 8;
+        while (capacity * 3 < n * 4 + 4)
+            capacity <<= 1;
+        std::vector<Slot> old(capacity);
+        old.swap(slots);
+        used = 0;
+        for (size_t i = 0; i < old.size(); ++i) {
+            if (old[i].state != FULL)
+                continue;
+            value_type *value = old[i].ptr();
+            Slot &slot = slots[probe(value->first)];
+            new (slot.data) value_type(std::move(*value));
+            slot.state = FULL;
+            ++used;
+            value->~value_type();
+        }
+    }
+
+    std::vector<Slot> slots;
+    /** number of elements */
+    size_type elements;
+    /** number of non-empty (full or deleted) slots */
+    size_type used;
+    Hash hash;
+    Pred equal;
+};
+
+/**
+ * \class XKeyHash
+ * Hash of XHashMap keys that hashes strings as std::string_view, so
+ * maps of string keys can be searched by string_view or "const char *"
+ * without building a string. Other keys use std::hash.
+ */
+template <typename Key>
+struct XKeyHash : std::hash<Key> {
+};
+template <>
+struct XKeyHash<std::string> {
+    size_t operator()(std::string_view key) const { return std::hash<std::string_view>()(key); }
+};
+
+/**
+ * \class XKeyEqual
+ * Key comparison that goes with XKeyHash.
+ */
+template <typename Key>
+struct XKeyEqual : std::equal_to<Key> {
+};
+template <>
+struct XKeyEqual<std::string> {
+    bool operator()(std::string_view key1, std::string_view key2) const { return key1 == key2; }
+};
+
+} // namespace pparam
@@ -25,6 +25,7 @@
  */
 
 #include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 #include <string>
 #include <vector>
 
@@ -216,5 +217,50 @@ private:
     static Init init_;
 };
 
+/**
+ * \class Reader.
+ * this class is a wrapper for xmlTextReader of libxml.
+ * it reads children of root element one by one, only the current child
+ * is kept in memory, so documents larger than memory can be read.
+ */
+class Reader
+{
+public:
+    /**
+     * open xml file and move to its root element.
+     */
+    Reader(const std::string &filePath);
+    ~Reader();
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+    /**
+     * @return name of root element.
+     */
+    std::string get_root_name() const;
+    /**
+     * read next child element of root with all of its subtree.
+     * @return the child, it's valid until next call; nullptr at end of root.
+     */
+    Element *next_child();
+    /**
+     * @return bytes of file consumed so far.
+     */
+    long bytes_read() const;
+
+private:
+    /**
+     * throw parse error of reader.
+     */
+    void throw_error(const std::string &what) const;
+
+    xmlTextReaderPtr reader;
+    std::string rootName;
+    /**
+     * current child, its wrappers are freed by next_child().
+     */
+    Element *current;
+    bool done;
+};
+
 } // namespace xml
 } // namespace pparam
@@ -1575,6 +1575,76 @@ public:
         }
         return true;
     }
+    /**
+     * Lock the list and call callback for all of objects on threads of
+     * "pool".
+     *
+     * Objects are split to chunks of "chunk" objects (0: chosen by pool),
+     * calling thread runs chunks too. Each object is in QUERYING status
+     * while callback runs on it (it waits for modifications of object),
+     * objects that can't be queried (e.g. deleted ones) are skipped.
+     * callback is called from several threads at once; if it throws,
+     * remaining chunks are skipped and the exception is thrown.
+     */
+    template <class T, class CallBack>
+    void parallel_iterate(CallBack callback, size_t chunk = 0,
+                          XThreadPool &pool = XThreadPool::shared())
+    {
+        parallel_visit(
+            chunk, pool, [](const std::vector<iterator> &, size_t) {},
+            [&](size_t, iterator iter) { callback((T *)*iter); });
+    }
+    /**
+     * Lock the list and find objects that "predicate" returns true for,
+     * on threads of "pool"; predicate is called like parallel_iterate().
+     *
+     * \return iterators to found objects, in order of list.
+     */
+    template <class T, class Predicate>
+    std::vector<iterator> parallel_query_all(Predicate predicate, size_t chunk = 0,
+                                             XThreadPool &pool = XThreadPool::shared())
+    {
+        std::vector<iterator> found;
+        std::vector<char> matched;
+        parallel_visit(
+            chunk, pool,
+            [&](const std::vector<iterator> &objects, size_t) {
+                found = objects;
+                matched.assign(objects.size(), false);
+            },
+            [&](size_t i, iterator iter) { matched[i] = predicate((T *)*iter); });
+        size_t count = 0;
+        for (size_t i = 0; i < found.size(); i++)
+            if (matched[i])
+                found[count++] = found[i];
+        found.resize(count);
+        return found;
+    }
+    /**
+     * Lock the list and combine "map" of all of objects on threads of
+     * "pool", like XSetParam::parallel_reduce(); skipped objects aren't
+     * mapped.
+     */
+    template <class T, typename R, class Map, class Combine>
+    R parallel_reduce(R init, Map map, Combine combine, size_t chunk = 0,
+                      XThreadPool &pool = XThreadPool::shared())
+    {
+        std::vector<R> parts;
+        parallel_visit(
+            chunk, pool,
+            [&](const std::vector<iterator> &objects, size_t _chunk) {
+                chunk = _chunk;
+                parts.assign((objects.size() + chunk - 1) / chunk, init);
+            },
+            [&](size_t i, iterator iter) {
+                R &part = parts[i / chunk];
+                part = combine(std::move(part), map((T *)*iter));
+            });
+        R result = init;
+        for (R &part : parts)
+            result = combine(std::move(result), std::move(part));
+        return result;
+    }
     /**
      * Query specified object.
      *
@@ -1775,6 +1845,42 @@ public:
     void set_repo(XObjectRepository<Type> *_repo) { repo = _repo; }
 
 protected:
+    /**
+     * Body of parallel functions: lock the list, call prepare(objects,
+     * chunk) with iterators to all of objects and size of chunks, then
+     * call visit(index, iterator) for objects that could be changed to
+     * QUERYING status, on threads of "pool".
+     */
+    template <class Prepare, class Visit>
+    void parallel_visit(size_t chunk, XThreadPool &pool, Prepare prepare, Visit visit)
+    {
+        rdlock();
+        try {
+            std::vector<iterator> objects;
+            for (iterator iter = list.begin(); iter != list.end(); ++iter)
+                objects.push_back(iter);
+            chunk = pool.chunkSize(objects.size(), chunk);
+            prepare(objects, chunk);
+            pool.parallelFor(objects.size(), chunk, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++) {
+                    _XObject *xobj = (_XObject *)*objects[i];
+                    if (!xobj->chStatus(ObjStatus::QUERYING))
+                        continue;
+                    try {
+                        visit(i, objects[i]);
+                    } catch (...) {
+                        xobj->bkStatus();
+                        throw;
+                    }
+                    xobj->bkStatus();
+                }
+            });
+        } catch (...) {
+            unlock();
+            throw;
+        }
+        unlock();
+    }
     /**
      * List of XObjects.
      */
@@ -40,13 +40,31 @@ using std::vector;
 #include <map>
 using std::map;
 
+#include <set>
+
+#include <list>
+
+#include <functional>
+#include <memory>
+
 #include <algorithm>
 using std::find;
 
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <mutex>
 #include <thread>
+#include <type_traits>
+#include <typeinfo>
 
 #include "xdbengine.hpp"
+#include "xhashmap.hpp"
 #include "xlist.hpp"
+#include "xslabpool.hpp"
+#include "xthreadpool.hpp"
 
 namespace pparam
 {
@@ -62,6 +80,24 @@ typedef float XFloat;
 typedef unsigned long long XULLong;
 typedef long long XLLong;
 
+/**
+ * \class XParamChange
+ * A difference between two XParam trees, found by XParam::diff().
+ */
+struct XParamChange {
+    enum Kind {
+        MODIFIED, /**< value of parameter differs */
+        ADDED,    /**< member of set isn't in base */
+        REMOVED,  /**< member of base isn't in set */
+    };
+    Kind kind;
+    /**
+     * names from root to changed parameter, separated by '/', members of
+     * sets have their key, e.g. "servers/server[10.0.0.1]/cpu_usage".
+     */
+    string path;
+};
+
 /**
  * \class XParam (X Parameter)
  * abstract class, defines common attributes/functions of X-Parameters.
@@ -96,6 +132,7 @@ public:
     typedef pparam::XFloat XFloat;
 
     XParam();
+    XParam(const XParam &);
     XParam(XParam &&);
     XParam(const string &_pname);
     /**
@@ -152,6 +189,57 @@ public:
      * \param xp left value in operator=(Xparam &)
      */
     virtual void assignHelper(const XParam &xp) { return; }
+    /**
+     * New copy of parameter made by copy constructor of its type, NULL if
+     * type can't be copied that way (use operator= on a new object).
+     *
+     * Single parameters implement it. Mixture parameters can't be copied
+     * by generated constructors, because their sub-parameters are
+     * registered by addParam(); a type may define its copy constructor
+     * and this function:
+     * \code
+     * Disk(const Disk &disk) : XMixParam(disk.get_pname()), name(disk.name), size(disk.size)
+     * {
+     *     addParam(&name);
+     *     addParam(&size);
+     * }
+     * XParam *clone() const { return new Disk(*this); }
+     * \endcode
+     * Note clone() of a base returns an object of base, not of caller.
+     */
+    virtual XParam *clone() const { return NULL; }
+    /**
+     * 64-bit hash of parameter: name and value of single parameters,
+     * fingerprints of children of mixture parameters (Merkle tree).
+     *
+     * Equal parameters (operator==) have equal fingerprints, so parameters
+     * with different fingerprints differ; operator== uses fingerprints
+     * when both of them are cached already. Fingerprint is cached and
+     * dropped when parameter or one of its children changes (see
+     * changed()); parameters that don't report their changes (see
+     * XSingleParam::tracksChanges()) are hashed again on each call, and so
+     * are their parents.
+     */
+    uint64_t fingerprint() const;
+    /**
+     * Differences of this parameter from "base", e.g. an older copy of it.
+     *
+     * Subtrees with equal fingerprints are skipped, so large trees are
+     * compared in time of their changed subtrees. Members of sets are
+     * matched by keys, order of members isn't compared.
+     */
+    vector<XParamChange> diff(const XParam &base) const;
+    /**
+     * Add differences from "base" to "changes", see diff().
+     * \param path path of this parameter.
+     */
+    virtual void addChanges(const XParam &base, const string &path,
+                            vector<XParamChange> &changes) const;
+    /**
+     * Mixture parameter (or set) that this parameter is added to, NULL if
+     * there is no one.
+     */
+    XParam *get_parent() const { return parentParam; }
 
     /**
      * Load parameter from xml-formatted string.
@@ -232,7 +320,7 @@ public:
     void set_runtime(bool rt = true) { runtime = rt; }
     /** Returns parametr name.
      */
-    string get_pname() const { return pname; }
+    const string &get_pname() const { return pname; }
     /** Returns parameter version.
      */
     string get_version() const { return version; }
@@ -258,9 +346,30 @@ public:
     virtual ~XParam() {}
 
 protected:
+    template <typename List> friend class _XMixParam;
+
     /** strip blanks from front and end of string.
      */
     string stripBlanks(string str);
+    /**
+     * Drop cached fingerprint of parameter and of its parents, should be
+     * called after value of parameter is changed.
+     */
+    void changed()
+    {
+        for (XParam *param = this; param != NULL; param = param->parentParam)
+            if (!param->fingerprintValid.exchange(false, std::memory_order_relaxed))
+                break;
+    }
+    /**
+     * Hash of parameter, see fingerprint().
+     * \param cacheable set to false if hash can't be cached.
+     */
+    virtual uint64_t computeFingerprint(bool &cacheable) const;
+    static uint64_t hashBytes(const char *data, size_t size);
+    static uint64_t hashString(const string &str) { return hashBytes(str.data(), str.size()); }
+    /** Mix "value" into "seed", order of values matters. */
+    static uint64_t hashCombine(uint64_t seed, uint64_t value);
     /** don't show this parameter in xml string..!
      */
     bool dont_show(bool show_runtime) const { return is_runtime() && !show_runtime; }
@@ -291,6 +400,17 @@ protected:
      * \note use set_runtime() to change runtime.
      */
     bool runtime;
+    /**
+     * Parent of parameter, set by first mixture parameter that parameter is
+     * added to, and cleared when it's removed from a set.
+     */
+    XParam *parentParam;
+    mutable uint64_t fingerprintCache;
+    /**
+     * If parameter is cached, so are its children (changed() stops at
+     * first parameter that isn't cached).
+     */
+    mutable std::atomic<bool> fingerprintValid;
 };
 
 /**
@@ -301,6 +421,7 @@ class XSingleParam : public XParam
 {
 public:
     XSingleParam(const string &_pname);
+    XSingleParam(const XSingleParam &);
     XSingleParam(XSingleParam &&);
 
     /** Read parameter value from xml config file.
@@ -310,7 +431,23 @@ public:
     virtual bool operator==(const XParam &);
     virtual bool operator!=(const XParam &);
     virtual string _xml(bool show_runtime, const int &indent, const string &endl) const;
+    /**
+     * Does parameter call changed() on each change of its value? Then its
+     * fingerprint is cached.
+     *
+     * Classes that do so return true for their own type only, subclasses
+     * may change value by other ways.
+     */
+    virtual bool tracksChanges() const { return false; }
     virtual ~XSingleParam() {}
+
+protected:
+    virtual uint64_t computeFingerprint(bool &cacheable) const;
+    /**
+     * Hash of value(), subclasses may hash their value without making
+     * its string.
+     */
+    virtual uint64_t hashValue() const { return hashString(value()); }
 };
 
 /**
@@ -346,8 +483,20 @@ public:
     virtual XParam *value(int index) const;
     virtual XParam *value(string name) const;
     virtual bool verify();
-    /** Add one sub-parameter to list of sub-parameters. */
-    virtual void addParam(XParam *param) { params.push_back(param); }
+    /**
+     * Add one sub-parameter to list of sub-parameters.
+     *
+     * Mixture becomes parent of param if param has no parent (see
+     * fingerprint()), param shouldn't outlive its parent.
+     */
+    virtual void addParam(XParam *param)
+    {
+        params.push_back(param);
+        adopt(param);
+        changed();
+    }
+    virtual void addChanges(const XParam &base, const string &path,
+                            vector<XParamChange> &changes) const;
 
     XUInt size() const { return params.size(); }
     iterator begin() { return params.begin(); }
@@ -376,6 +525,12 @@ public:
      * \param [in] parentNode Parent XParam of this object
      */
     virtual void dbSave(const XParam *parentNode = (XParam *)NULL);
+    /**
+     * Save this top-level XParam as a part of the open batch (XDBBatch)
+     * of calling thread, without a transaction of its own (a savepoint,
+     * for SQLiteDBEngine). If it fails, roll the batch back.
+     */
+    void dbSaveInBatch();
     /**
      * Update stored data using this XParam and its children by
      * associated XDBEngine
@@ -401,18 +556,161 @@ public:
     virtual void dbDestroyStructure(const XParam *parentNode = (XParam *)NULL);
     virtual void dbLoad(const XParam *parentNode = (XParam *)NULL);
     virtual void dbLoad(stringList &fields, stringList &values);
+    /**
+     * Positions of children in "params" for loaded fields, in the order
+     * of fields. XParams of the same type share layouts.
+     */
+    struct DBLayout {
+        stringList fields;
+        vector<int> slots;
+    };
+    /**
+     * Load row of "key" by "reader" (see XDBEngine::rowReader()), values
+     * are put in children by "layout" that reader binds once, so loading
+     * many rows of a table doesn't look up field names per row.
+     * \return false if row isn't found.
+     */
+    bool dbLoad(XDBRowReader &reader, const string &key, const string &parentKey,
+                DBLayout &layout);
+    /**
+     * Asynchronous dbSave()/dbUpdate()/dbDelete()/dbLoad() of top-level
+     * XParam, they run on executor of the engine (XDBEngine::executor()).
+     *
+     * Don't touch this XParam until the future is ready, future throws
+     * the exception of operation.
+     */
+    std::future<void> dbSaveAsync();
+    std::future<void> dbUpdateAsync();
+    std::future<void> dbDeleteAsync();
+    std::future<void> dbLoadAsync();
     virtual void setDBEngine(XDBEngine *engine);
     virtual XDBEngine *getDBEngine();
     virtual string generateJoinStmts(const XParam *parentNode = (XParam *)NULL);
+    /**
+     * Forget what we know about stored data of this XParam and its
+     * children, so next dbUpdate would rewrite all of them.
+     *
+     * Would be called when stored data may be changed behind us, e.g.
+     * failed commit or modifications by other processes.
+     */
+    virtual void dbResetTracking();
+    /**
+     * Record current values of single children as stored values.
+     *
+     * dbLoad/dbSave/dbUpdate call this by themselves, call it when you
+     * know the stored row is equal to this XParam by other means.
+     * \param [in] parentNode Parent XParam of this object
+     */
+    void dbTrack(const XParam *parentNode = (XParam *)NULL);
+    /**
+     * Declare an index on some single children, it would be created by
+     * dbCreateStructure().
+     *
+     * Use it for fields that XDBCondition lookups filter on.
+     * \param [in] field Name of indexed child (or children).
+     * \param [in] unique Values of field(s) are unique.
+     */
+    void addDBIndex(const string &field, bool unique = false);
+    void addDBIndex(const stringList &fields, bool unique = false);
 
     virtual ~_XMixParam() {}
 
 protected:
+    virtual uint64_t computeFingerprint(bool &cacheable) const;
+    /** Be parent of "param", if it has no parent. */
+    void adopt(XParam *param)
+    {
+        if (param->parentParam == NULL)
+            param->parentParam = this;
+    }
+    /** Forget "param" that isn't our child anymore. */
+    void disown(XParam *param)
+    {
+        if (param->parentParam == this)
+            param->parentParam = NULL;
+    }
+    /** Take children of "mix" that is moved to us. */
+    void adoptAll(_XMixParam &mix)
+    {
+        for (XParam *param : params)
+            if (param->parentParam == &mix)
+                param->parentParam = this;
+        mix.changed();
+    }
+    /**
+     * Values of single children in the order of "params".
+     */
+    stringList dbValues() const;
+    /**
+     * Puts loaded values in children by a layout.
+     */
+    class DBRowLoader : public XDBRowLoader
+    {
+    public:
+        DBRowLoader(_XMixParam *_mix, DBLayout &_layout) : mix(_mix), layout(_layout) {}
+        virtual void bindFields(const stringList &fields);
+        virtual void loadValue(unsigned int index, const char *value)
+        {
+            XParam *param = *std::next(mix->params.begin(), layout.slots[index]);
+            (*param) = string(value);
+        }
+
+    protected:
+        _XMixParam *mix;
+        DBLayout &layout;
+    };
+    /** Load mix children, after our row is loaded. */
+    void dbLoadChildren();
+    /**
+     * Commit transaction of top-level (parentNode == NULL) operations.
+     *
+     * On failure, tracked data would be reset.
+     */
+    void dbCommit(const XParam *parentNode);
+    /**
+     * dbSave() in a transaction of its own, or as a part of caller's
+     * transaction (always for children).
+     */
+    void dbSaveRow(const XParam *parentNode, bool transaction);
     /**
      * list of sub-element(parameters) of the mixture parameter.
      */
     list params;
     XDBEngine *dbengine;
+    /**
+     * Values of single children as they have been stored by the last
+     * dbLoad/dbSave/dbUpdate.
+     *
+     * dbUpdate only writes columns which differ from these values.
+     * Snapshot belongs to the row addressed by "dbTrackedKey" and
+     * "dbTrackedParentKey", if key of row changes, snapshot is useless.
+     * Empty snapshot means we don't know what is stored.
+     */
+    stringList dbSnapshot;
+    string dbTrackedKey;
+    string dbTrackedParentKey;
+    /**
+     * Rollbacks of "dbengine" when tracked data was taken, a rollback
+     * after that may have undone what we know as stored.
+     */
+    unsigned long dbTrackedRollbacks;
+    /** No rollback has happened since tracked data was taken. */
+    bool dbTrackingValid() const
+    {
+        return (dbengine != NULL) && (dbTrackedRollbacks == dbengine->getRollbacks());
+    }
+    /** Tracked data is taken now, see dbTrackingValid(). */
+    void dbTrackRollbacks()
+    {
+        dbTrackedRollbacks = (dbengine == NULL) ? 0 : dbengine->getRollbacks();
+    }
+    /**
+     * Declared indexes, each of them is fields of index and his
+     * uniqueness.
+     */
+    vector<std::pair<stringList, bool>> dbIndexes;
+    /** layout of rows loaded by dbLoad(parentNode) */
+    DBLayout dbLayout;
 };
 /**
  * \typedef XMixParam
@@ -428,6 +726,7 @@ class XTextParam : public XSingleParam
 {
 public:
     XTextParam(const string &_pname);
+    XTextParam(const XTextParam &_xtp);
     XTextParam(XTextParam &&_xtp);
     XTextParam &operator=(const XTextParam &vtp);
     virtual XParam &operator=(const string &str);
@@ -441,9 +740,13 @@ public:
     string get_value() const;
     bool empty() const;
     const char *c_str();
+    virtual XParam *clone() const { return new XTextParam(*this); }
+    virtual bool tracksChanges() const { return typeid(*this) == typeid(XTextParam); }
     virtual ~XTextParam();
 
 protected:
+    virtual uint64_t hashValue() const;
+
     /* Determines generating XML in CDATA format or not */
     bool cdata;
     /** parameter value */
@@ -475,7 +778,7 @@ public:
     {
     }
     XIntParam(const _XIntParam &iparam) :
-        XSingleParam(iparam.pname), min(iparam.min), max(iparam.max), val(iparam.val)
+        XSingleParam(iparam), min(iparam.min), max(iparam.max), val(iparam.val)
     {
     }
     XIntParam(XIntParam &&_xip) :
@@ -509,7 +812,11 @@ public:
 
         return oss.str();
     }
-    virtual void reset() { val = min; }
+    virtual void reset()
+    {
+        val = min;
+        changed();
+    }
     void set_value(const T &value)
     {
         if ((max >= min) /* we should check boundries. */
@@ -517,12 +824,25 @@ public:
             throw Exception(pname + " value is out of range !", TracePoint("pparam"));
         }
         val = value;
+        changed();
     }
     T get_value() const { return val; }
+    virtual XParam *clone() const { return new _XIntParam(*this); }
+    virtual bool tracksChanges() const { return typeid(*this) == typeid(_XIntParam); }
     virtual ~XIntParam() {}
 
 protected:
     bool checkLimit() { return max >= min; }
+    /** hash of value() without making it, for integers */
+    virtual uint64_t hashValue() const
+    {
+        if constexpr (std::is_integral<T>::value && sizeof(T) > 1) {
+            char digits[24];
+            std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), val);
+            return hashBytes(digits, result.ptr - digits);
+        } else
+            return XSingleParam::hashValue();
+    }
 
     /**
      * parameter minimum value
@@ -553,11 +873,13 @@ public:
      * means we don't want to check parameter boundries.
      */
     XFloatParam(const string &_pname, const XFloat &_min, const XFloat &_max);
+    XFloatParam(const XFloatParam &_xfp);
     XFloatParam(XFloatParam &&_xfp);
 
     XFloatParam &operator=(const XFloatParam &vip)
     {
         val = vip.val;
+        changed();
 
         return *this;
     }
@@ -565,13 +887,21 @@ public:
     virtual XParam &operator=(const XFloat &);
     virtual XParam &operator=(const XParam &xp);
     string value() const;
-    virtual void reset() { val = min; }
+    virtual void reset()
+    {
+        val = min;
+        changed();
+    }
     XFloat float_value() const { return val; }
     void set_value(const XFloat &value) { (*this) = value; }
     XParam::XFloat get_value() const { return val; }
+    virtual XParam *clone() const { return new XFloatParam(*this); }
+    virtual bool tracksChanges() const { return typeid(*this) == typeid(XFloatParam); }
     virtual ~XFloatParam() {}
 
 protected:
+    virtual uint64_t hashValue() const;
+
     /**
      * parameter minimum value
      */
@@ -608,10 +938,12 @@ public:
     {
     }
     XEnumParam() : XEnumParam("value", T::MAX) {}
+    XEnumParam(const XEnumParam &_xep) : XSingleParam(_xep), def(_xep.def), val(_xep.val) {}
     XEnumParam(XEnumParam &&_xep) : XSingleParam(std::move(_xep)), def(_xep.def), val(_xep.def) {}
     XEnumParam &operator=(const XEnumParam &vp)
     {
         val = vp.val;
+        changed();
 
         return *this;
     }
@@ -620,6 +952,7 @@ public:
         for (int i = 0; i < static_cast<XInt>(T::MAX); ++i) {
             if (str == T::typeString[i]) {
                 val = i;
+                changed();
                 return (*this);
             }
         }
@@ -638,19 +971,33 @@ public:
             return "";
         return T::typeString[val];
     }
-    virtual void reset() { val = def; }
+    virtual void reset()
+    {
+        val = def;
+        changed();
+    }
     virtual void set_value(const int &value)
     {
         if (value >= 0 && value <= T::MAX)
             val = value;
         else
             throw Exception("Bad <" + pname + "> value !", TracePoint("pparam"));
+        changed();
     }
     virtual int get_value() const { return val; }
+    virtual XParam *clone() const { return new XEnumParam(*this); }
+    virtual bool tracksChanges() const { return typeid(*this) == typeid(XEnumParam); }
 
     virtual ~XEnumParam() {}
 
 protected:
+    virtual uint64_t hashValue() const
+    {
+        if (val < 0 || val >= T::MAX)
+            return hashBytes("", 0);
+        return hashString(T::typeString[val]);
+    }
+
     /** default value.
      */
     XInt def;
@@ -659,6 +1006,392 @@ protected:
     XInt val;
 };
 
+/**
+ * \class XSetOrder
+ * "less than" of members of XSetParam, made of a comparator of T* that
+ * returns bool ("less than") or int (1: less, 0: equal, -1: greater).
+ */
+template <typename T, typename Compare> class XSetOrder
+{
+public:
+    XSetOrder(const Compare &_compare, bool _descending = false) :
+        compare(_compare), descending(_descending)
+    {
+    }
+    bool operator()(const XParam *param1, const XParam *param2) const
+    {
+        T *t1 = static_cast<T *>(const_cast<XParam *>(param1));
+        T *t2 = static_cast<T *>(const_cast<XParam *>(param2));
+        return descending ? less(t2, t1) : less(t1, t2);
+    }
+
+protected:
+    bool less(T *t1, T *t2) const
+    {
+        if constexpr (std::is_same<decltype(compare(t1, t2)), bool>::value)
+            return compare(t1, t2);
+        else
+            return compare(t1, t2) == 1;
+    }
+
+    mutable Compare compare;
+    bool descending;
+};
+
+/**
+ * Stable sort of "members" on "threads" threads: parts are sorted in
+ * parallel, then merged pairwise in parallel.
+ */
+template <typename Less>
+void xParallelSort(vector<XParam *> &members, Less less, unsigned int threads)
+{
+    // smaller parts aren't worth a thread
+    const size_t MIN_PART = 8192;
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads > members.size() / MIN_PART)
+        threads = members.size() / MIN_PART;
+    if (threads <= 1) {
+        std::stable_sort(members.begin(), members.end(), less);
+        return;
+    }
+
+    vector<size_t> bounds;
+    for (unsigned int i = 0; i <= threads; i++)
+        bounds.push_back(members.size() * i / threads);
+    std::exception_ptr error;
+    std::mutex errorLock;
+    auto run = [&](std::function<void(size_t)> job, size_t jobs) {
+        vector<std::thread> workers;
+        for (size_t i = 0; i < jobs; i++)
+            workers.emplace_back([&, i]() {
+                try {
+                    job(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> guard(errorLock);
+                    error = std::current_exception();
+                }
+            });
+        for (std::thread &worker : workers)
+            worker.join();
+        if (error)
+            std::rethrow_exception(error);
+    };
+    run(
+        [&](size_t i) {
+            std::stable_sort(members.begin() + bounds[i], members.begin() + bounds[i + 1], less);
+        },
+        threads);
+    // merge neighbour parts until one part is left
+    while (bounds.size() > 2) {
+        vector<size_t> merged;
+        for (size_t i = 0; i + 1 < bounds.size(); i += 2)
+            merged.push_back(bounds[i]);
+        merged.push_back(bounds.back());
+        run(
+            [&](size_t i) {
+                size_t first = bounds[2 * i], middle = bounds[2 * i + 1];
+                size_t last = (2 * i + 2 < bounds.size()) ? bounds[2 * i + 2] : middle;
+                std::inplace_merge(members.begin() + first, members.begin() + middle,
+                                   members.begin() + last, less);
+            },
+            (bounds.size() - 1) / 2);
+        bounds.swap(merged);
+    }
+}
+
+/**
+ * Make room for "n" elements in containers that support it (vectors and
+ * hash maps); others, like lists and trees, are left as they are.
+ */
+template <typename Container>
+auto xReserve(Container &container, size_t n, int) -> decltype(container.reserve(n), void())
+{
+    container.reserve(n);
+}
+template <typename Container> void xReserve(Container &container, size_t n, long) {}
+template <typename Container> void xReserve(Container &container, size_t n)
+{
+    xReserve(container, n, 0);
+}
+
+/**
+ * Key of a set member as text, for paths of XParam::diff().
+ */
+template <typename Key> string xKeyString(const Key &key)
+{
+    if constexpr (std::is_convertible<Key, string>::value)
+        return key;
+    else if constexpr (std::is_arithmetic<Key>::value)
+        return std::to_string(key);
+    else {
+        std::ostringstream oss;
+        oss << key;
+        return oss.str();
+    }
+}
+
+/**
+ * \class XSetListener
+ * Receives changes of members of an XSetParam, see XSetParam::addListener().
+ */
+template <typename T> class XSetListener
+{
+public:
+    /** "member" is going to be added, throw to reject it. */
+    virtual void checkMember(T *member) {}
+    /** "members" are going to be added together, throw to reject them. */
+    virtual void checkMembers(const vector<T *> &members)
+    {
+        for (T *member : members)
+            checkMember(member);
+    }
+    virtual void memberAdded(T *member) = 0;
+    /** "member" is removed, it may be deleted after this call. */
+    virtual void memberRemoved(T *member) = 0;
+    /** All of members are removed. */
+    virtual void membersCleared() = 0;
+    /** Set is destroyed or moved, there would be no more calls. */
+    virtual void setDetached() = 0;
+    virtual ~XSetListener() {}
+};
+
+/**
+ * \class XSetIndex
+ * Secondary index of XSetParam members, see XSetParam::addIndex().
+ *
+ * Key of each member is taken by "extract" when member is added, call
+ * update() when indexed fields of a member change. Hash indexes find
+ * in O(1); ordered indexes find in O(log n) and can scan ranges of keys.
+ */
+template <typename T, typename IKey> class XSetIndex : public XSetListener<T>
+{
+public:
+    typedef std::function<IKey(const T *)> Extractor;
+
+    XSetIndex(const string &_name, Extractor _extract, bool _unique, bool _ordered) :
+        name(_name), extract(_extract), unique(_unique), ordered(_ordered)
+    {
+    }
+    const string &get_name() const { return name; }
+    bool isUnique() const { return unique; }
+    bool isOrdered() const { return ordered; }
+    size_t size() const { return keys.size(); }
+    /**
+     * Member with "key", NULL if there is not; any of them if index
+     * isn't unique.
+     */
+    T *find(const IKey &key) const
+    {
+        if (ordered) {
+            typename Tree::const_iterator iter = tree.find(key);
+            return iter == tree.end() ? NULL : iter->second;
+        }
+        typename Groups::const_iterator iter = groups.find(key);
+        return iter == groups.end() ? NULL : iter->second.front();
+    }
+    /** Members with "key". */
+    vector<T *> findAll(const IKey &key) const
+    {
+        vector<T *> result;
+        if (ordered) {
+            auto range = tree.equal_range(key);
+            for (typename Tree::const_iterator iter = range.first; iter != range.second; ++iter)
+                result.push_back(iter->second);
+        } else {
+            typename Groups::const_iterator iter = groups.find(key);
+            if (iter != groups.end())
+                result = iter->second;
+        }
+        return result;
+    }
+    size_t count(const IKey &key) const
+    {
+        if (ordered)
+            return tree.count(key);
+        typename Groups::const_iterator iter = groups.find(key);
+        return iter == groups.end() ? 0 : iter->second.size();
+    }
+    /**
+     * Visit members with "low" <= key <= "high" in order of keys, until
+     * "callback" returns false. Index should be ordered.
+     * \return number of visited members.
+     */
+    size_t scan(const IKey &low, const IKey &high, std::function<bool(T *)> callback) const
+    {
+        if (!ordered)
+            throw Exception("Index '" + name + "' isn't ordered.", TracePoint("pparam"));
+        size_t visited = 0;
+        typename Tree::const_iterator last = tree.upper_bound(high);
+        for (typename Tree::const_iterator iter = tree.lower_bound(low); iter != last; ++iter) {
+            ++visited;
+            if (!callback(iter->second))
+                break;
+        }
+        return visited;
+    }
+    /** Members with "low" <= key <= "high", in order of keys. */
+    vector<T *> range(const IKey &low, const IKey &high) const
+    {
+        vector<T *> result;
+        scan(low, high, [&result](T *member) {
+            result.push_back(member);
+            return true;
+        });
+        return result;
+    }
+    /**
+     * Move "member" to its new key after its indexed fields change.
+     */
+    void update(T *member)
+    {
+        typename Keys::iterator iter = keys.find(member);
+        if (iter == keys.end())
+            return;
+        IKey key = extract(member);
+        if (key == iter->second)
+            return;
+        if (unique && count(key) > 0)
+            throw Exception("Duplicated key in index '" + name + "' !", TracePoint("pparam"));
+        erase(member);
+        insert(member, key);
+    }
+
+    virtual void checkMember(T *member)
+    {
+        if (unique && count(extract(member)) > 0)
+            throw Exception("Duplicated key in index '" + name + "' !", TracePoint("pparam"));
+    }
+    virtual void checkMembers(const vector<T *> &members)
+    {
+        if (!unique)
+            return;
+        std::set<IKey> batch;
+        for (T *member : members) {
+            IKey key = extract(member);
+            if (count(key) > 0 || !batch.insert(key).second)
+                throw Exception("Duplicated key in index '" + name + "' !",
+                                TracePoint("pparam"));
+        }
+    }
+    virtual void memberAdded(T *member) { insert(member, extract(member)); }
+    virtual void memberRemoved(T *member) { erase(member); }
+    virtual void membersCleared()
+    {
+        tree.clear();
+        nodes.clear();
+        groups.clear();
+        slots.clear();
+        keys.clear();
+    }
+    virtual void setDetached() { membersCleared(); }
+
+protected:
+    typedef std::multimap<IKey, T *> Tree;
+    typedef XHashMap<IKey, vector<T *>, XKeyHash<IKey>, XKeyEqual<IKey>> Groups;
+    typedef XHashMap<T *, IKey> Keys;
+
+    void insert(T *member, const IKey &key)
+    {
+        keys[member] = key;
+        if (ordered) {
+            nodes[member] = tree.insert(std::make_pair(key, member));
+            return;
+        }
+        vector<T *> &group = groups[key];
+        slots[member] = group.size();
+        group.push_back(member);
+    }
+    void erase(T *member)
+    {
+        typename Keys::iterator kiter = keys.find(member);
+        if (kiter == keys.end())
+            return;
+        if (ordered) {
+            typename XHashMap<T *, typename Tree::iterator>::iterator niter = nodes.find(member);
+            tree.erase(niter->second);
+            nodes.erase(niter);
+        } else {
+            // last member of group takes place of removed one
+            typename Groups::iterator giter = groups.find(kiter->second);
+            vector<T *> &group = giter->second;
+            typename XHashMap<T *, size_t>::iterator siter = slots.find(member);
+            T *last = group.back();
+            group[siter->second] = last;
+            slots[last] = siter->second;
+            group.pop_back();
+            slots.erase(member);
+            if (group.empty())
+                groups.erase(giter);
+        }
+        keys.erase(kiter);
+    }
+
+    string name;
+    Extractor extract;
+    bool unique, ordered;
+    /** key of each member, as it was indexed */
+    Keys keys;
+    /** ordered index: members by key, and node of each member */
+    Tree tree;
+    XHashMap<T *, typename Tree::iterator> nodes;
+    /** hash index: members by key, and position of each member in group */
+    Groups groups;
+    XHashMap<T *, size_t> slots;
+};
+
+/**
+ * \class XOrderedSMap
+ * Search map policy of XSetParam: members are kept in a std::map, so
+ * min()/max() work and lookups take O(log n) comparisons.
+ */
+struct XOrderedSMap {
+    static const bool ordered = true;
+    template <typename Key, typename Value> using map = std::map<Key, Value, std::less<>>;
+};
+
+/**
+ * \class XHashSMap
+ * Search map policy of XSetParam: members are kept in an XHashMap, so
+ * lookups are O(1), but there is no order (no min()/max()).
+ */
+struct XHashSMap {
+    static const bool ordered = false;
+    template <typename Key, typename Value>
+    using map = XHashMap<Key, Value, XKeyHash<Key>, XKeyEqual<Key>>;
+};
+
+/**
+ * \class XHeapAlloc
+ * Allocation policy of XSetParam: each member is allocated by new and
+ * deleted when it's removed.
+ */
+struct XHeapAlloc {
+    template <typename T> class pool
+    {
+    public:
+        template <typename... Args> T *create(Args &&...args)
+        {
+            return new T(std::forward<Args>(args)...);
+        }
+        void destroy(XParam *param) { delete param; }
+        bool release() { return true; }
+    };
+};
+
+/**
+ * \class XSlabAlloc
+ * Allocation policy of XSetParam: members are constructed in slabs of
+ * an XSlabPool owned by set, which are freed together by clear().
+ *
+ * Members made by T::Type::newT() of XISetParam are still allocated by
+ * their type. Members taken by del_soft() should be released by
+ * destroyT() of their set.
+ */
+struct XSlabAlloc {
+    template <typename T> using pool = XSlabPool<T>;
+};
+
 /**
  * \class XSetParam
  * manages set-parameter.
@@ -666,25 +1399,31 @@ protected:
  * set-parameter is a mixture parameter that his sub-parameters are from
  * same type and number of them is varriable (base on user needs)
  * like of <disks> in xml-config file.
+ *
+ * \param SMap type of search map, XOrderedSMap or XHashSMap.
+ * \param Alloc allocation policy of members, XHeapAlloc or XSlabAlloc.
  */
-template <typename T, typename Key = int, typename List = std::vector<XParam *>>
+template <typename T, typename Key = int, typename List = std::vector<XParam *>,
+          typename SMap = XOrderedSMap, typename Alloc = XHeapAlloc>
 class XSetParam : public _XMixParam<List>
 {
 public:
-    typedef XSetParam<T, Key, List> _XSetParam;
+    typedef XSetParam<T, Key, List, SMap, Alloc> _XSetParam;
     typedef _XMixParam<List> XMixParam;
     typedef typename XMixParam::iterator iterator;
     typedef typename XMixParam::const_iterator const_iterator;
     typedef typename XMixParam::riterator riterator;
     typedef typename XMixParam::const_riterator const_riterator;
 
-    typedef std::map<Key, XParam *> map;
+    typedef typename SMap::template map<Key, XParam *> map;
     typedef typename map::iterator smiterator;
     typedef typename map::const_iterator const_smiterator;
+    typedef typename Alloc::template pool<T> pool;
     typedef XParam::XmlNode XmlNode;
 
     using XMixParam::begin;
     using XMixParam::dbengine;
+    using XMixParam::dbTrackedParentKey;
     using XMixParam::end;
     using XMixParam::params;
     using XParam::assignHelper;
@@ -696,11 +1435,26 @@ public:
         DESCENDING,
     };
 
-    XSetParam(const string &_pname) : XMixParam(_pname), smapEnabled(false) {}
+    XSetParam(const string &_pname) :
+        XMixParam(_pname), dbMembersValid(false), smapEnabled(false), fastRemoval(false)
+    {
+    }
     XSetParam(XSetParam &&_xsp) :
-        XMixParam(std::move(_xsp)), smap(std::move(_xsp.smap)), smapEnabled(_xsp.smapEnabled)
+        XMixParam(std::move(_xsp)), dbMembers(std::move(_xsp.dbMembers)),
+        dbMembersValid(_xsp.dbMembersValid), smap(std::move(_xsp.smap)),
+        smapEnabled(_xsp.smapEnabled), positions(std::move(_xsp.positions)),
+        fastRemoval(_xsp.fastRemoval), memberPool(std::move(_xsp.memberPool))
     {
         params = std::move(_xsp.params);
+        this->adoptAll(_xsp);
+        _xsp.dbMembersValid = false;
+        /* indexes belong to set, other listeners follow the old set */
+        indexes = std::move(_xsp.indexes);
+        for (auto &index : indexes) {
+            _xsp.removeListener(index.second.get());
+            addListener(index.second.get());
+        }
+        _xsp.detachListeners();
     }
     /**
      * \param node pointer to parameter node in XML document.
@@ -710,61 +1464,201 @@ public:
     /**
      * Add a copy of T-object to set.
      *
-     * T should support "=" operator.
+     * T should support "=" operator, copy constructor of T is used
+     * instead when it has one (see XParam::clone()).
      * \return pointer to the new created object from _t.
      */
     virtual T *addT(const T &_t)
     {
-        XParam *sparam = NULL;
+        T *sparam = NULL;
         try {
-            sparam = newT(_t);
-            *sparam = *(XParam *)&_t;
+            sparam = copyT(_t);
             addParam(sparam);
         } catch (Exception &e) {
             /* delete allocated memory. */
             if (sparam)
-                delete sparam;
+                destroyT(sparam);
             e.addTracePoint(TracePoint("pparam"));
             throw e;
         }
-        return (T *)sparam;
-    }
-    virtual void addParam(XParam *param)
-    {
-        T *sparam = dynamic_cast<T *>(param);
-        if (sparam == NULL) {
-            throw Exception("Bad T param in addParam", TracePoint("pparam"));
-        }
-        XMixParam::addParam(param);
-        if (smapEnabled) {
-            iterator iter = end();
-            try {
-                add2SMap(--iter);
-            } catch (Exception &e) {
-                /* Got o end to release last element.
-                 */
-                ++iter;
-                /* remove added parameter from list.
-                 */
-                params.pop_back();
-                e.addTracePoint(TracePoint("pparam"));
-                throw e;
-            }
-        }
+        return sparam;
     }
     /**
-     * Clear all of child parameters.
+     * Move _t into set by move constructor of T, when T can't be copied
+     * by constructors (see XParam::clone()) it's copied by operator=.
      */
-    virtual void clear()
+    virtual T *addT(T &&_t)
+    {
+        T *sparam = NULL;
+        try {
+            sparam = moveT(std::move(_t));
+            addParam(sparam);
+        } catch (Exception &e) {
+            if (sparam)
+                destroyT(sparam);
+            e.addTracePoint(TracePoint("pparam"));
+            throw e;
+        }
+        return sparam;
+    }
+    /**
+     * Construct a member from "args" by constructor of T and add it.
+     *
+     * \code
+     * disks.emplaceT("sda", 100 << 30);
+     * \endcode
+     */
+    template <typename... Args> T *emplaceT(Args &&...args)
+    {
+        T *sparam = NULL;
+        try {
+            sparam = memberPool.create(std::forward<Args>(args)...);
+            addParam(sparam);
+        } catch (Exception &e) {
+            if (sparam)
+                destroyT(sparam);
+            e.addTracePoint(TracePoint("pparam"));
+            throw e;
+        }
+        return sparam;
+    }
+    /**
+     * Make room for "n" members in storage and search map (when they
+     * support it), so adding them doesn't reallocate.
+     */
+    void reserve(size_t n)
+    {
+        xReserve(params, n);
+        if (smapEnabled)
+            reserveSMap(n);
+        if (fastRemoval)
+            positions.reserve(n);
+    }
+    /**
+     * Add members of "range" all or nothing: if one of them can't be
+     * added (bad type, missing or duplicated key, rejected by an index),
+     * set doesn't change.
+     *
+     * Range may hold T objects, which are copied like addT(), or
+     * pointers to members, which are owned by set on success like
+     * addParam(). Keys are checked before insertion and storage is
+     * reserved once.
+     */
+    template <typename Range> void addMany(const Range &range)
+    {
+        addMany(std::begin(range), std::end(range));
+    }
+    template <typename InputIt> void addMany(InputIt first, InputIt last)
+    {
+        typedef typename std::iterator_traits<InputIt>::value_type Value;
+        vector<T *> members;
+        try {
+            for (; first != last; ++first) {
+                if constexpr (std::is_pointer<Value>::value) {
+                    T *member = dynamic_cast<T *>(*first);
+                    if (member == NULL)
+                        throw Exception("Bad T param in addMany", TracePoint("pparam"));
+                    members.push_back(member);
+                } else
+                    members.push_back(copyT(*first));
+            }
+            addMembers(members);
+        } catch (Exception &e) {
+            /* copies are ours, pointers are still owned by caller */
+            if (!std::is_pointer<Value>::value)
+                for (T *member : members)
+                    destroyT(member);
+            e.addTracePoint(TracePoint("pparam"));
+            throw e;
+        }
+    }
+    /**
+     * Delete members with keys of "keys" all or nothing: if one of keys
+     * isn't in set, no member is deleted.
+     *
+     * Vectors are compacted once instead of once per member.
+     * You should call this function when smap has been enabled.
+     */
+    template <typename Range> void delMany(const Range &keys)
+    {
+        if (!smapEnabled)
+            throw Exception("delMany() needs search map.", TracePoint("pparam"));
+        for (const auto &_key : keys)
+            if (!keyExist(_key))
+                throw Exception("Key doesn't exist in set !", TracePoint("pparam"));
+        typedef typename std::iterator_traits<iterator>::iterator_category category;
+        if (fastRemoval || !std::is_same<category, std::random_access_iterator_tag>::value) {
+            /* members are removed in O(1), or can't be compacted */
+            for (const auto &_key : keys)
+                del(_key);
+            return;
+        }
+        XHashMap<XParam *, bool> removed;
+        for (const auto &_key : keys) {
+            smiterator siter = smap.find(_key);
+            if (siter == smap.end())
+                continue; // repeated key
+            removed[siter->second] = true;
+            smap.erase(siter);
+        }
+        params.erase(std::remove_if(begin(), end(),
+                                    [&removed](XParam *member) {
+                                        return removed.find(member) != removed.end();
+                                    }),
+                     end());
+        for (auto &member : removed) {
+            notifyRemoved(member.first);
+            destroyT(member.first);
+        }
+    }
+    virtual void addParam(XParam *param)
+    {
+        T *sparam = dynamic_cast<T *>(param);
+        if (sparam == NULL) {
+            throw Exception("Bad T param in addParam", TracePoint("pparam"));
+        }
+        for (XSetListener<T> *listener : listeners)
+            listener->checkMember(sparam);
+        XMixParam::addParam(param);
+        if (smapEnabled) {
+            iterator iter = end();
+            try {
+                add2SMap(--iter);
+            } catch (Exception &e) {
+                /* Got o end to release last element.
+                 */
+                ++iter;
+                /* remove added parameter from list.
+                 */
+                params.pop_back();
+                this->disown(param);
+                e.addTracePoint(TracePoint("pparam"));
+                throw e;
+            }
+        }
+        if (fastRemoval)
+            positions[param] = params.size() - 1;
+        for (XSetListener<T> *listener : listeners)
+            listener->memberAdded(sparam);
+    }
+    /**
+     * Clear all of child parameters.
+     */
+    virtual void clear()
     {
         if (smapEnabled)
             clearSMap();
+        positions.clear();
+        for (XSetListener<T> *listener : listeners)
+            listener->membersCleared();
         /* free dynamic allocated memory. */
         for (iterator iter = begin(); iter != end(); ++iter) {
             XParam *param = *iter;
-            delete param;
+            destroyT(param);
         }
         params.clear();
+        memberPool.release();
+        this->changed();
     }
     virtual void reset() { clear(); }
     /**
@@ -792,12 +1686,34 @@ public:
         clearSMap();
         smapEnabled = false;
     }
+    /**
+     * Remove members in O(1) by moving the last member into place of
+     * removed one, so del()/del_soft() don't search or shift "params".
+     *
+     * Order of members isn't kept after removals, use XOrderedSetParam
+     * when it matters. List should have random access iterators.
+     */
+    void enable_fast_removal()
+    {
+        typedef typename std::iterator_traits<iterator>::iterator_category category;
+        if (!std::is_same<category, std::random_access_iterator_tag>::value)
+            throw Exception("Fast removal needs random access list.", TracePoint("pparam"));
+        fastRemoval = true;
+        reindex();
+    }
+    void disable_fast_removal()
+    {
+        fastRemoval = false;
+        positions.clear();
+    }
     /**
      * Find parameter base on id.
      *
+     * Key may be of another type that search map compares with Key,
+     * e.g. std::string_view or "const char *" for string keys.
      * You should call this function when smap has been enabled.
      */
-    XParam *find(const Key &_key) const
+    template <typename K = Key> XParam *find(const K &_key) const
     {
         const_smiterator iter = smap.find(_key);
         if (iter != smap.end())
@@ -824,6 +1740,7 @@ public:
      */
     XParam *max()
     {
+        static_assert(SMap::ordered, "max() needs an ordered search map");
         typename map::reverse_iterator iter = smap.rbegin();
         if (iter != smap.rend())
             return iter->second;
@@ -836,6 +1753,7 @@ public:
      */
     XParam *min()
     {
+        static_assert(SMap::ordered, "min() needs an ordered search map");
         smiterator iter = smap.begin();
         if (iter != smap.end())
             return iter->second;
@@ -850,7 +1768,7 @@ public:
     {
         XParam *param = del_soft(_key);
         if (param)
-            delete param;
+            destroyT(param);
     }
     /**
      * Soft delete parameter(just storage structure) with specified key.
@@ -864,16 +1782,26 @@ public:
         smiterator siter = smap.find(_key);
         if (siter == smap.end())
             return NULL;
-        iterator iter = std::find(begin(), end(), siter->second);
         XParam *ret = siter->second;
-        params.erase(iter);
+        if (fastRemoval)
+            fastErase(std::next(begin(), positions[ret]));
+        else
+            params.erase(std::find(begin(), end(), ret));
         smap.erase(siter);
+        notifyRemoved(ret);
         return ret;
     }
     /**
      * Delete parameter(storage structure + memory) at specified location.
      */
-    virtual void del(iterator iter) { delete del_soft(iter); }
+    virtual void del(iterator iter) { destroyT(del_soft(iter)); }
+    /**
+     * Delete a member that has been taken by del_soft().
+     *
+     * Members of sets with XSlabAlloc policy should be deleted by this
+     * function, members of other sets could be deleted directly.
+     */
+    void destroyT(XParam *param) { memberPool.destroy(param); }
     /**
      * Soft delete parameter(just storage structure) at specified location.
      *
@@ -888,26 +1816,31 @@ public:
             smap.erase(smap.find(_key));
         }
         XParam *ret = *iter;
-        params.erase(iter);
+        if (fastRemoval)
+            fastErase(iter);
+        else
+            params.erase(iter);
+        notifyRemoved(ret);
         return ret;
     }
     /**
-     * This function will sort XSetParam like a bubble sort.
+     * Sort members in O(n log n), order of equal members is kept.
      *
      * \param compare is a template.
      * If compare was function then accept two params of T*,
-     * and about return: if first param is less than second param return 1,
-     * if first param is equal to second param return 0,
+     * and about return: it may return bool, true if first param is less
+     * than second param; or int, if first param is less than second param
+     * return 1, if first param is equal to second param return 0,
      * else return -1.
      *
      * If compare was class then overwrite () operator, with two params of T*.
      *
      * The following is two sample of compare templates:
      * \code
-     * 	int myfunction (T* i,T* j) { return (i<j); }
+     * 	bool myfunction (T* i,T* j) { return (*i<*j); }
      *
      * 	struct myclass {
-     * 		int operator() (T* i,T* j) { return (i<j);}
+     * 		int operator() (T* i,T* j) { return (*i<*j) ? 1 : (*j<*i) ? -1 : 0;}
      * 	} myobject;
      * \endcode
      *
@@ -917,25 +1850,103 @@ public:
      */
     template <class Compare> void sort(Compare compare, SortMode mode = SortMode::ASCENDING)
     {
-
-        int size = this->size();
-        int asc;
-
-        (mode == ASCENDING) ? asc = -1 : asc = 1;
-
-        for (auto i = 0; i != size - 1; ++i) {
-            auto beg = begin();
-            for (auto k = 0; k < size - i - 1; ++k) {
-                auto iter1 = beg;
-                auto iter2 = beg;
-                iter2++;
-                auto t1 = static_cast<T *>(*iter1);
-                auto t2 = static_cast<T *>(*iter2);
-                if (compare(t1, t2) == asc)
-                    std::iter_swap(iter1, iter2);
-                ++beg;
+        vector<XParam *> members(begin(), end());
+        std::stable_sort(members.begin(), members.end(),
+                         XSetOrder<T, Compare>(compare, mode == DESCENDING));
+        setOrder(members);
+    }
+    /**
+     * sort() that doesn't keep order of equal members, it's faster.
+     */
+    template <class Compare>
+    void sort_unstable(Compare compare, SortMode mode = SortMode::ASCENDING)
+    {
+        vector<XParam *> members(begin(), end());
+        std::sort(members.begin(), members.end(),
+                  XSetOrder<T, Compare>(compare, mode == DESCENDING));
+        setOrder(members);
+    }
+    /**
+     * sort() on "threads" threads (0: number of CPUs), for large sets.
+     *
+     * compare is called from several threads at once. Small sets are
+     * sorted on calling thread.
+     */
+    template <class Compare>
+    void sort_parallel(Compare compare, SortMode mode = SortMode::ASCENDING,
+                       unsigned int threads = 0)
+    {
+        vector<XParam *> members(begin(), end());
+        xParallelSort(members, XSetOrder<T, Compare>(compare, mode == DESCENDING), threads);
+        setOrder(members);
+    }
+    /**
+     * Let "listener" know about added and removed members (e.g.
+     * XSortedView), it's not owned by set.
+     */
+    void addListener(XSetListener<T> *listener) { listeners.push_back(listener); }
+    void removeListener(XSetListener<T> *listener)
+    {
+        listeners.erase(std::remove(listeners.begin(), listeners.end(), listener),
+                        listeners.end());
+    }
+    /**
+     * Add a secondary index on keys that "extract" takes from members,
+     * it's kept up to date as members are added and removed.
+     *
+     * \code
+     * vms.addIndex("by_host", [](const VM *vm) { return vm->host.value(); });
+     * vector<VM *> local = vms.index<string>("by_host").findAll(hostname);
+     * \endcode
+     * \param unique members can't share a key, adding such a member
+     * throws.
+     * \param ordered keep keys in order (range scans), instead of hash.
+     */
+    template <class Extract>
+    XSetIndex<T, typename std::decay<typename std::invoke_result<Extract, const T *>::type>::type> &
+    addIndex(const string &name, Extract extract, bool unique = false, bool ordered = false)
+    {
+        typedef typename std::decay<typename std::invoke_result<Extract, const T *>::type>::type IKey;
+        if (indexes.count(name))
+            throw Exception("Index '" + name + "' exists.", TracePoint("pparam"));
+        XSetIndex<T, IKey> *index = new XSetIndex<T, IKey>(name, extract, unique, ordered);
+        std::unique_ptr<XSetListener<T>> guard(index);
+        for (iterator iter = begin(); iter != end(); ++iter) {
+            try {
+                index->checkMember(static_cast<T *>(*iter));
+            } catch (Exception &e) {
+                e.addTracePoint(TracePoint("pparam"));
+                throw e;
             }
+            index->memberAdded(static_cast<T *>(*iter));
         }
+        indexes[name] = std::move(guard);
+        addListener(index);
+        return *index;
+    }
+    /**
+     * Index named "name", IKey is type of its keys.
+     */
+    template <typename IKey> XSetIndex<T, IKey> &index(const string &name)
+    {
+        typename std::map<string, std::unique_ptr<XSetListener<T>>>::iterator iter =
+            indexes.find(name);
+        XSetIndex<T, IKey> *index = (iter == indexes.end())
+                                        ? NULL
+                                        : dynamic_cast<XSetIndex<T, IKey> *>(iter->second.get());
+        if (index == NULL)
+            throw Exception("No index '" + name + "' with this type of keys.",
+                            TracePoint("pparam"));
+        return *index;
+    }
+    void dropIndex(const string &name)
+    {
+        typename std::map<string, std::unique_ptr<XSetListener<T>>>::iterator iter =
+            indexes.find(name);
+        if (iter == indexes.end())
+            return;
+        removeListener(iter->second.get());
+        indexes.erase(iter);
     }
     /**
      * Iterate on list and call
@@ -958,6 +1969,88 @@ public:
         }
         return true;
     }
+    /**
+     * iterate() on threads of "pool", for large sets or slow callbacks.
+     *
+     * Members are split to chunks of "chunk" members (0: chosen by pool),
+     * calling thread runs chunks too. callback is called from several
+     * threads at once, and set must not be changed until it returns. If a
+     * callback throws, remaining chunks are skipped and the exception is
+     * thrown.
+     */
+    template <class CallBack>
+    void parallel_iterate(CallBack callback, size_t chunk = 0,
+                          XThreadPool &pool = XThreadPool::shared())
+    {
+        vector<XParam *> members(begin(), end());
+        pool.parallelFor(members.size(), chunk, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++)
+                callback((T *)members[i]);
+        });
+    }
+    /**
+     * Members that "predicate" returns true for, in order of set;
+     * predicate is called like parallel_iterate().
+     */
+    template <class Predicate>
+    vector<T *> parallel_query_all(Predicate predicate, size_t chunk = 0,
+                                   XThreadPool &pool = XThreadPool::shared())
+    {
+        vector<XParam *> members(begin(), end());
+        chunk = pool.chunkSize(members.size(), chunk);
+        vector<vector<T *>> found((members.size() + chunk - 1) / chunk);
+        pool.parallelFor(members.size(), chunk, [&](size_t first, size_t last) {
+            vector<T *> &part = found[first / chunk];
+            for (size_t i = first; i < last; i++)
+                if (predicate((T *)members[i]))
+                    part.push_back((T *)members[i]);
+        });
+        vector<T *> result;
+        size_t count = 0;
+        for (vector<T *> &part : found)
+            count += part.size();
+        result.reserve(count);
+        for (vector<T *> &part : found)
+            result.insert(result.end(), part.begin(), part.end());
+        return result;
+    }
+    /**
+     * Combine "map" of all of members, e.g. sum of sizes of disks:
+     *
+     * \code
+     * XULLong total = disks.parallel_reduce((XULLong)0,
+     *         [](Disk *disk) { return disk->size.get_value(); },
+     *         std::plus<XULLong>());
+     * \endcode
+     * Each chunk is reduced from "init" on its thread, then results of
+     * chunks are combined in order of set, so "init" must be identity of
+     * "combine" (e.g. 0 for sum), and combine must be associative. map is
+     * called like parallel_iterate().
+     */
+    template <typename R, class Map, class Combine>
+    R parallel_reduce(R init, Map map, Combine combine, size_t chunk = 0,
+                      XThreadPool &pool = XThreadPool::shared())
+    {
+        vector<XParam *> members(begin(), end());
+        chunk = pool.chunkSize(members.size(), chunk);
+        vector<R> parts((members.size() + chunk - 1) / chunk, init);
+        pool.parallelFor(members.size(), chunk, [&](size_t first, size_t last) {
+            R &part = parts[first / chunk];
+            for (size_t i = first; i < last; i++)
+                part = combine(std::move(part), map((T *)members[i]));
+        });
+        R result = init;
+        for (R &part : parts)
+            result = combine(std::move(result), std::move(part));
+        return result;
+    }
+    /**
+     * Members are matched with members of base by their keys (by
+     * position, if they don't have keys), path of a member is
+     * "set/member[key]".
+     */
+    virtual void addChanges(const XParam &base, const string &path,
+                            vector<XParamChange> &changes) const;
 
     // Database functions
     /**
@@ -969,6 +2062,9 @@ public:
     /**
      * Update stored data using this XParam and its children by
      * associated XDBEngine
+     *
+     * Sets of single XParams can be updated only under a parent, their
+     * rows have no key of their own.
      * \param [in] parentNode Parent XParam of this object
      */
     virtual void dbUpdate(const XParam *parentNode = (XParam *)NULL);
@@ -991,10 +2087,121 @@ public:
     virtual void dbDestroyStructure(const XParam *parentNode = (XParam *)NULL);
     virtual void dbLoad(const XParam *parentNode = (XParam *)NULL);
     virtual void dbQuery(XDBCondition &conditions);
+    /**
+     * Load members that match "conditions".
+     *
+     * Values of conditions are bound to the statement, so queries with
+     * same shape share one plan in the engine.
+     */
+    virtual void dbQuery(const XDBExpr &conditions);
+    /**
+     * Asynchronous dbQuery(), see dbLoadAsync().
+     */
+    std::future<void> dbQueryAsync(const XDBExpr &conditions);
+    /**
+     * Stream members that match "conditions" to "callback" one by one,
+     * instead of loading all of them into this set.
+     *
+     * Each member is deleted when callback returns, so memory usage
+     * doesn't depend on the number of matched members.
+     * \param [in] callback returns false to stop the query.
+     * \return number of visited members.
+     */
+    XUInt dbQueryEach(const XDBExpr &conditions, std::function<bool(T &)> callback);
+    XUInt dbQueryEach(XDBCondition &conditions, std::function<bool(T &)> callback);
+    /**
+     * Load one page of members that match "conditions".
+     *
+     * Members are ordered by "orderBy" (a column of members, "" means
+     * their keys) and then by their keys, so order is total. Index the
+     * column (addDBIndex) to make each page an index seek.
+     *
+     * \code
+     * XDBPageCursor cursor;
+     * do {
+     *     vms.clear();
+     *     cursor = vms.dbQueryPage(cond, 100, cursor, "name");
+     *     ...
+     * } while (!cursor.isEnd());
+     * \endcode
+     * \param [in] cursor position to continue from, default is first page.
+     * \return cursor of next page, isEnd() if there is no more pages.
+     */
+    XDBPageCursor dbQueryPage(const XDBExpr &conditions, XUInt limit,
+                              const XDBPageCursor &cursor = XDBPageCursor(),
+                              const string &orderBy = "", bool descending = false);
+    /**
+     * Import members from XML file straight into database, without
+     * adding them to this set.
+     *
+     * Root element of document should be this set. Members are read and
+     * saved one by one, so document may be larger than memory. Each
+     * "batchSize" members are saved in one batch (XDBBatch) and indexes
+     * are created after loading (XDBEngine::deferIndexes).
+     * Structure is created if it doesn't exist.
+     * \param [in] progress called after each batch.
+     * \return statistics of import.
+     */
+    XDBImportStats dbImportXml(const string &xmlFile, XUInt batchSize = 10000,
+                               std::function<void(const XDBImportStats &)> progress = nullptr);
     virtual string generateJoinStmts(const XParam *parentNode = (XParam *)NULL);
-    virtual ~XSetParam() { clear(); }
+    virtual void dbResetTracking();
+    virtual ~XSetParam()
+    {
+        detachListeners();
+        clear();
+    }
 
 protected:
+    /**
+     * Reconcile stored single members with current members.
+     * \param tracked do we know which members are stored (dbMembers)?
+     */
+    void dbUpdateSingles(const XParam *parentNode, const string &pname, bool tracked);
+    /**
+     * Reconcile stored mix members with current members by their keys.
+     *
+     * Members which are not stored would be saved, removed members would
+     * be deleted and others would be updated.
+     */
+    void dbUpdateMixes(const XParam *parentNode, bool tracked);
+    /**
+     * Delete stored mix member (and his children) with specified key.
+     */
+    void dbDeleteMember(const XParam *parentNode, const string &key);
+    /**
+     * Record current members of set as stored members.
+     *
+     * Mix members are recorded by their keys and single members by their
+     * values.
+     */
+    void dbTrackMembers(const XParam *parentNode);
+    /**
+     * Load members by keys that "where" clause selects and give them to
+     * "consumer" one by one, consumer owns them.
+     */
+    XUInt dbQueryItems(const string &where, const stringList &params,
+                       std::function<bool(T *)> consumer);
+    /**
+     * Table of members, throws if members are not mix.
+     */
+    string dbMemberTable();
+    /**
+     * Create a member and load it by its key, caller owns it.
+     * \param reader reader of member table.
+     * \param layout shared by members loaded in a row.
+     */
+    T *dbLoadItem(XDBRowReader &reader, const string &key,
+                  typename XMixParam::DBLayout &layout);
+    /**
+     * Members of set (keys or values) as they have been stored by the
+     * last dbLoad/dbSave/dbUpdate under "dbTrackedParentKey".
+     *
+     * dbUpdate reconciles current members with these, so only added or
+     * removed members would be inserted or deleted.
+     */
+    std::multiset<string> dbMembers;
+    bool dbMembersValid;
     /**
      * Add defined parameter to search map.
      *
@@ -1028,6 +2235,118 @@ protected:
      * Clear content of smap.
      */
     virtual void clearSMap() { smap.clear(); }
+    virtual void reserveSMap(size_t n) { xReserve(smap, n); }
+    /**
+     * Erase member at "iter" in fast removal mode: last member is moved
+     * into its place.
+     */
+    void fastErase(iterator iter)
+    {
+        XParam *last = *std::prev(end());
+        size_t position = std::distance(begin(), iter);
+        positions.erase(*iter);
+        if (*iter != last) {
+            *iter = last;
+            positions[last] = position;
+        }
+        params.pop_back();
+    }
+    /**
+     * Put members in order of "members", which holds all of them.
+     */
+    void setOrder(const vector<XParam *> &members)
+    {
+        typename vector<XParam *>::const_iterator member = members.begin();
+        for (iterator iter = begin(); iter != end(); ++iter, ++member)
+            *iter = *member;
+        reindex();
+        this->changed();
+    }
+    void notifyRemoved(XParam *member)
+    {
+        this->disown(member);
+        this->changed();
+        for (XSetListener<T> *listener : listeners)
+            listener->memberRemoved(static_cast<T *>(member));
+    }
+    /**
+     * Add "members" of addMany(): check all of them, then put them in
+     * storage and search map.
+     */
+    void addMembers(const vector<T *> &members)
+    {
+        vector<Key> keys;
+        if (smapEnabled) {
+            typename SMap::template map<Key, bool> batch;
+            xReserve(batch, members.size());
+            keys.reserve(members.size());
+            for (T *member : members) {
+                Key _key;
+                if (!member->key(_key))
+                    throw Exception("Parameter doesn't have any key !", TracePoint("pparam"));
+                if (keyExist(_key) || !batch.emplace(_key, true).second)
+                    throw Exception("Duplicated key parameter !", TracePoint("pparam"));
+                keys.push_back(_key);
+            }
+        }
+        for (XSetListener<T> *listener : listeners)
+            listener->checkMembers(members);
+        size_t added = 0;
+        try {
+            reserve(params.size() + members.size());
+            for (T *member : members) {
+                XMixParam::addParam(member);
+                iterator iter = end();
+                --iter;
+                if (smapEnabled)
+                    _add2SMap(keys[added], iter);
+                if (fastRemoval)
+                    positions[member] = params.size() - 1;
+                memberStored(iter);
+                ++added;
+            }
+        } catch (std::bad_alloc &e) {
+            /* undo partial insertion, search map is built again */
+            for (; added > 0; --added) {
+                this->disown(params.back());
+                params.pop_back();
+            }
+            if (smapEnabled) {
+                clearSMap();
+                for (iterator iter = begin(); iter != end(); ++iter)
+                    add2SMap(iter);
+            }
+            reindex();
+            throw Exception(e.what(), TracePoint("pparam"));
+        }
+        for (T *member : members)
+            for (XSetListener<T> *listener : listeners)
+                listener->memberAdded(member);
+    }
+    /**
+     * Member at "iter" is added by addMany(), subclasses that keep
+     * positions of members record it.
+     */
+    virtual void memberStored(const iterator &iter) {}
+    void detachListeners()
+    {
+        vector<XSetListener<T> *> detached;
+        detached.swap(listeners);
+        for (XSetListener<T> *listener : detached)
+            listener->setDetached();
+    }
+    /**
+     * Rebuild positions of members after they are reordered.
+     */
+    virtual void reindex()
+    {
+        if (!fastRemoval)
+            return;
+        positions.clear();
+        size_t position = 0;
+        for (iterator iter = begin(); iter != end(); ++iter, ++position)
+            positions[*iter] = position;
+    }
     /**
      * Search map base of parameters IDs.
      *
@@ -1057,18 +2376,228 @@ protected:
      * smap has been enabled?
      */
     bool smapEnabled;
+    /**
+     * Index of each member in "params", kept in fast removal mode.
+     */
+    XHashMap<XParam *, size_t> positions;
+    bool fastRemoval;
+    vector<XSetListener<T> *> listeners;
+    /** secondary indexes by name, they are in "listeners" too */
+    std::map<string, std::unique_ptr<XSetListener<T>>> indexes;
+    /** allocator of members, see Alloc */
+    pool memberPool;
     /**
      * new functions ..
      * This functions enable us to implement XISetParam functionalities.
      */
     virtual T *newT(const XmlNode *node)
     {
-        T *t = new T;
+        T *t = memberPool.create();
         if (t == NULL)
             throw Exception("Can't allocate memory !", TracePoint("pparam"));
         return t;
     }
     virtual T *newT(const T &t) { return newT((const XmlNode *)NULL); }
+    /**
+     * New member that is a copy of "t".
+     *
+     * Made by copy constructor of T if it has one, because it copies
+     * fields without type checks of operator=.
+     */
+    virtual T *copyT(const T &t)
+    {
+        if constexpr (std::is_copy_constructible<T>::value)
+            return memberPool.create(t);
+        else
+            return assignT(t);
+    }
+    /**
+     * New member that "t" is moved to, see copyT().
+     *
+     * Mixture types have generated move constructors that don't move
+     * their sub-parameters, so T is moved only if it can be copied by
+     * constructor, which is written by T then.
+     */
+    virtual T *moveT(T &&t)
+    {
+        if constexpr (std::is_copy_constructible<T>::value)
+            return memberPool.create(std::move(t));
+        else
+            return assignT(t);
+    }
+    /**
+     * New member made by newT() and assigned by operator=.
+     */
+    T *assignT(const T &t)
+    {
+        T *copy = newT(t);
+        try {
+            *(XParam *)copy = *(const XParam *)&t;
+        } catch (Exception &e) {
+            destroyT(copy);
+            e.addTracePoint(TracePoint("pparam"));
+            throw e;
+        }
+        return copy;
+    }
+};
+
+/**
+ * \class XOrderedSetParam
+ * XSetParam that keeps order of members and removes them in O(1).
+ *
+ * Members are kept in a linked list and position of each member is
+ * hashed, so del()/del_soft() neither search nor shift the list.
+ * Indexed access (value(int)) walks the list; use enable_fast_removal()
+ * of XSetParam when order of members doesn't matter.
+ */
+template <typename T, typename Key = int, typename SMap = XOrderedSMap,
+          typename Alloc = XHeapAlloc>
+class XOrderedSetParam : public XSetParam<T, Key, std::list<XParam *>, SMap, Alloc>
+{
+public:
+    typedef XSetParam<T, Key, std::list<XParam *>, SMap, Alloc> _XSetParam;
+    typedef typename _XSetParam::iterator iterator;
+    typedef typename _XSetParam::smiterator smiterator;
+
+    using _XSetParam::begin;
+    using _XSetParam::end;
+    using _XSetParam::params;
+
+    XOrderedSetParam(const string &_pname) : _XSetParam(_pname) {}
+    /* list nodes don't move, so positions stay valid */
+    XOrderedSetParam(XOrderedSetParam &&_xosp) :
+        _XSetParam(std::move(_xosp)), nodes(std::move(_xosp.nodes))
+    {
+    }
+    virtual void addParam(XParam *param)
+    {
+        _XSetParam::addParam(param);
+        nodes[param] = std::prev(end());
+    }
+    virtual void clear()
+    {
+        nodes.clear();
+        _XSetParam::clear();
+    }
+    virtual XParam *del_soft(const Key &_key)
+    {
+        smiterator siter = this->smap.find(_key);
+        if (siter == this->smap.end())
+            return NULL;
+        XParam *ret = siter->second;
+        typename Nodes::iterator niter = nodes.find(ret);
+        params.erase(niter->second);
+        nodes.erase(niter);
+        this->smap.erase(siter);
+        this->notifyRemoved(ret);
+        return ret;
+    }
+    virtual XParam *del_soft(iterator iter)
+    {
+        nodes.erase(*iter);
+        return _XSetParam::del_soft(iter);
+    }
+
+protected:
+    typedef XHashMap<XParam *, iterator> Nodes;
+    virtual void memberStored(const iterator &iter) { nodes[*iter] = iter; }
+    virtual void reindex()
+    {
+        nodes.clear();
+        for (iterator iter = begin(); iter != end(); ++iter)
+            nodes[*iter] = iter;
+    }
+    /** list node of each member */
+    Nodes nodes;
+};
+
+/**
+ * \class XSortedView
+ * Members of an XSetParam in sorted order, kept sorted as members are
+ * added or removed, so sets needn't be sorted again for each display.
+ *
+ * View doesn't own members. Call update() when sort key of a member
+ * changes. View stops following its set when set is destroyed (or
+ * moved), then it's empty.
+ * \code
+ * XSortedView<User> byName(users, [](User *u1, User *u2) {
+ *     return u1->name.value() < u2->name.value();
+ * });
+ * for (User *user : byName)
+ *     ...
+ * \endcode
+ */
+template <typename T> class XSortedView : public XSetListener<T>
+{
+protected:
+    typedef std::multiset<T *, std::function<bool(const XParam *, const XParam *)>> Members;
+
+public:
+    typedef typename Members::const_iterator iterator;
+    typedef typename Members::const_iterator const_iterator;
+
+    /**
+     * \param compare comparator of T*, like of XSetParam::sort().
+     */
+    template <typename Set, typename Compare>
+    XSortedView(Set &set, Compare compare, typename Set::SortMode mode = Set::ASCENDING) :
+        members(XSetOrder<T, Compare>(compare, mode == Set::DESCENDING))
+    {
+        for (typename Set::iterator iter = set.begin(); iter != set.end(); ++iter)
+            memberAdded(static_cast<T *>(*iter));
+        set.addListener(this);
+        detach = [&set, this]() { set.removeListener(this); };
+    }
+    XSortedView(const XSortedView &) = delete;
+    XSortedView &operator=(const XSortedView &) = delete;
+    virtual ~XSortedView()
+    {
+        if (detach)
+            detach();
+    }
+
+    const_iterator begin() const { return members.begin(); }
+    const_iterator end() const { return members.end(); }
+    size_t size() const { return members.size(); }
+    bool empty() const { return members.empty(); }
+    /**
+     * Move "member" to its place after its sort key is changed.
+     */
+    void update(T *member)
+    {
+        typename XHashMap<T *, typename Members::iterator>::iterator iter = nodes.find(member);
+        if (iter == nodes.end())
+            return;
+        members.erase(iter->second);
+        iter->second = members.insert(member);
+    }
+
+    virtual void memberAdded(T *member) { nodes[member] = members.insert(member); }
+    virtual void memberRemoved(T *member)
+    {
+        typename XHashMap<T *, typename Members::iterator>::iterator iter = nodes.find(member);
+        if (iter == nodes.end())
+            return;
+        members.erase(iter->second);
+        nodes.erase(iter);
+    }
+    virtual void membersCleared()
+    {
+        members.clear();
+        nodes.clear();
+    }
+    virtual void setDetached()
+    {
+        detach = nullptr;
+        membersCleared();
+    }
+
+protected:
+    Members members;
+    /** node of each member in "members" */
+    XHashMap<T *, typename Members::iterator> nodes;
+    std::function<void()> detach;
 };
 
 /**
@@ -1104,13 +2633,14 @@ protected:
  * T should support "public type(type &t) const" function that would
  * adjust type based on caller object.
  */
-template <typename T, typename Key = int, typename List = std::vector<XParam *>>
-class XISetParam : public XSetParam<T, Key, List>
+template <typename T, typename Key = int, typename List = std::vector<XParam *>,
+          typename SMap = XOrderedSMap, typename Alloc = XHeapAlloc>
+class XISetParam : public XSetParam<T, Key, List, SMap, Alloc>
 {
 public:
     typedef typename T::Type Type;
 
-    typedef XSetParam<T, Key, List> _XSetParam;
+    typedef XSetParam<T, Key, List, SMap, Alloc> _XSetParam;
     typedef typename _XSetParam::XMixParam XMixParam;
     typedef typename _XSetParam::iterator iterator;
     typedef typename _XSetParam::const_iterator const_iterator;
@@ -1139,25 +2669,51 @@ protected:
             throw Exception("newT failed!", TracePoint("pparam"));
         return tmp;
     }
+    /**
+     * Copy of "t" by its clone(), if clone() of t's own type is there,
+     * else by newT() of t's type and operator=.
+     */
+    virtual T *copyT(const T &t)
+    {
+        XParam *copy = t.clone();
+        if (copy != NULL) {
+            if (typeid(*copy) == typeid(t))
+                return static_cast<T *>(copy);
+            /* clone() of a base class, it's sliced */
+            delete copy;
+        }
+        return this->assignT(t);
+    }
+    /**
+     * Members are of different types, they are copied by copyT().
+     */
+    virtual T *moveT(T &&t) { return copyT(t); }
 };
 
 /**
  * \class XListParam
  * "XList" of "XParam" parameters.
+ *
+ * Members are deleted by other threads on the fly (see xdel()), so only
+ * XHeapAlloc policy is supported.
  */
-template <typename T, typename Key = int>
-class XListParam : public XISetParam<T, Key, XList<XParam *>>
+template <typename T, typename Key = int, typename SMap = XOrderedSMap,
+          typename Alloc = XHeapAlloc>
+class XListParam : public XISetParam<T, Key, XList<XParam *>, SMap, Alloc>
 {
+    static_assert(std::is_same<Alloc, XHeapAlloc>::value,
+                  "XListParam members are deleted by other threads, use XHeapAlloc");
+
 public:
-    typedef XISetParam<T, Key, XList<XParam *>> _XSetParam;
-    typedef XISetParam<T, Key, XList<XParam *>> _XISetParam;
+    typedef XISetParam<T, Key, XList<XParam *>, SMap, Alloc> _XSetParam;
+    typedef XISetParam<T, Key, XList<XParam *>, SMap, Alloc> _XISetParam;
     typedef typename _XISetParam::XMixParam XMixParam;
     typedef typename _XISetParam::iterator iterator;
     typedef typename _XISetParam::const_iterator const_iterator;
     typedef typename _XISetParam::riterator riterator;
     typedef typename _XISetParam::const_riterator const_riterator;
 
-    typedef std::map<Key, iterator> map;
+    typedef typename SMap::template map<Key, iterator> map;
     typedef typename map::iterator smiterator;
     typedef typename map::const_iterator const_smiterator;
     typedef XParam::XmlNode XmlNode;
@@ -1184,18 +2740,18 @@ public:
     }
     virtual void reset() { clear(); }
     /**
-     * Find parameter base on id.
+     * Find parameter base on id, see XSetParam::find().
      *
      * You should call this function when smap has been enabled.
      */
-    iterator find(const Key &_key)
+    template <typename K = Key> iterator find(const K &_key)
     {
         const_smiterator iter = smap.find(_key);
         if (iter != smap.end())
             return iter->second;
         return end();
     }
-    const_iterator find(const Key &_key) const
+    template <typename K = Key> const_iterator find(const K &_key) const
     {
         const_smiterator iter = smap.find(_key);
         if (iter != smap.end())
@@ -1209,6 +2765,7 @@ public:
      */
     const_iterator max() const
     {
+        static_assert(SMap::ordered, "max() needs an ordered search map");
         typename map::reverse_iterator iter = smap.rbegin();
         if (iter != smap.rend())
             return iter->second;
@@ -1221,6 +2778,7 @@ public:
      */
     const_iterator min() const
     {
+        static_assert(SMap::ordered, "min() needs an ordered search map");
         smiterator iter = smap.begin();
         if (iter != smap.end())
             return iter->second;
@@ -1243,6 +2801,8 @@ public:
         iterator iter = siter->second;
         if (!params.xerase_prepare(iter))
             iter = end();
+        else
+            this->notifyRemoved(*iter);
         smap.erase(siter);
         return iter;
     }
@@ -1255,7 +2815,10 @@ public:
             if (siter != smap.end())
                 smap.erase(siter);
         }
-        return params.xerase_prepare(iter);
+        if (!params.xerase_prepare(iter))
+            return false;
+        this->notifyRemoved(*iter);
+        return true;
     }
     /**
      * Delete prepared element, should be called after "xdel_prepare" call.
@@ -1348,6 +2911,7 @@ protected:
      * Clear content of smap.
      */
     virtual void clearSMap() { smap.clear(); }
+    virtual void reserveSMap(size_t n) { xReserve(smap, n); }
     /**
      * Search map.
      * \see XSetParam::smap.
@@ -33,14 +33,20 @@ namespace pparam
  */
 template<typename List>
 _XMixParam<List>::_XMixParam(const string& _pname) :
-	XParam(_pname)
+	XParam(_pname), dbengine(NULL), dbTrackedRollbacks(0)
 {
 	//xmap = NULL;
 }
 
 template<typename List>
 _XMixParam<List>::_XMixParam(_XMixParam &&_xmp) : XParam(std::move(_xmp)),
-					dbengine(_xmp.dbengine)
+					dbengine(_xmp.dbengine),
+					dbSnapshot(std::move(_xmp.dbSnapshot)),
+					dbTrackedKey(std::move(_xmp.dbTrackedKey)),
+					dbTrackedParentKey(
+						std::move(_xmp.dbTrackedParentKey)),
+					dbTrackedRollbacks(_xmp.dbTrackedRollbacks),
+					dbIndexes(std::move(_xmp.dbIndexes))
 { 
 	/* We cant move params, because XMixParam is mix of some fixed
 	 * parameters.
@@ -132,15 +138,21 @@ bool _XMixParam<List>::operator == (const XParam &parameter)
 	const	XMixParam	*_mixParameter =
 				dynamic_cast<const XMixParam*>(&parameter);
 	XMixParam		*mixParameter = (XMixParam*) _mixParameter;
-	iterator		first = params.begin();
-	iterator		second = mixParameter->begin();
 
 	if (!mixParameter)
 		throw Exception(Exception::FAILED,
 				"Bax mix parameter in assignment !",
 				TracePoint("pparam"));
+	/* different fingerprints, different parameters; they aren't
+	 * computed here, uncached subtrees would be hashed on each call.
+	 */
+	if (fingerprintValid && mixParameter->fingerprintValid
+		&& (fingerprintCache != mixParameter->fingerprintCache))
+		return false;
 	if (params.size() != mixParameter->size())
 		return false;
+	iterator		first = params.begin();
+	iterator		second = mixParameter->begin();
 	for (; first != params.end(); first++, second++) {
 		if (**first != **second)
 			return false;
@@ -155,6 +167,41 @@ bool _XMixParam<List>::operator != (const XParam &parameter)
 	return !(*this == parameter);
 }
 
+template<typename List>
+uint64_t _XMixParam<List>::computeFingerprint(bool &cacheable) const
+{
+	uint64_t hash = 0;
+	size_t count = 0;
+	for (const_iterator iter = params.begin(); iter != params.end();
+								++iter, ++count) {
+		const XParam *child = *iter;
+		hash = hashCombine(hash, child->fingerprint());
+		/* we aren't told about changes of children that aren't
+		 * cached, or have another parent */
+		if ((child->parentParam != this) || !child->fingerprintValid)
+			cacheable = false;
+	}
+	return hashCombine(hash, count);
+}
+
+template<typename List>
+void _XMixParam<List>::addChanges(const XParam &base, const string &path,
+				vector<XParamChange> &changes) const
+{
+	if (fingerprint() == base.fingerprint())
+		return;
+	const XMixParam *mix = dynamic_cast<const XMixParam *>(&base);
+	if ((mix == NULL) || (params.size() != mix->params.size())) {
+		changes.push_back({XParamChange::MODIFIED, path});
+		return;
+	}
+	const_iterator iter = params.begin();
+	const_iterator base_iter = mix->params.begin();
+	for (; iter != params.end(); ++iter, ++base_iter)
+		(*iter)->addChanges(**base_iter,
+				path + "/" + (*iter)->get_pname(), changes);
+}
+
 template<typename List>
 void _XMixParam<List>::reset()
 {
@@ -194,6 +241,18 @@ bool _XMixParam<List>::verify()
 
 template<typename List>
 void _XMixParam<List>::dbSave(const XParam* parentNode)
+{
+	dbSaveRow(parentNode, parentNode == NULL);
+}
+
+template<typename List>
+void _XMixParam<List>::dbSaveInBatch()
+{
+	dbSaveRow(NULL, false);
+}
+
+template<typename List>
+void _XMixParam<List>::dbSaveRow(const XParam* parentNode, bool transaction)
 {
 	if (params.size() == 0)
 		return;
@@ -205,7 +264,7 @@ void _XMixParam<List>::dbSave(const XParam* parentNode)
 		throw Exception("No key assigned : " + this->get_pname(),
 			TracePoint("pparam"));
 	}
-	if (parentNode == NULL)
+	if (transaction)
 		dbengine->startTransaction();
 
 	for (iterator iter = params.begin(); iter != params.end(); ++iter) {
@@ -234,9 +293,14 @@ void _XMixParam<List>::dbSave(const XParam* parentNode)
 	else
 		dbengine->saveXParam(this->get_pname(), this->get_key(), fields,
 			values);
-
-	if (parentNode == NULL)
-		dbengine->commitTransaction();
+	/* fields are exactly single children, so values are our snapshot. */
+	dbSnapshot = values;
+	dbTrackedKey = lkey;
+	dbTrackedParentKey = (parentNode == NULL) ? "" : parentNode->get_key();
+	dbTrackRollbacks();
+
+	if (transaction)
+		dbCommit(NULL);
 }
 
 template<typename List>
@@ -245,7 +309,7 @@ void _XMixParam<List>::dbUpdate(const XParam* parentNode)
 	if (params.size() == 0)
 		return;
 
-	stringList fields, values;
+	stringList fields, values, current;
 	if (parentNode == NULL)
 		dbengine->startTransaction();
 
@@ -255,6 +319,12 @@ void _XMixParam<List>::dbUpdate(const XParam* parentNode)
 		throw Exception("No key assigned : " + this->get_pname(),
 			TracePoint("pparam"));
 	}
+	string pkey = (parentNode == NULL) ? "" : parentNode->get_key();
+	/* If we know what is stored for this row, only changed columns
+	 * would be written.
+	 */
+	bool tracked = !dbSnapshot.empty() && (dbTrackedKey == lkey)
+		&& (dbTrackedParentKey == pkey) && dbTrackingValid();
 	//fields
 	for (iterator iter = params.begin(); iter != params.end(); ++iter) {
 		XMixParam *xmix = dynamic_cast<XMixParam *>(*iter);
@@ -268,23 +338,35 @@ void _XMixParam<List>::dbUpdate(const XParam* parentNode)
 						+ this->get_pname() + "!",
 					TracePoint("pparam"));
 			} else {
-				fields.push_back(xpar->get_pname());
-				values.push_back(xpar->value());
+				string val = xpar->value();
+				unsigned int index = current.size();
+				if (!tracked || index >= dbSnapshot.size()
+					|| dbSnapshot[index] != val) {
+					fields.push_back(xpar->get_pname());
+					values.push_back(val);
+				}
+				current.push_back(val);
 			}
 		} else { //its mix
 			xmix->dbUpdate((XParam*) this);
 		}
 	}
-	if (parentNode == NULL)
-		dbengine->updateXParam(this->get_pname(), this->get_key(),
-			fields, values);
-	else
-		dbengine->updateXParam(this->get_pname(), this->get_key(),
-			parentNode->get_pname(), parentNode->get_key(), fields,
-			values);
+	/* there is nothing to write, if nothing changed in this row. */
+	if (!fields.empty()) {
+		if (parentNode == NULL)
+			dbengine->updateXParam(this->get_pname(), lkey,
+				fields, values);
+		else
+			dbengine->updateXParam(this->get_pname(), lkey,
+				parentNode->get_pname(), pkey, fields,
+				values);
+	}
+	dbSnapshot = current;
+	dbTrackedKey = lkey;
+	dbTrackedParentKey = pkey;
+	dbTrackRollbacks();
 
-	if (parentNode == NULL)
-		dbengine->commitTransaction();
+	dbCommit(parentNode);
 }
 
 template<typename List>
@@ -310,11 +392,37 @@ void _XMixParam<List>::dbDelete(const XParam* parentNode)
 			parentNode->get_pname(), parentNode->get_key());
 	else
 		dbengine->removeXParam(this->get_pname(), this->get_key());
+	dbSnapshot.clear();
 
 	if (parentNode == NULL)
 		dbengine->commitTransaction();
 }
 
+template<typename List>
+std::future<void> _XMixParam<List>::dbSaveAsync()
+{
+	return dbengine->executor()->submit([this]() { this->dbSave(); });
+}
+
+template<typename List>
+std::future<void> _XMixParam<List>::dbUpdateAsync()
+{
+	return dbengine->executor()->submit([this]() { this->dbUpdate(); });
+}
+
+template<typename List>
+std::future<void> _XMixParam<List>::dbDeleteAsync()
+{
+	return dbengine->executor()->submit([this]() { this->dbDelete(); });
+}
+
+template<typename List>
+std::future<void> _XMixParam<List>::dbLoadAsync()
+{
+	return dbengine->executor()->submit([this]() { this->dbLoad(); },
+						false);
+}
+
 template<typename List>
 void _XMixParam<List>::dbCreateStructure(const XParam* parentNode)
 {
@@ -352,10 +460,50 @@ void _XMixParam<List>::dbCreateStructure(const XParam* parentNode)
 		dbengine->createXParamStructure(this->get_pname(),
 			parentNode->get_pname(), fields, ftypes);
 
+	for (unsigned int i = 0; i < dbIndexes.size(); ++i) {
+		const stringList &ifields = dbIndexes[i].first;
+		for (unsigned int j = 0; j < ifields.size(); ++j) {
+			XParam *xpar = this->value(ifields[j]);
+			if ((xpar == NULL) || (dynamic_cast<XMixParam *>(xpar)
+								!= NULL)) {
+				if (parentNode == NULL)
+					dbengine->rollbackTransaction();
+				throw Exception("There is no single field with "
+					"name of '" + ifields[j] + "' in '"
+					+ this->get_pname() + "' to index it.",
+					TracePoint("pparam"));
+			}
+		}
+		dbengine->createXParamIndex(this->get_pname(), ifields,
+							dbIndexes[i].second);
+	}
+
 	if (parentNode == NULL)
 		dbengine->commitTransaction();
 }
 
+template<typename List>
+void _XMixParam<List>::addDBIndex(const string &field, bool unique)
+{
+	addDBIndex(stringList(1, field), unique);
+}
+
+template<typename List>
+void _XMixParam<List>::addDBIndex(const stringList &fields, bool unique)
+{
+	if (fields.empty())
+		throw Exception("Index of '" + this->get_pname()
+					+ "' has no field.",
+				TracePoint("pparam"));
+	/* Move constructors of inherited classes may declare them again. */
+	for (unsigned int i = 0; i < dbIndexes.size(); ++i)
+		if (dbIndexes[i].first == fields) {
+			dbIndexes[i].second = unique;
+			return;
+		}
+	dbIndexes.push_back(std::make_pair(fields, unique));
+}
+
 template<typename List>
 void _XMixParam<List>::dbDestroyStructure(const XParam* parentNode)
 {
@@ -376,37 +524,70 @@ void _XMixParam<List>::dbDestroyStructure(const XParam* parentNode)
 template<typename List>
 void _XMixParam<List>::dbLoad(const XParam* parentNode)
 {
-	stringList fields, values;
-	int res;
-	if (parentNode == NULL)
-		res = dbengine->loadXParamRow(this->get_pname(),
-			this->get_key(), fields, values);
-	else
-		res = dbengine->loadXParamRow(this->get_pname(),
-			this->get_key(), parentNode->get_pname(),
-			parentNode->get_key(), fields, values);
-	if (res == 0)
+	std::unique_ptr<XDBRowReader> reader = dbengine->rowReader(
+		this->get_pname(),
+		(parentNode == NULL) ? "" : parentNode->get_pname());
+	if (!this->dbLoad(*reader, this->get_key(),
+			(parentNode == NULL) ? "" : parentNode->get_key(),
+			dbLayout))
 		return;
-	this->dbLoad(fields, values);
+	dbTrack(parentNode);
 }
 
 template<typename List>
 void _XMixParam<List>::dbLoad(stringList &fields, stringList &values)
 {
+	DBRowLoader loader(this, dbLayout);
+	loader.bindFields(fields);
+	for (unsigned int i = 0; i < values.size(); i++)
+		loader.loadValue(i, values[i].c_str());
+	dbLoadChildren();
+}
+
+template<typename List>
+bool _XMixParam<List>::dbLoad(XDBRowReader &reader, const string &key,
+		const string &parentKey, DBLayout &layout)
+{
+	DBRowLoader loader(this, layout);
+	if (reader.load(key, parentKey, loader) == 0)
+		return false;
+	dbLoadChildren();
+	return true;
+}
+
+template<typename List>
+void _XMixParam<List>::dbLoadChildren()
+{
+	for (iterator iter = params.begin(); iter != params.end(); ++iter) {
+		XMixParam *xptr = dynamic_cast<XMixParam *>(*iter);
+		if (xptr != NULL)
+			xptr->dbLoad(this);
+	}
+}
+
+template<typename List>
+void _XMixParam<List>::DBRowLoader::bindFields(const stringList &fields)
+{
+	if (fields == layout.fields)
+		return;
+	vector<int> slots(fields.size(), -1);
 	for (unsigned int i = 0; i < fields.size(); i++) {
-		if (this->value(fields[i]) == NULL)
+		int slot = 0;
+		for (iterator iter = mix->params.begin();
+				iter != mix->params.end(); ++iter, ++slot)
+			if ((*iter)->get_pname() == fields[i]) {
+				slots[i] = slot;
+				break;
+			}
+		if (slots[i] < 0)
 			throw Exception(
 				"Theres no field with name of '" + fields[i]
-					+ "' in '" + this->get_pname()
+					+ "' in '" + mix->get_pname()
 					+ "' to put loaded data in it.",
 				TracePoint("pparam"));
-		(*this->value(fields[i])) = values[i];
-	}
-	for (unsigned int i = 0; i < params.size(); i++) {
-		XMixParam *xptr = dynamic_cast<XMixParam *>(value(i));
-		if (xptr != NULL)
-			xptr->dbLoad(this);
 	}
+	layout.fields = fields;
+	layout.slots.swap(slots);
 }
 
 template<typename List>
@@ -427,6 +608,53 @@ XDBEngine* _XMixParam<List>::getDBEngine()
 	return dbengine;
 }
 
+template<typename List>
+void _XMixParam<List>::dbTrack(const XParam* parentNode)
+{
+	dbSnapshot = dbValues();
+	dbTrackedKey = this->get_key();
+	dbTrackedParentKey = (parentNode == NULL) ? "" : parentNode->get_key();
+	dbTrackRollbacks();
+}
+
+template<typename List>
+void _XMixParam<List>::dbResetTracking()
+{
+	dbSnapshot.clear();
+	for (iterator iter = params.begin(); iter != params.end(); ++iter) {
+		XMixParam *xmix = dynamic_cast<XMixParam *>(*iter);
+		if (xmix != NULL) { //its mix
+			xmix->dbResetTracking();
+		}
+	}
+}
+
+template<typename List>
+stringList _XMixParam<List>::dbValues() const
+{
+	stringList values;
+	for (const_iterator iter = params.begin(); iter != params.end(); ++iter) {
+		if (dynamic_cast<const XMixParam *>(*iter) == NULL) //its single
+			values.push_back((*iter)->value());
+	}
+	return values;
+}
+
+template<typename List>
+void _XMixParam<List>::dbCommit(const XParam* parentNode)
+{
+	if (parentNode != NULL)
+		return;
+	try {
+		dbengine->commitTransaction();
+	} catch (Exception &e) {
+		/* Nothing has been stored, so our snapshots are wrong. */
+		dbResetTracking();
+		e.addTracePoint(TracePoint("pparam"));
+		throw e;
+	}
+}
+
 template<typename List>
 string _XMixParam<List>::generateJoinStmts(const XParam* parentNode)
 {
@@ -469,6 +697,7 @@ XParam &XIntParam<T>::operator=(const XParam &xp)
 	min = xip->min;
 	max = xip->max;
 	val = xip->val;
+	changed();
 
 	return *this;
 }
@@ -478,6 +707,7 @@ XIntParam<T> &XIntParam<T>::operator++()
 {
 	val ++;
 	if (checkLimit() && (val > max)) val = min;
+	changed();
 	return *this;
 }
 
@@ -487,6 +717,7 @@ XIntParam<T> XIntParam<T>::operator++(int)
 	XIntParam<T> temp = *this;
 	val ++;
 	if (checkLimit() && (val > max)) val = min;
+	changed();
 	return temp;
 }
 
@@ -495,6 +726,7 @@ XIntParam<T> &XIntParam<T>::operator--()
 {
 	val --;
 	if (checkLimit() && (val < min)) val = max;
+	changed();
 	return *this;
 }
 
@@ -504,6 +736,7 @@ XIntParam<T> XIntParam<T>::operator--(int)
 	XIntParam<T> temp = *this;
 	val --;
 	if (checkLimit() && (val < min)) val = max;
+	changed();
 	return temp;
 }
 
@@ -529,13 +762,14 @@ XParam &XEnumParam<T>::operator = (const XParam &xp)
 	}
 	def = xep->def;
 	val = xep->val;
+	changed();
 	return *this;
 }
 
 /* Implementation of "XSetParam" Class.
  */
-template<typename T, typename Key, typename List>
-XParam &XSetParam<T, Key, List>::operator=(const XmlNode *node)
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+XParam &XSetParam<T, Key, List, SMap, Alloc>::operator=(const XmlNode *node)
 {
 	if (!is_myNode(node)) return (*this);
 
@@ -553,10 +787,10 @@ XParam &XSetParam<T, Key, List>::operator=(const XmlNode *node)
 				if (sparam->is_myNode(*iter)) {
 					(*sparam) = (*iter);
 					addParam(sparam);
-				} else delete sparam;
+				} else destroyT(sparam);
 			} catch (Exception &e) {
 				clear();
-				if (sparam) delete sparam;
+				if (sparam) destroyT(sparam);
 				e.addTracePoint(TracePoint("pparam"));
 				throw e;
 			}
@@ -565,8 +799,8 @@ XParam &XSetParam<T, Key, List>::operator=(const XmlNode *node)
 	return (*this);
 }
 
-template<typename T, typename Key, typename List>
-XParam &XSetParam<T, Key, List>::operator=(const XParam &xp)
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+XParam &XSetParam<T, Key, List, SMap, Alloc>::operator=(const XParam &xp)
 {
 	const _XSetParam *_xsp = dynamic_cast<const _XSetParam*>(&xp);
 	_XSetParam *xsp = (_XSetParam *) _xsp;
@@ -605,8 +839,64 @@ XParam &XSetParam<T, Key, List>::operator=(const XParam &xp)
 	return *this;
 }
 
-template<typename T, typename Key, typename List>
-void XSetParam<T, Key, List>::dbSave(const XParam *parentNode)
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::addChanges(const XParam &base,
+		const string &path, vector<XParamChange> &changes) const
+{
+	if (this->fingerprint() == base.fingerprint())
+		return;
+	const _XSetParam *xsp = dynamic_cast<const _XSetParam *>(&base);
+	if (xsp == NULL) {
+		changes.push_back({XParamChange::MODIFIED, path});
+		return;
+	}
+	/* members of base by key, and those without key in order */
+	typename SMap::template map<Key, const XParam *> keyed;
+	vector<const XParam *> unkeyed;
+	for (const_iterator iter = xsp->begin(); iter != xsp->end(); ++iter) {
+		Key _key;
+		if (((T *) *iter)->key(_key) &&
+				keyed.emplace(_key, *iter).second)
+			continue;
+		unkeyed.push_back(*iter);
+	}
+	size_t position = 0;
+	for (const_iterator iter = begin(); iter != end(); ++iter) {
+		T *member = (T *) *iter;
+		const XParam *old = NULL;
+		Key _key;
+		string mpath = path + "/" + member->get_pname() + "[";
+		if (member->key(_key)) {
+			auto found = keyed.find(_key);
+			if (found != keyed.end()) {
+				old = found->second;
+				keyed.erase(found);
+			}
+			mpath += xKeyString(_key) + "]";
+		} else {
+			if (position < unkeyed.size())
+				old = unkeyed[position];
+			mpath += std::to_string(position++) + "]";
+		}
+		if (old == NULL)
+			changes.push_back({XParamChange::ADDED, mpath});
+		else
+			member->addChanges(*old, mpath, changes);
+	}
+	for (auto &member : keyed) {
+		Key _key = member.first;
+		changes.push_back({XParamChange::REMOVED, path + "/" +
+			member.second->get_pname() + "[" +
+			xKeyString(_key) + "]"});
+	}
+	for (; position < unkeyed.size(); ++position)
+		changes.push_back({XParamChange::REMOVED, path + "/" +
+			unkeyed[position]->get_pname() + "[" +
+			std::to_string(position) + "]"});
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbSave(const XParam *parentNode)
 {
 	if (params.size() == 0)
 		return;
@@ -638,73 +928,217 @@ void XSetParam<T, Key, List>::dbSave(const XParam *parentNode)
 			xmp->dbSave(parentNode);
 		}
 	}
-	if (parentNode == NULL)
-		dbengine->commitTransaction();
+	dbTrackMembers(parentNode);
+	this->dbCommit(parentNode);
 }
 
-template<typename T, typename Key, typename List>
-void XSetParam<T, Key, List>::dbUpdate(const XParam *parentNode)
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbUpdate(const XParam *parentNode)
 {
-	if (params.size() == 0)
+	if (parentNode == NULL && params.size() == 0)
 		return;
-	stringList fields, values;
-	if (parentNode == NULL)
-		dbengine->startTransaction();
 	XParam *xptr = newT(NULL);
 	const XMixParam *xmix = dynamic_cast<const XMixParam *>(xptr);
-	if (xmix == NULL) { //its single
-		dbengine->removeXParamByParent(xptr->get_pname(),
-						parentNode->get_pname(),
-						parentNode->get_key());
-		for (iterator iter = params.begin();
-			iter != params.end(); ++iter) {
-			const XParam *xsp = (const XParam *) *iter;
-			stringList fields, values;
-			fields.push_back(xsp->get_pname());
-			values.push_back(xsp->value());
-			if (parentNode == NULL)
-				dbengine->saveXParam(xsp->get_pname(),
-					xsp->get_key(), fields, values);
-			else
-				dbengine->saveXParam(xsp->get_pname(),
-					xsp->get_key(),
+	if (parentNode == NULL && xmix == NULL) {
+		/* Rows of top-level singles have neither key nor parent, so
+		 * stored ones can't be found to be replaced.
+		 */
+		destroyT(xptr);
+		throw Exception("Top-level single sets can't be updated : "
+				+ this->get_pname(), TracePoint("pparam"));
+	}
+	if (parentNode == NULL)
+		dbengine->startTransaction();
+	/* Do we know which members are stored? */
+	bool tracked = dbMembersValid && (parentNode != NULL)
+		&& (dbTrackedParentKey == parentNode->get_key())
+		&& this->dbTrackingValid();
+	try {
+		if (xmix == NULL) //its single
+			dbUpdateSingles(parentNode, xptr->get_pname(), tracked);
+		else //its mix
+			dbUpdateMixes(parentNode, tracked);
+	} catch (Exception &e) {
+		destroyT(xptr);
+		e.addTracePoint(TracePoint("pparam"));
+		throw e;
+	}
+	destroyT(xptr);
+	dbTrackMembers(parentNode);
+	this->dbCommit(parentNode);
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbUpdateSingles(const XParam *parentNode,
+					const string &pname, bool tracked)
+{
+	std::multiset<string> current;
+	for (iterator iter = params.begin(); iter != params.end(); ++iter)
+		current.insert((*iter)->value());
+
+	if (!tracked) {
+		/* We don't know what is stored, so rewrite all of them. */
+		dbengine->removeXParamByParent(pname,
+			parentNode->get_pname(), parentNode->get_key());
+		dbMembers.clear();
+	} else {
+		/* Single members are addressed by their values, so values
+		 * that lost some copies would be removed and rewritten.
+		 */
+		for (auto iter = dbMembers.begin(); iter != dbMembers.end();) {
+			auto range = dbMembers.equal_range(*iter);
+			if (current.count(*iter) <
+					(size_t) std::distance(range.first, range.second)) {
+				dbengine->removeXParamByValue(pname,
 					parentNode->get_pname(),
-					parentNode->get_key(), fields,
-					values);
+					parentNode->get_key(), pname, *iter);
+				iter = dbMembers.erase(range.first, range.second);
+			} else
+				iter = range.second;
 		}
-	} else { //its mix
-		for (iterator iter = params.begin();
-			iter != params.end(); ++iter) {
-			XMixParam *xmp = (XMixParam *)(*iter);
+	}
+	for (auto iter = current.begin(); iter != current.end();
+					iter = current.upper_bound(*iter)) {
+		stringList fields, values;
+		fields.push_back(pname);
+		values.push_back(*iter);
+		size_t stored = dbMembers.count(*iter);
+		size_t copies = current.count(*iter);
+		for (; stored < copies; ++stored)
+			dbengine->saveXParam(pname, "", parentNode->get_pname(),
+				parentNode->get_key(), fields, values);
+	}
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbUpdateMixes(const XParam *parentNode,
+								bool tracked)
+{
+	std::set<string> stored, current;
+	if (tracked) {
+		stored.insert(dbMembers.begin(), dbMembers.end());
+	} else if (parentNode != NULL) {
+		XParam *test = newT(NULL);
+		stringList keys;
+		dbengine->loadXParamKeyListByParent(test->get_pname(),
+			parentNode->get_pname(), parentNode->get_key(), keys);
+		stored.insert(keys.begin(), keys.end());
+		destroyT(test);
+	}
+	for (iterator iter = params.begin(); iter != params.end(); ++iter) {
+		XMixParam *xmp = (XMixParam *)(*iter);
+		string key = xmp->get_key();
+		current.insert(key);
+		/* New members may not know the engine yet. */
+		if (xmp->getDBEngine() != dbengine)
+			xmp->setDBEngine(dbengine);
+		/* Without parent we can't see what is stored, so just
+		 * update members as before.
+		 */
+		if (parentNode == NULL || stored.count(key))
 			xmp->dbUpdate(parentNode);
-		}
+		else
+			xmp->dbSave(parentNode);
 	}
 	if (parentNode == NULL)
-		dbengine->commitTransaction();
+		return;
+	for (auto iter = stored.begin(); iter != stored.end(); ++iter) {
+		if (!current.count(*iter))
+			dbDeleteMember(parentNode, *iter);
+	}
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbDeleteMember(const XParam *parentNode,
+							const string &key)
+{
+	/* Load stored member to remove his children too. */
+	XMixParam *removed = (XMixParam *) newT(NULL);
+	removed->setDBEngine(dbengine);
+	stringList fields, values;
+	try {
+		if (dbengine->loadXParamRow(removed->get_pname(), key,
+			parentNode->get_pname(), parentNode->get_key(),
+			fields, values)) {
+			removed->dbLoad(fields, values);
+			if (removed->get_key() == key)
+				removed->dbDelete(parentNode);
+			else
+				dbengine->removeXParam(removed->get_pname(),
+					key, parentNode->get_pname(),
+					parentNode->get_key());
+		}
+	} catch (Exception &e) {
+		destroyT(removed);
+		e.addTracePoint(TracePoint("pparam"));
+		throw e;
+	}
+	destroyT(removed);
 }
 
-template<typename T, typename Key, typename List>
-void XSetParam<T, Key, List>::dbDelete(const XParam *parentNode)
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbDelete(const XParam *parentNode)
 {
 	if (parentNode == NULL)
 		dbengine->startTransaction();
 	XParam *xptr = newT(NULL);
 	XMixParam *xmix = dynamic_cast<XMixParam *>(xptr);
-	if (xmix != NULL) { //its mix
-		xmix->dbDelete((XParam*) this);
+	if (xmix != NULL && parentNode == NULL) { //its mix
+		for (iterator iter = params.begin(); iter != params.end();
+								++iter) {
+			XMixParam *xmp = (XMixParam *)(*iter);
+			xmp->setDBEngine(dbengine);
+			xmp->dbDelete(parentNode);
+		}
+	} else if (xmix != NULL) { //its mix
+		/* Members are stored under our parent, delete all of them. */
+		stringList keys;
+		dbengine->loadXParamKeyListByParent(xmix->get_pname(),
+			parentNode->get_pname(), parentNode->get_key(), keys);
+		for (unsigned int i = 0; i < keys.size(); ++i)
+			dbDeleteMember(parentNode, keys[i]);
 	} else {
 		dbengine->removeXParamByParent(xptr->get_pname(),
 			parentNode->get_pname(), parentNode->get_key());
 	}
+	destroyT(xptr);
+	dbMembers.clear();
+	dbMembersValid = false;
 	if (parentNode == NULL)
 		dbengine->commitTransaction();
 }
 
-template<typename T, typename Key, typename List>
-void XSetParam<T, Key, List>::dbCreateStructure(const XParam *parentNode)
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbTrackMembers(const XParam *parentNode)
 {
-	if (params.size() == 0)
+	dbMembers.clear();
+	dbMembersValid = (parentNode != NULL);
+	if (!dbMembersValid)
 		return;
+	dbTrackedParentKey = parentNode->get_key();
+	this->dbTrackRollbacks();
+	for (iterator iter = params.begin(); iter != params.end(); ++iter) {
+		if (dynamic_cast<XMixParam *>(*iter) == NULL) //its single
+			dbMembers.insert((*iter)->value());
+		else //its mix
+			dbMembers.insert((*iter)->get_key());
+	}
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbResetTracking()
+{
+	dbMembers.clear();
+	dbMembersValid = false;
+	XMixParam::dbResetTracking();
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbCreateStructure(const XParam *parentNode)
+{
+	/* Structure comes from a new member, so we don't need any member
+	 * here; empty sets need their tables too.
+	 */
 	stringList fields;
 	vector<DBFieldTypes> ftypes;
 	if (parentNode == NULL)
@@ -733,21 +1167,23 @@ void XSetParam<T, Key, List>::dbCreateStructure(const XParam *parentNode)
 					ftypes);
 		}
 	} else { //its mix
-		xmix->dbCreateStructure((XParam*) this);
+		xmix->setDBEngine(dbengine);
+		xmix->dbCreateStructure(parentNode);
 	}
 	if (parentNode == NULL)
 		dbengine->commitTransaction();
 }
 
-template<typename T, typename Key, typename List>
-void XSetParam<T, Key, List>::dbDestroyStructure(const XParam *parentNode)
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbDestroyStructure(const XParam *parentNode)
 {
 	if (parentNode == NULL)
 		dbengine->startTransaction();
 	XParam *xptr=newT(NULL);
 	XMixParam *xmix = dynamic_cast<XMixParam *>(xptr);
 	if (xmix != NULL) { //its mix
-		xmix->dbDestroyStructure((XParam*) this);
+		xmix->setDBEngine(dbengine);
+		xmix->dbDestroyStructure(parentNode);
 	}
 	else
 	{
@@ -757,9 +1193,13 @@ void XSetParam<T, Key, List>::dbDestroyStructure(const XParam *parentNode)
 		dbengine->commitTransaction();
 }
 
-template<typename T, typename Key, typename List>
-void XSetParam<T, Key, List>::dbLoad(const XParam *parentNode)
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbLoad(const XParam *parentNode)
 {
+	/* Loaded members are stored, besides of the members that we knew. */
+	if (!dbMembersValid || dbTrackedParentKey != parentNode->get_key()
+			|| !this->dbTrackingValid())
+		dbMembers.clear();
 	XParam *test = newT(NULL);
 	XMixParam *xmix = dynamic_cast<XMixParam *>(test);
 	if (xmix != NULL) { //its mix
@@ -767,16 +1207,18 @@ void XSetParam<T, Key, List>::dbLoad(const XParam *parentNode)
 		dbengine->loadXParamKeyListByParent(test->get_pname(),
 			parentNode->get_pname(), parentNode->get_key(),
 			keys);
+		typename XMixParam::DBLayout layout;
+		std::unique_ptr<XDBRowReader> reader = dbengine->rowReader(
+			test->get_pname(), parentNode->get_pname());
 		for (unsigned int i = 0; i < keys.size(); i++) {
 			XMixParam *newitem = (XMixParam*)newT(NULL);
 			newitem->setDBEngine(this->getDBEngine());
-			stringList fields, values;
-			dbengine->loadXParamRow(newitem->get_pname(),
-				keys[i], parentNode->get_pname(),
-				parentNode->get_key(), fields, values);
-			newitem->dbLoad(fields,values);
+			newitem->dbLoad(*reader, keys[i], parentNode->get_key(),
+				layout);
+			newitem->dbTrack(parentNode);
 			this->addParam(newitem);
 		}
+		dbMembers.insert(keys.begin(), keys.end());
 	} else {
 		stringList values;
 		dbengine->loadXParamValueListByParent(test->get_pname(),
@@ -787,37 +1229,273 @@ void XSetParam<T, Key, List>::dbLoad(const XParam *parentNode)
 			(*newitem) = values[i];
 			this->addParam(newitem);
 		}
+		dbMembers.insert(values.begin(), values.end());
 	}
-	delete test;
+	dbMembersValid = true;
+	dbTrackedParentKey = parentNode->get_key();
+	this->dbTrackRollbacks();
+	destroyT(test);
 }
 
-template<typename T, typename Key, typename List>
-void XSetParam<T, Key, List>::dbQuery(XDBCondition &conditions)
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbQuery(XDBCondition &conditions)
 {
-	XMixParam *test = (XMixParam *) newT(NULL);
-	string cmd = "SELECT DISTINCT " + test->get_pname() + "."
-		+ test->get_pname() + "_key FROM " + test->get_pname()
-		+ " " + test->generateJoinStmts() + " WHERE "
-		+ conditions.getConditions();
-	vector<vector<string> > res;
-	vector<string> cols;
-	this->getDBEngine()->getData(cmd, res, cols);
+	dbQueryItems(conditions.getConditions(), stringList(),
+		[this](T *item) {
+			this->addParam(item);
+			return true;
+		});
+}
 
-	//xptr->get_pname();
-	for (unsigned int i = 0; i < res.size(); i++) {
-		XMixParam *newitem = (XMixParam*) newT(NULL);
-		newitem->setDBEngine(this->getDBEngine());
-		stringList fields, values;
-		this->getDBEngine()->loadXParamRow(newitem->get_pname(),
-			res[i][0], fields, values);
-		newitem->dbLoad(fields, values);
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+void XSetParam<T, Key, List, SMap, Alloc>::dbQuery(const XDBExpr &conditions)
+{
+	stringList params;
+	string where = conditions.compile(params);
+	dbQueryItems(where, params, [this](T *item) {
+			this->addParam(item);
+			return true;
+		});
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+std::future<void> XSetParam<T, Key, List, SMap, Alloc>::dbQueryAsync(
+					const XDBExpr &conditions)
+{
+	return this->getDBEngine()->executor()->submit(
+		[this, conditions]() { this->dbQuery(conditions); }, false);
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+XUInt XSetParam<T, Key, List, SMap, Alloc>::dbQueryEach(const XDBExpr &conditions,
+					std::function<bool(T &)> callback)
+{
+	stringList params;
+	string where = conditions.compile(params);
+	return dbQueryItems(where, params, [this, &callback](T *item) {
+			std::unique_ptr<T, std::function<void(T *)> > guard(
+				item, [this](T *t) { destroyT(t); });
+			return callback(*item);
+		});
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+XUInt XSetParam<T, Key, List, SMap, Alloc>::dbQueryEach(XDBCondition &conditions,
+					std::function<bool(T &)> callback)
+{
+	return dbQueryItems(conditions.getConditions(), stringList(),
+		[this, &callback](T *item) {
+			std::unique_ptr<T, std::function<void(T *)> > guard(
+				item, [this](T *t) { destroyT(t); });
+			return callback(*item);
+		});
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+XUInt XSetParam<T, Key, List, SMap, Alloc>::dbQueryItems(const string &where,
+	const stringList &params, std::function<bool(T *)> consumer)
+{
+	string table = dbMemberTable();
+	XParam *xptr = newT(NULL);
+	string cmd = "SELECT DISTINCT " + table + "." + table + "_key FROM "
+		+ table + " "
+		+ dynamic_cast<XMixParam *>(xptr)->generateJoinStmts()
+		+ " WHERE " + where;
+	destroyT(xptr);
+
+	XDBEngine *engine = this->getDBEngine();
+	XUInt count = 0;
+	typename XMixParam::DBLayout layout;
+	std::unique_ptr<XDBRowReader> reader = engine->rowReader(table, "");
+	/* Rows are streamed, so only one member is in memory here. */
+	XDBRowFunction visitor([&](const XDBRow &row) {
+		T *newitem = dbLoadItem(*reader, row[0], layout);
+		++count;
+		return consumer(newitem);
+	});
+	try {
+		engine->query(cmd, params, visitor);
+	} catch (Exception &e) {
+		e.addTracePoint(TracePoint("pparam"));
+		throw e;
+	}
+	return count;
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+XDBPageCursor XSetParam<T, Key, List, SMap, Alloc>::dbQueryPage(const XDBExpr &conditions,
+	XUInt limit, const XDBPageCursor &cursor, const string &orderBy,
+	bool descending)
+{
+	if (cursor.isEnd())
+		return cursor;
+	if (limit == 0)
+		throw Exception("Page size can't be zero.", TracePoint("pparam"));
+	if (!cursor.isStart() && (cursor.getOrderBy() != orderBy
+			|| cursor.isDescending() != descending))
+		throw Exception("Cursor belongs to another order.",
+				TracePoint("pparam"));
+	for (unsigned int i = 0; i < orderBy.size(); i++)
+		if (!isalnum((unsigned char) orderBy[i]) && orderBy[i] != '_')
+			throw Exception("Invalid order column: " + orderBy,
+					TracePoint("pparam"));
+
+	string table = dbMemberTable();
+	string keyColumn = table + "." + table + "_key";
+	string orderColumn = orderBy.empty() ? "" : table + "." + orderBy;
+	string direction = descending ? " DESC" : " ASC";
+	stringList params;
+	string where = (conditions && cursor.condition(orderColumn, keyColumn))
+			.compile(params);
+
+	XParam *xptr = newT(NULL);
+	std::stringstream cmd;
+	cmd << "SELECT DISTINCT " << keyColumn
+		<< (orderColumn.empty() ? "" : ", " + orderColumn)
+		<< " FROM " << table << " "
+		<< dynamic_cast<XMixParam *>(xptr)->generateJoinStmts()
+		<< " WHERE " << where << " ORDER BY "
+		<< (orderColumn.empty() ? "" : orderColumn + direction + ", ")
+		<< keyColumn << direction
+		/* one more row tells whether there is a next page */
+		<< " LIMIT " << (limit + 1);
+	destroyT(xptr);
+
+	XDBEngine *engine = this->getDBEngine();
+	XUInt count = 0;
+	bool more = false;
+	string lastKey, lastValue;
+	typename XMixParam::DBLayout layout;
+	std::unique_ptr<XDBRowReader> reader = engine->rowReader(table, "");
+	XDBRowFunction visitor([&](const XDBRow &row) {
+		if (count == limit) {
+			more = true;
+			return false;
+		}
+		T *newitem = dbLoadItem(*reader, row[0], layout);
 		this->addParam(newitem);
+		lastKey = row[0];
+		if (!orderColumn.empty())
+			lastValue = row[1];
+		++count;
+		return true;
+	});
+	try {
+		engine->query(cmd.str(), params, visitor);
+	} catch (Exception &e) {
+		e.addTracePoint(TracePoint("pparam"));
+		throw e;
+	}
+	if (!more)
+		return XDBPageCursor::endCursor();
+	return XDBPageCursor(orderBy, descending, lastValue, lastKey);
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+XDBImportStats XSetParam<T, Key, List, SMap, Alloc>::dbImportXml(const string &xmlFile,
+	XUInt batchSize, std::function<void(const XDBImportStats &)> progress)
+{
+	XDBEngine *engine = this->getDBEngine();
+	XDBImportStats stats;
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	if (batchSize == 0)
+		batchSize = 1;
+
+	engine->deferIndexes(true);
+	try {
+		xml::Reader reader(xmlFile);
+		if (reader.get_root_name() != this->get_pname())
+			throw Exception("Root of '" + xmlFile + "' is not '"
+						+ this->get_pname() + "'.",
+					TracePoint("pparam"));
+		this->dbCreateStructure();
+		bool more = true;
+		while (more) {
+			XDBBatch batch(engine);
+			for (XUInt i = 0; i < batchSize; i++) {
+				const XmlNode *node = reader.next_child();
+				if (node == NULL) {
+					more = false;
+					break;
+				}
+				std::unique_ptr<T, std::function<void(T *)> > item(
+					newT(node), [this](T *t) { destroyT(t); });
+				if (!item->is_myNode(node))
+					continue;
+				XParam *xparam = item.get();
+				*xparam = node;
+				XMixParam *xmix =
+					dynamic_cast<XMixParam *>(item.get());
+				if (xmix != NULL) {
+					/* A savepoint per member is two more
+					 * statements; if one fails the whole
+					 * batch is rolled back anyway.
+					 */
+					xmix->setDBEngine(engine);
+					xmix->dbSaveInBatch();
+				} else
+					engine->saveXParam(item->get_pname(),
+						item->get_key(),
+						stringList(1, item->get_pname()),
+						stringList(1, item->value()));
+				++stats.items;
+			}
+			batch.commit();
+			stats.bytes = reader.bytes_read();
+			stats.seconds = std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count();
+			if (progress)
+				progress(stats);
+		}
+		engine->deferIndexes(false);
+	} catch (Exception &e) {
+		try {
+			/* imported members are kept, so they need the
+			 * indexes too. */
+			engine->deferIndexes(false);
+		} catch (Exception &ie) {
+		}
+		e.addTracePoint(TracePoint("pparam"));
+		throw e;
+	}
+	stats.seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+string XSetParam<T, Key, List, SMap, Alloc>::dbMemberTable()
+{
+	XParam *xptr = newT(NULL);
+	XMixParam *test = dynamic_cast<XMixParam *>(xptr);
+	string table = xptr->get_pname();
+	destroyT(xptr);
+	if (test == NULL)
+		throw Exception("Members of '" + this->get_pname()
+					+ "' are not queryable.",
+				TracePoint("pparam"));
+	return table;
+}
+
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+T *XSetParam<T, Key, List, SMap, Alloc>::dbLoadItem(XDBRowReader &reader, const string &key,
+	typename XMixParam::DBLayout &layout)
+{
+	T *newitem = newT(NULL);
+	XMixParam *xmix = (XMixParam *) newitem;
+	try {
+		xmix->setDBEngine(this->getDBEngine());
+		xmix->dbLoad(reader, key, "", layout);
+	} catch (Exception &e) {
+		destroyT(newitem);
+		throw e;
 	}
-	delete test;
+	return newitem;
 }
 
-template<typename T, typename Key, typename List>
-string XSetParam<T, Key, List>::generateJoinStmts(const XParam *parentNode)
+template<typename T, typename Key, typename List, typename SMap, typename Alloc>
+string XSetParam<T, Key, List, SMap, Alloc>::generateJoinStmts(const XParam *parentNode)
 {
 	XParam *xptr=newT(NULL);
 	XMixParam *xmix = dynamic_cast<XMixParam *>(xptr);
@@ -0,0 +1,534 @@
+/**
+ * \file xsetcolumns.hpp
+ * defines columnar snapshot of fields of XSetParam members.
+ *
+ * Copyright 2010-2022 Cloud Avid Co. (www.cloudavid.com)
+ *
+ * xsetcolumns is part of PParam.
+ *
+ * PParam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PParam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PParam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "sparam.hpp"
+#include "xhashmap.hpp"
+#include "xparam.hpp"
+
+namespace pparam
+{
+
+/**
+ * \class XSelection
+ * Bitmap of selected rows of XSetColumns, result of predicates of
+ * columns.
+ *
+ * \code
+ * XSelection busy = cpu.greater(80) & ram.greater(80);
+ * for (size_t row : busy.indexes())
+ *     ...
+ * \endcode
+ */
+class XSelection
+{
+public:
+    /**
+     * \param _size number of rows.
+     * \param selected are rows selected?
+     */
+    XSelection(size_t _size = 0, bool selected = false) :
+        words((_size + 63) / 64, selected ? ~(uint64_t)0 : 0), rows(_size)
+    {
+        trim();
+    }
+
+    /** number of rows */
+    size_t size() const { return rows; }
+    bool test(size_t row) const { return (words[row / 64] >> (row % 64)) & 1; }
+    void set(size_t row, bool selected = true)
+    {
+        if (selected)
+            words[row / 64] |= (uint64_t)1 << (row % 64);
+        else
+            words[row / 64] &= ~((uint64_t)1 << (row % 64));
+    }
+    /** number of selected rows */
+    size_t count() const
+    {
+        size_t selected = 0;
+        for (uint64_t word : words)
+            selected += __builtin_popcountll(word);
+        return selected;
+    }
+    bool any() const
+    {
+        for (uint64_t word : words)
+            if (word)
+                return true;
+        return false;
+    }
+    /** selected rows, in order */
+    vector<size_t> indexes() const
+    {
+        vector<size_t> result;
+        result.reserve(count());
+        forEach([&result](size_t row) { result.push_back(row); });
+        return result;
+    }
+    /** Call callback(row) for selected rows, in order. */
+    template <class CallBack> void forEach(CallBack callback) const
+    {
+        for (size_t i = 0; i < words.size(); i++)
+            for (uint64_t word = words[i]; word; word &= word - 1)
+                callback(i * 64 + __builtin_ctzll(word));
+    }
+
+    XSelection &operator&=(const XSelection &selection)
+    {
+        check(selection);
+        for (size_t i = 0; i < words.size(); i++)
+            words[i] &= selection.words[i];
+        return *this;
+    }
+    XSelection &operator|=(const XSelection &selection)
+    {
+        check(selection);
+        for (size_t i = 0; i < words.size(); i++)
+            words[i] |= selection.words[i];
+        return *this;
+    }
+    XSelection operator&(const XSelection &selection) const
+    {
+        XSelection result(*this);
+        return result &= selection;
+    }
+    XSelection operator|(const XSelection &selection) const
+    {
+        XSelection result(*this);
+        return result |= selection;
+    }
+    XSelection operator~() const
+    {
+        XSelection result(*this);
+        for (uint64_t &word : result.words)
+            word = ~word;
+        result.trim();
+        return result;
+    }
+    /** 64 rows in each word, row 0 is lowest bit of first word. */
+    const vector<uint64_t> &get_words() const { return words; }
+    vector<uint64_t> &get_words() { return words; }
+
+protected:
+    /** clear bits after last row */
+    void trim()
+    {
+        if (rows % 64)
+            words.back() &= ((uint64_t)1 << (rows % 64)) - 1;
+    }
+    void check(const XSelection &selection) const
+    {
+        if (selection.rows != rows)
+            throw Exception("Selections have different number of rows.", TracePoint("pparam"));
+    }
+
+    vector<uint64_t> words;
+    size_t rows;
+};
+
+/**
+ * \class XSetColumnBase
+ * Untyped part of XSetColumn, used by XSetColumns to keep its columns
+ * in sync with rows.
+ */
+template <typename T> class XSetColumnBase
+{
+public:
+    XSetColumnBase(const string &_name) : name(_name) {}
+    virtual ~XSetColumnBase() {}
+    const string &get_name() const { return name; }
+
+    virtual void append(const T *member) = 0;
+    virtual void assign(size_t row, const T *member) = 0;
+    /** Remove "row", last row is moved to its place. */
+    virtual void remove(size_t row) = 0;
+    virtual void clear() = 0;
+    virtual void reserve(size_t rows) = 0;
+
+protected:
+    string name;
+};
+
+/**
+ * \class XSetColumn
+ * Values of a field of all of members of a set, in a contiguous array of
+ * V (one per row of XSetColumns).
+ *
+ * Predicates and aggregates are plain loops over the array, without
+ * branches, so compiler may vectorize them.
+ */
+template <typename T, typename V> class XSetColumn : public XSetColumnBase<T>
+{
+public:
+    typedef std::function<V(const T *)> Extractor;
+    /** type of sum(), wide enough for sum of values */
+    typedef typename std::conditional<
+        std::is_floating_point<V>::value, double,
+        typename std::conditional<std::is_signed<V>::value, long long,
+                                  unsigned long long>::type>::type Sum;
+
+    XSetColumn(const string &_name, Extractor _extract) :
+        XSetColumnBase<T>(_name), extract(_extract)
+    {
+    }
+
+    size_t size() const { return values.size(); }
+    const V *data() const { return values.data(); }
+    const vector<V> &get_values() const { return values; }
+    V operator[](size_t row) const { return values[row]; }
+
+    /**
+     * Rows that predicate(value) returns true for.
+     */
+    template <class Predicate> XSelection where(Predicate predicate) const
+    {
+        XSelection selection(values.size());
+        vector<uint64_t> &words = selection.get_words();
+        const V *value = values.data();
+        size_t full = values.size() / 64;
+        for (size_t i = 0; i < full; i++, value += 64) {
+            uint64_t word = 0;
+            for (unsigned int bit = 0; bit < 64; bit++)
+                word |= (uint64_t)(bool)predicate(value[bit]) << bit;
+            words[i] = word;
+        }
+        if (values.size() % 64) {
+            uint64_t word = 0;
+            for (unsigned int bit = 0; bit < values.size() % 64; bit++)
+                word |= (uint64_t)(bool)predicate(value[bit]) << bit;
+            words[full] = word;
+        }
+        return selection;
+    }
+    XSelection equal(V value) const
+    {
+        return where([value](V v) { return v == value; });
+    }
+    XSelection greater(V value) const
+    {
+        return where([value](V v) { return v > value; });
+    }
+    XSelection less(V value) const
+    {
+        return where([value](V v) { return v < value; });
+    }
+    /** Rows with "low" <= value <= "high". */
+    XSelection between(V low, V high) const
+    {
+        return where([low, high](V v) { return (v >= low) & (v <= high); });
+    }
+
+    Sum sum() const
+    {
+        Sum total = 0;
+        for (V value : values)
+            total += value;
+        return total;
+    }
+    Sum sum(const XSelection &selection) const
+    {
+        check(selection);
+        Sum total = 0;
+        selection.forEach([&](size_t row) { total += values[row]; });
+        return total;
+    }
+    /** Average of values, 0 if there is no row. */
+    double mean() const { return values.empty() ? 0 : (double)sum() / values.size(); }
+    double mean(const XSelection &selection) const
+    {
+        size_t count = selection.count();
+        return count ? (double)sum(selection) / count : 0;
+    }
+    /**
+     * Smallest value, throws if there is no row.
+     */
+    V min() const
+    {
+        if (values.empty())
+            throw Exception("Column '" + this->name + "' is empty.", TracePoint("pparam"));
+        V result = values[0];
+        for (V value : values)
+            result = value < result ? value : result;
+        return result;
+    }
+    V min(const XSelection &selection) const
+    {
+        return pick(selection, [](V value, V result) { return value < result; });
+    }
+    /**
+     * Largest value, throws if there is no row.
+     */
+    V max() const
+    {
+        if (values.empty())
+            throw Exception("Column '" + this->name + "' is empty.", TracePoint("pparam"));
+        V result = values[0];
+        for (V value : values)
+            result = value > result ? value : result;
+        return result;
+    }
+    V max(const XSelection &selection) const
+    {
+        return pick(selection, [](V value, V result) { return value > result; });
+    }
+
+    virtual void append(const T *member) { values.push_back(extract(member)); }
+    virtual void assign(size_t row, const T *member) { values[row] = extract(member); }
+    virtual void remove(size_t row)
+    {
+        values[row] = values.back();
+        values.pop_back();
+    }
+    virtual void clear() { values.clear(); }
+    virtual void reserve(size_t rows) { values.reserve(rows); }
+
+protected:
+    void check(const XSelection &selection) const
+    {
+        if (selection.size() != values.size())
+            throw Exception("Selection doesn't match rows of column '" + this->name + "'.",
+                            TracePoint("pparam"));
+    }
+    template <class Better> V pick(const XSelection &selection, Better better) const
+    {
+        check(selection);
+        bool found = false;
+        V result = V();
+        selection.forEach([&](size_t row) {
+            if (!found || better(values[row], result))
+                result = values[row];
+            found = true;
+        });
+        if (!found)
+            throw Exception("No row of column '" + this->name + "' is selected.",
+                            TracePoint("pparam"));
+        return result;
+    }
+
+    Extractor extract;
+    vector<V> values;
+};
+
+/**
+ * \class XSetColumns
+ * Columnar (structure of arrays) copy of fields of members of an
+ * XSetParam, for scans and aggregates that don't chase member pointers.
+ *
+ * Each member is a row; each column keeps one field of all of rows in a
+ * contiguous array. Rows are added and removed as members are added and
+ * removed (removed row is filled by last row, so rows are in order of set
+ * only until a member is removed). Call update() when fields of a member
+ * change, or refresh() after many changes. Columns stop following their
+ * set when set is destroyed (or moved), then they're empty.
+ * \code
+ * XSetColumns<Server> columns(servers);
+ * auto &cpu = columns.addColumn("cpu", &Server::cpuUsage);
+ * auto &ram = columns.addColumn("ram", &Server::ramUsage);
+ * double busyRam = ram.mean(cpu.greater(80));
+ * \endcode
+ * Columns aren't thread safe, like the set they follow.
+ */
+template <typename T> class XSetColumns : public XSetListener<T>
+{
+public:
+    template <typename Set> XSetColumns(Set &set)
+    {
+        positions.reserve(set.size());
+        members.reserve(set.size());
+        for (typename Set::iterator iter = set.begin(); iter != set.end(); ++iter)
+            memberAdded(static_cast<T *>(*iter));
+        set.addListener(this);
+        detach = [&set, this]() { set.removeListener(this); };
+    }
+    XSetColumns(const XSetColumns &) = delete;
+    XSetColumns &operator=(const XSetColumns &) = delete;
+    virtual ~XSetColumns()
+    {
+        if (detach)
+            detach();
+    }
+
+    /**
+     * Add a column of values that "extract" takes from members.
+     *
+     * \code
+     * columns.addColumn<XULong>("uptime", [](const Server *s) {
+     *     return s->uptime.get_value();
+     * });
+     * \endcode
+     */
+    template <typename V, class Extract>
+    XSetColumn<T, V> &addColumn(const string &name, Extract extract)
+    {
+        static_assert(std::is_arithmetic<V>::value, "columns keep numbers");
+        if (columns.count(name))
+            throw Exception("Column '" + name + "' exists.", TracePoint("pparam"));
+        XSetColumn<T, V> *column = new XSetColumn<T, V>(name, extract);
+        std::unique_ptr<XSetColumnBase<T>> guard(column);
+        column->reserve(members.size());
+        for (T *member : members)
+            column->append(member);
+        columns[name] = std::move(guard);
+        return *column;
+    }
+    /** Column of an XIntParam field. */
+    template <typename I>
+    XSetColumn<T, I> &addColumn(const string &name, XIntParam<I> T::*field)
+    {
+        return addColumn<I>(name, [field](const T *member) { return (member->*field).get_value(); });
+    }
+    /** Column of an XFloatParam field. */
+    XSetColumn<T, XParam::XFloat> &addColumn(const string &name, XFloatParam T::*field)
+    {
+        return addColumn<XParam::XFloat>(
+            name, [field](const T *member) { return (member->*field).get_value(); });
+    }
+    /** Column of an XEnumParam field, values are enum values. */
+    template <typename E>
+    XSetColumn<T, int> &addColumn(const string &name, XEnumParam<E> T::*field)
+    {
+        return addColumn<int>(name,
+                              [field](const T *member) { return (member->*field).get_value(); });
+    }
+    /** Column of a BoolParam field, values are 0 or 1. */
+    XSetColumn<T, unsigned char> &addColumn(const string &name, BoolParam T::*field)
+    {
+        return addColumn<unsigned char>(
+            name, [field](const T *member) { return (member->*field).is_enable(); });
+    }
+    /** Column of an IPv4 address field, see IPv4Param::getAddressCompact(). */
+    XSetColumn<T, unsigned int> &addColumn(const string &name, IPv4Param T::*field)
+    {
+        return addColumn<unsigned int>(
+            name, [field](const T *member) { return (member->*field).getAddressCompact(); });
+    }
+    /** Column of an IP address field, IPv6 addresses are 0. */
+    XSetColumn<T, unsigned int> &addColumn(const string &name, IPxParam T::*field)
+    {
+        return addColumn<unsigned int>(
+            name, [field](const T *member) { return (member->*field).getAddressCompact(); });
+    }
+    /**
+     * Column named "name", V is type of its values.
+     */
+    template <typename V> XSetColumn<T, V> &column(const string &name)
+    {
+        typename Columns::iterator iter = columns.find(name);
+        XSetColumn<T, V> *column =
+            (iter == columns.end()) ? NULL : dynamic_cast<XSetColumn<T, V> *>(iter->second.get());
+        if (column == NULL)
+            throw Exception("No column '" + name + "' with this type of values.",
+                            TracePoint("pparam"));
+        return *column;
+    }
+    void dropColumn(const string &name) { columns.erase(name); }
+
+    /** number of rows */
+    size_t size() const { return members.size(); }
+    /** Member of "row". */
+    T *member(size_t row) const { return members[row]; }
+    /** Members of selected rows. */
+    vector<T *> select(const XSelection &selection) const
+    {
+        vector<T *> result;
+        result.reserve(selection.count());
+        selection.forEach([&](size_t row) { result.push_back(members[row]); });
+        return result;
+    }
+    /** Selection of all (or none) of rows. */
+    XSelection selection(bool selected = true) const { return XSelection(members.size(), selected); }
+    /**
+     * Take values of "member" again, after its fields are changed.
+     */
+    void update(T *member)
+    {
+        typename XHashMap<T *, size_t>::iterator iter = positions.find(member);
+        if (iter == positions.end())
+            return;
+        for (auto &column : columns)
+            column.second->assign(iter->second, member);
+    }
+    /**
+     * Take values of all of members again.
+     */
+    void refresh()
+    {
+        for (auto &column : columns)
+            for (size_t row = 0; row < members.size(); row++)
+                column.second->assign(row, members[row]);
+    }
+
+    virtual void memberAdded(T *member)
+    {
+        positions[member] = members.size();
+        members.push_back(member);
+        for (auto &column : columns)
+            column.second->append(member);
+    }
+    virtual void memberRemoved(T *member)
+    {
+        typename XHashMap<T *, size_t>::iterator iter = positions.find(member);
+        if (iter == positions.end())
+            return;
+        size_t row = iter->second;
+        positions.erase(iter);
+        if (row != members.size() - 1) {
+            members[row] = members.back();
+            positions[members[row]] = row;
+        }
+        members.pop_back();
+        for (auto &column : columns)
+            column.second->remove(row);
+    }
+    virtual void membersCleared()
+    {
+        members.clear();
+        positions.clear();
+        for (auto &column : columns)
+            column.second->clear();
+    }
+    virtual void setDetached()
+    {
+        detach = nullptr;
+        membersCleared();
+    }
+
+protected:
+    typedef std::map<string, std::unique_ptr<XSetColumnBase<T>>> Columns;
+
+    Columns columns;
+    /** member of each row */
+    vector<T *> members;
+    /** row of each member */
+    XHashMap<T *, size_t> positions;
+    std::function<void()> detach;
+};
+
+} // namespace pparam
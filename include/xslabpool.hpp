@@ -0,0 +1,203 @@
+/**
+ * \file xslabpool.hpp
+ * defines a slab pool of objects.
+ *
+ * Copyright 2010-2022 Cloud Avid Co. (www.cloudavid.com)
+ *
+ * xslabpool is part of PParam.
+ *
+ * PParam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PParam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PParam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace pparam
+{
+
+/**
+ * \class XSlabPool
+ * Pool that constructs objects of T in slabs of slots.
+ *
+ * Slots are handed out in address order and freed slots are reused, so
+ * objects of a pool are packed together and a pool allocates once per
+ * slab instead of once per object. Slabs grow from FIRST_SLAB slots to
+ * MAX_SLAB_BYTES, which keeps them in heap of malloc (not mmap-ed) to be
+ * reused, and are freed together by release(), when no object of the
+ * pool is alive.
+ *
+ * destroy() accepts objects that aren't from the pool (they're
+ * deleted), so a container may hold a mix of pool and heap objects.
+ * Pool isn't thread safe, like the containers that own it.
+ */
+template <typename T> class XSlabPool
+{
+public:
+    static const size_t FIRST_SLAB = 32;
+    static const size_t MAX_SLAB_BYTES = 64 * 1024;
+
+    XSlabPool() :
+        recent(0), freeSlots(NULL), next(NULL), last(NULL), live(0), slabSize(FIRST_SLAB)
+    {
+    }
+    XSlabPool(XSlabPool &&pool) :
+        slabs(std::move(pool.slabs)), recent(pool.recent), freeSlots(pool.freeSlots),
+        next(pool.next), last(pool.last), live(pool.live), slabSize(pool.slabSize)
+    {
+        pool.slabs.clear();
+        pool.recent = 0;
+        pool.freeSlots = pool.next = pool.last = NULL;
+        pool.live = 0;
+        pool.slabSize = FIRST_SLAB;
+    }
+    XSlabPool(const XSlabPool &) = delete;
+    XSlabPool &operator=(const XSlabPool &) = delete;
+    /**
+     * Slabs are freed with pool, so destroy objects of pool before it;
+     * destroying a pool with alive objects is undefined (it's asserted
+     * in debug builds).
+     */
+    ~XSlabPool() { assert(live == 0); }
+
+    /**
+     * Construct a T in pool.
+     */
+    template <typename... Args> T *create(Args &&...args)
+    {
+        void *slot = allocate();
+        try {
+            return new (slot) T(std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate(slot);
+            throw;
+        }
+    }
+    /**
+     * Destroy an object of pool, other objects are deleted.
+     *
+     * \param object T or one of its polymorphic bases.
+     */
+    template <typename B> void destroy(B *object)
+    {
+        if (object == NULL)
+            return;
+        void *address = dynamic_cast<void *>(object);
+        if (!owns(address)) {
+            delete object;
+            return;
+        }
+        object->~B();
+        deallocate(address);
+    }
+    /**
+     * Free all of slabs if no object of pool is alive.
+     * \return were slabs freed?
+     */
+    bool release()
+    {
+        if (live)
+            return false;
+        slabs.clear();
+        recent = 0;
+        freeSlots = next = last = NULL;
+        slabSize = FIRST_SLAB;
+        return true;
+    }
+    /** number of alive objects */
+    size_t size() const { return live; }
+    /** number of slots in slabs */
+    size_t capacity() const
+    {
+        size_t slots = 0;
+        for (auto &slab : slabs)
+            slots += slab.count;
+        return slots;
+    }
+
+protected:
+    union Slot {
+        Slot *next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+    struct Slab {
+        std::unique_ptr<Slot[]> slots;
+        size_t count;
+        bool contains(const Slot *slot) const
+        {
+            return slot >= slots.get() && slot < slots.get() + count;
+        }
+    };
+
+    void *allocate()
+    {
+        Slot *slot = freeSlots;
+        if (slot != NULL) {
+            freeSlots = slot->next;
+        } else {
+            if (next == last) {
+                Slab slab = {std::unique_ptr<Slot[]>(new Slot[slabSize]), slabSize};
+                next = slab.slots.get();
+                last = next + slabSize;
+                slabs.insert(std::upper_bound(slabs.begin(), slabs.end(), next, before),
+                             std::move(slab));
+                if ((slabSize * 2) * sizeof(Slot) <= MAX_SLAB_BYTES)
+                    slabSize *= 2;
+            }
+            slot = next++;
+        }
+        ++live;
+        return slot;
+    }
+    void deallocate(void *address)
+    {
+        Slot *slot = static_cast<Slot *>(address);
+        slot->next = freeSlots;
+        freeSlots = slot;
+        --live;
+    }
+    /**
+     * Is address in one of slabs? Objects are mostly destroyed in
+     * order of creation, so last found slab is checked first.
+     */
+    bool owns(const void *address)
+    {
+        const Slot *slot = static_cast<const Slot *>(address);
+        if (recent < slabs.size() && slabs[recent].contains(slot))
+            return true;
+        auto iter = std::upper_bound(slabs.begin(), slabs.end(), slot, before);
+        if (iter == slabs.begin() || !(--iter)->contains(slot))
+            return false;
+        recent = iter - slabs.begin();
+        return true;
+    }
+    static bool before(const Slot *slot, const Slab &slab) { return slot < slab.slots.get(); }
+
+    /** slabs ordered by address */
+    std::vector<Slab> slabs;
+    size_t recent;
+    Slot *freeSlots;
+    /** unused slots of last slab */
+    Slot *next, *last;
+    size_t live;
+    size_t slabSize;
+};
+
+} // namespace pparam
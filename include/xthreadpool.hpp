@@ -0,0 +1,96 @@
+/**
+ * \file xthreadpool.hpp
+ * defines a pool of worker threads for parallel loops.
+ *
+ * Copyright 2010-2022 Cloud Avid Co. (www.cloudavid.com)
+ *
+ * xthreadpool is part of PParam.
+ *
+ * PParam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PParam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PParam.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pparam
+{
+
+/**
+ * \class XThreadPool
+ * Fixed number of worker threads that run chunks of parallel loops.
+ *
+ * Calling thread of parallelFor() runs chunks too, and only waits for
+ * chunks that are taken by workers, so a loop may be started from inside
+ * another one (or from a busy pool) without dead-lock.
+ *
+ * \code
+ * XThreadPool pool(4);
+ * vms.parallel_iterate([](VM *vm) { vm->check(); }, 64, pool);
+ * \endcode
+ */
+class XThreadPool
+{
+public:
+    /**
+     * \param threads number of workers, 0 means one worker per CPU.
+     */
+    XThreadPool(unsigned int threads = 0);
+    /** Waits for queued tasks and stops workers. */
+    ~XThreadPool();
+    XThreadPool(const XThreadPool &) = delete;
+    XThreadPool &operator=(const XThreadPool &) = delete;
+
+    /** number of workers */
+    unsigned int size() const { return workers.size(); }
+    /**
+     * Size of chunks of a loop.
+     * \param count number of items of loop.
+     * \param chunk requested size, 0 lets pool choose one (four chunks per
+     * thread).
+     */
+    size_t chunkSize(size_t count, size_t chunk = 0) const;
+    /**
+     * Call body(first, last) for chunks of [0, count) on workers and calling
+     * thread, and return when all of chunks are done.
+     *
+     * If body throws, chunks that aren't started are skipped and first
+     * exception is thrown again.
+     * \param chunk items of each chunk, see chunkSize().
+     */
+    void parallelFor(size_t count, size_t chunk,
+                     const std::function<void(size_t first, size_t last)> &body);
+    /**
+     * Pool with one worker per CPU, used by parallel functions of sets and
+     * object lists when no pool is passed.
+     */
+    static XThreadPool &shared();
+
+protected:
+    void submit(std::function<void()> task);
+    void work();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()> > tasks;
+    std::mutex lock;
+    std::condition_variable ready;
+    bool stopping;
+};
+
+} // namespace pparam
@@ -10,7 +10,7 @@ using std::hex;
 namespace pparam
 {
 
-const string DBEngineTypes::typeString[DBEngineTypes::MAX] = {"sqlite"};
+const string DBEngineTypes::typeString[DBEngineTypes::MAX] = {"sqlite", "memory", "logstore"};
 
 /* Implementation of "UUIDParam" Class
  */
@@ -1776,6 +1776,13 @@ string IPxParam::getNetmaskString() const
     return "";
 }
 
+unsigned int IPxParam::getAddressCompact() const
+{
+    if (version == IPType::IPv4)
+        return ipv4->getAddressCompact();
+    return 0;
+}
+
 bool IPxParam::checkNetworkAvailability(string IPAddress) const
 {
     if (version == IPType::IPv4)
@@ -2099,6 +2106,12 @@ DBEngineParam *DBEngineType::newT()
     case DBEngineTypes::SQLite:
         ret = new SQLiteDBEngineParam(get_pname());
         break;
+    case DBEngineTypes::Memory:
+        ret = new MemoryDBEngineParam(get_pname());
+        break;
+    case DBEngineTypes::LogStore:
+        ret = new LogDBEngineParam(get_pname());
+        break;
     default:
         throw Exception("Bad type !", TracePoint("sparam"));
         break;
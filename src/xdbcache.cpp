@@ -0,0 +1,452 @@
+#include "xdbcache.hpp"
+
+namespace pparam
+{
+// implementation of XDBCache
+
+void XDBCache::cleanTBuffer(void *ptr)
+{
+    delete (Pending *)ptr;
+}
+
+XDBCache::XDBCache(XDBEngine *_engine, size_t _capacity) :
+    engine(_engine), capacity(_capacity ? _capacity : 1), generation(0)
+{
+    pthread_key_create(&transactionTSMKey, cleanTBuffer);
+    resetStats();
+}
+
+XDBCache::~XDBCache()
+{
+    stopExecutor();
+    delete (Pending *)pthread_getspecific(transactionTSMKey);
+    pthread_key_delete(transactionTSMKey);
+}
+
+void XDBCache::connect(string connectionString)
+{
+    clear();
+    engine->connect(connectionString);
+}
+
+void XDBCache::disconnect()
+{
+    engine->disconnect();
+    clear();
+}
+
+void XDBCache::execute(string command)
+{
+    engine->execute(command);
+    invalidate(Invalidation::ALL, "");
+}
+
+void XDBCache::startTransaction()
+{
+    if (pthread_getspecific(transactionTSMKey) == NULL)
+        pthread_setspecific(transactionTSMKey, new Pending);
+    engine->startTransaction();
+}
+
+void XDBCache::commitTransaction()
+{
+    Pending *pending = (Pending *)pthread_getspecific(transactionTSMKey);
+    if (pending != NULL && pending->batches > 0) {
+        // invalidations are repeated when batch commits
+        engine->commitTransaction();
+        return;
+    }
+    pthread_setspecific(transactionTSMKey, NULL);
+    try {
+        engine->commitTransaction();
+    } catch (Exception &e) {
+        delete pending;
+        e.addTracePoint(TracePoint("XDBCache"));
+        throw e;
+    }
+    applyPending(pending);
+}
+
+void XDBCache::rollbackTransaction()
+{
+    // entries are dropped already, nothing to restore.
+    Pending *pending = (Pending *)pthread_getspecific(transactionTSMKey);
+    if (pending == NULL || pending->batches == 0) {
+        delete pending;
+        pthread_setspecific(transactionTSMKey, NULL);
+    }
+    engine->rollbackTransaction();
+}
+
+void XDBCache::beginBatch()
+{
+    Pending *pending = (Pending *)pthread_getspecific(transactionTSMKey);
+    bool created = (pending == NULL);
+    if (created) {
+        pending = new Pending;
+        pthread_setspecific(transactionTSMKey, pending);
+    }
+    try {
+        engine->beginBatch();
+    } catch (Exception &e) {
+        if (created) {
+            delete pending;
+            pthread_setspecific(transactionTSMKey, NULL);
+        }
+        e.addTracePoint(TracePoint("XDBCache"));
+        throw e;
+    }
+    pending->batches++;
+}
+
+void XDBCache::endBatch(bool commit)
+{
+    Pending *pending = (Pending *)pthread_getspecific(transactionTSMKey);
+    if (pending == NULL || pending->batches == 0)
+        throw Exception("No batch is open.", TracePoint("XDBCache"));
+    if (--pending->batches > 0) {
+        engine->endBatch(commit);
+        return;
+    }
+    pthread_setspecific(transactionTSMKey, NULL);
+    try {
+        engine->endBatch(commit);
+    } catch (Exception &e) {
+        delete pending;
+        e.addTracePoint(TracePoint("XDBCache"));
+        throw e;
+    }
+    applyPending(pending);
+}
+
+void XDBCache::applyPending(Pending *pending)
+{
+    if (pending == NULL)
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (unsigned int i = 0; i < pending->invalidations.size(); i++)
+            apply(pending->invalidations[i]);
+    }
+    delete pending;
+}
+
+void XDBCache::saveXParam(string pname, string pkey, string parentName, string parentKey,
+                          stringList fields, stringList values)
+{
+    engine->saveXParam(pname, pkey, parentName, parentKey, fields, values);
+    invalidate(Invalidation::ROW, pname, pkey, parentName, parentKey);
+}
+
+void XDBCache::saveXParam(string pname, string pkey, stringList fields, stringList values)
+{
+    saveXParam(pname, pkey, "", "", fields, values);
+}
+
+void XDBCache::updateXParam(string pname, string pkey, string parentName, string parentKey,
+                            stringList fields, stringList values)
+{
+    engine->updateXParam(pname, pkey, parentName, parentKey, fields, values);
+    invalidate(Invalidation::ROW, pname, pkey, parentName, parentKey);
+}
+
+void XDBCache::updateXParam(string pname, string pkey, stringList fields, stringList values)
+{
+    updateXParam(pname, pkey, "", "", fields, values);
+}
+
+void XDBCache::removeXParam(string pname, string pkey, string parentName, string parentKey)
+{
+    engine->removeXParam(pname, pkey, parentName, parentKey);
+    invalidate(Invalidation::ROW, pname, pkey, parentName, parentKey);
+}
+
+void XDBCache::removeXParam(string pname, string pkey) { removeXParam(pname, pkey, "", ""); }
+
+void XDBCache::removeXParamByParent(string pname, string parentName, string parentKey)
+{
+    engine->removeXParamByParent(pname, parentName, parentKey);
+    invalidate(Invalidation::PARENT, pname, "", parentName, parentKey);
+}
+
+void XDBCache::removeXParamByValue(string pname, string parentName, string parentKey,
+                                   string fieldName, string value)
+{
+    engine->removeXParamByValue(pname, parentName, parentKey, fieldName, value);
+    invalidate(Invalidation::PARENT, pname, "", parentName, parentKey);
+}
+
+void XDBCache::createXParamStructure(string pname, string parentName, stringList fields,
+                                     vector<DBFieldTypes> fieldTypes)
+{
+    engine->createXParamStructure(pname, parentName, fields, fieldTypes);
+    invalidate(Invalidation::TABLE, pname);
+}
+
+void XDBCache::createXParamStructure(string pname, stringList fields,
+                                     vector<DBFieldTypes> fieldTypes)
+{
+    createXParamStructure(pname, "", fields, fieldTypes);
+}
+
+void XDBCache::destroyXParamStructure(string pname)
+{
+    engine->destroyXParamStructure(pname);
+    invalidate(Invalidation::TABLE, pname);
+}
+
+void XDBCache::createXParamIndex(string pname, stringList fields, bool unique)
+{
+    engine->createXParamIndex(pname, fields, unique);
+}
+
+int XDBCache::loadXParamRow(string pname, string pkey, string parentName, string parentKey,
+                            stringList &fields, stringList &values)
+{
+    string key = rowKey(pname, pkey, parentName, parentKey);
+    unsigned long long gen;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        XHashMap<string, Entry>::iterator iter = entries.find(key);
+        if (iter != entries.end()) {
+            ++counters.hits;
+            touch(iter->second);
+            fields = iter->second.fields;
+            values = iter->second.values;
+            return iter->second.found;
+        }
+        ++counters.misses;
+        gen = generation;
+    }
+    int found = engine->loadXParamRow(pname, pkey, parentName, parentKey, fields, values);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (gen == generation && !entries.count(key)) {
+        Entry entry;
+        entry.table = pname;
+        entry.pkey = pkey;
+        entry.parentName = parentName;
+        entry.parentKey = parentKey;
+        entry.found = found;
+        entry.fields = fields;
+        entry.values = values;
+        insert(key, entry);
+    }
+    return found;
+}
+
+int XDBCache::loadXParamRow(string pname, string pkey, stringList &fields, stringList &values)
+{
+    return loadXParamRow(pname, pkey, "", "", fields, values);
+}
+
+int XDBCache::loadXParamValueListByParent(string pname, string parentName, string parentKey,
+                                          string fieldName, stringList &values)
+{
+    string key = listKey(pname, parentName, parentKey);
+    unsigned long long gen;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        XHashMap<string, Entry>::iterator iter = entries.find(key);
+        if (iter != entries.end()) {
+            std::map<string, stringList>::iterator liter = iter->second.lists.find(fieldName);
+            if (liter != iter->second.lists.end()) {
+                ++counters.hits;
+                touch(iter->second);
+                values = liter->second;
+                return values.size();
+            }
+        }
+        ++counters.misses;
+        gen = generation;
+    }
+    int count = engine->loadXParamValueListByParent(pname, parentName, parentKey, fieldName,
+                                                    values);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (gen == generation) {
+        XHashMap<string, Entry>::iterator iter = entries.find(key);
+        if (iter != entries.end()) {
+            iter->second.lists[fieldName] = values;
+        } else {
+            Entry entry;
+            entry.table = pname;
+            entry.parentName = parentName;
+            entry.parentKey = parentKey;
+            entry.found = 0;
+            entry.lists[fieldName] = values;
+            insert(key, entry);
+        }
+    }
+    return count;
+}
+
+void XDBCache::getData(string selectstmt, vector<vector<string> > &results,
+                       vector<string> &columns)
+{
+    engine->getData(selectstmt, results, columns);
+}
+
+void XDBCache::getData(string selectstmt, const stringList &params,
+                       vector<vector<string> > &results, vector<string> &columns)
+{
+    engine->getData(selectstmt, params, results, columns);
+}
+
+void XDBCache::query(string selectstmt, const stringList &params, XDBRowVisitor &visitor)
+{
+    engine->query(selectstmt, params, visitor);
+}
+
+void XDBCache::clear() { invalidate(Invalidation::ALL, ""); }
+
+XDBCacheStats XDBCache::stats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    XDBCacheStats result = counters;
+    result.entries = entries.size();
+    return result;
+}
+
+void XDBCache::resetStats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    counters.hits = counters.misses = counters.evictions = counters.invalidations = 0;
+    counters.entries = 0;
+}
+
+string XDBCache::rowKey(const string &pname, const string &pkey, const string &parentName,
+                        const string &parentKey)
+{
+    string key = "R";
+    key += pname;
+    key += '\0';
+    key += pkey;
+    key += '\0';
+    key += parentName;
+    key += '\0';
+    key += parentKey;
+    return key;
+}
+
+string XDBCache::listKey(const string &pname, const string &parentName, const string &parentKey)
+{
+    string key = "L";
+    key += pname;
+    key += '\0';
+    key += parentName;
+    key += '\0';
+    key += parentKey;
+    return key;
+}
+
+void XDBCache::invalidate(Invalidation::Type type, const string &pname, const string &pkey,
+                          const string &parentName, const string &parentKey)
+{
+    Invalidation inv;
+    inv.type = type;
+    inv.table = pname;
+    inv.pkey = pkey;
+    inv.parentName = parentName;
+    inv.parentKey = parentKey;
+    Pending *pending = (Pending *)pthread_getspecific(transactionTSMKey);
+    if (pending != NULL)
+        pending->invalidations.push_back(inv);
+    std::lock_guard<std::mutex> guard(lock);
+    apply(inv);
+}
+
+void XDBCache::apply(const Invalidation &inv)
+{
+    ++generation;
+    string table = inv.table + '\0';
+    switch (inv.type) {
+    case Invalidation::ALL:
+        counters.invalidations += entries.size();
+        XHashMap<string, Entry>().swap(entries);
+        lru.clear();
+        index.clear();
+        break;
+    case Invalidation::TABLE:
+        eraseIndexed("T" + table);
+        break;
+    case Invalidation::ROW:
+        if (!inv.parentName.empty()) {
+            // the row may be cached with or without its parent
+            erase(rowKey(inv.table, inv.pkey, inv.parentName, inv.parentKey));
+            erase(rowKey(inv.table, inv.pkey, "", ""));
+            erase(listKey(inv.table, inv.parentName, inv.parentKey));
+        } else {
+            // parent is unknown, so any parent and any list may change
+            eraseIndexed("K" + table + inv.pkey);
+            eraseIndexed("S" + table);
+        }
+        break;
+    case Invalidation::PARENT:
+        // keys are unknown, rows loaded without parent may be there too
+        eraseIndexed("P" + table + inv.parentName + '\0' + inv.parentKey);
+        eraseIndexed("N" + table);
+        erase(listKey(inv.table, inv.parentName, inv.parentKey));
+        break;
+    }
+}
+
+void XDBCache::eraseIndexed(const string &ikey)
+{
+    std::map<string, std::set<string> >::iterator iter = index.find(ikey);
+    if (iter == index.end())
+        return;
+    std::set<string> keys;
+    keys.swap(iter->second);
+    for (std::set<string>::iterator kiter = keys.begin(); kiter != keys.end(); ++kiter)
+        erase(*kiter);
+}
+
+void XDBCache::erase(const string &key)
+{
+    XHashMap<string, Entry>::iterator iter = entries.find(key);
+    if (iter == entries.end())
+        return;
+    Entry &entry = iter->second;
+    lru.erase(entry.lru);
+    for (unsigned int i = 0; i < entry.indexes.size(); i++) {
+        std::map<string, std::set<string> >::iterator iiter = index.find(entry.indexes[i]);
+        if (iiter == index.end())
+            continue;
+        iiter->second.erase(key);
+        if (iiter->second.empty())
+            index.erase(iiter);
+    }
+    entries.erase(iter);
+    ++counters.invalidations;
+}
+
+void XDBCache::insert(const string &key, Entry &proto)
+{
+    while (entries.size() >= capacity) {
+        erase(lru.back());
+        --counters.invalidations;
+        ++counters.evictions;
+    }
+    string table = proto.table + '\0';
+    proto.indexes.push_back("T" + table);
+    if (key[0] == 'L') {
+        proto.indexes.push_back("S" + table);
+    } else if (proto.parentName.empty()) {
+        proto.indexes.push_back("K" + table + proto.pkey);
+        proto.indexes.push_back("N" + table);
+    } else {
+        proto.indexes.push_back("K" + table + proto.pkey);
+        proto.indexes.push_back("P" + table + proto.parentName + '\0' + proto.parentKey);
+    }
+    for (unsigned int i = 0; i < proto.indexes.size(); i++)
+        index[proto.indexes[i]].insert(key);
+    lru.push_front(key);
+    proto.lru = lru.begin();
+    entries.emplace(key, std::move(proto));
+}
+
+void XDBCache::touch(Entry &entry) { lru.splice(lru.begin(), lru, entry.lru); }
+
+} // namespace pparam
+// end namespace pparam
@@ -1,7 +1,11 @@
 #include "xdbengine.hpp"
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <exception>
 #include <pthread.h>
 #include <sqlite3.h>
+#include <unistd.h>
 
 using std::cout;
 using std::stringstream;
@@ -10,8 +14,161 @@ using std::stringstream;
 
 namespace pparam
 {
+// implementation of XDBEngine
+
+void XDBEngine::getData(string selectstmt, const stringList &params,
+                        vector<vector<string> > &results, vector<string> &columns)
+{
+    stringstream buff;
+    unsigned int p = 0;
+    // quote that current literal/identifier is opened by, if any
+    char quote = 0;
+    for (unsigned int i = 0; i < selectstmt.size(); i++) {
+        char c = selectstmt[i];
+        /* Other quote character is a plain one inside quotes; a doubled
+         * quote closes and reopens, so escaped quotes keep us inside.
+         */
+        if (quote == 0 && (c == '\'' || c == '"'))
+            quote = c;
+        else if (c == quote)
+            quote = 0;
+        if (c != '?' || quote) {
+            buff << c;
+            continue;
+        }
+        if (p >= params.size())
+            throw Exception("Too few parameters for statement.", TracePoint("XDBEngine"));
+        buff << '\'';
+        for (unsigned int j = 0; j < params[p].size(); j++)
+            buff << params[p][j] << (params[p][j] == '\'' ? "'" : "");
+        buff << '\'';
+        p++;
+    }
+    if (p != params.size())
+        throw Exception("Too many parameters for statement.", TracePoint("XDBEngine"));
+    this->getData(buff.str(), results, columns);
+}
+
+/**
+ * Row of a materialized result.
+ */
+class XDBVectorRow : public XDBRow
+{
+public:
+    XDBVectorRow(const vector<string> &_columns) : columns(_columns), row(NULL) {}
+    virtual int size() const { return row->size(); }
+    virtual const char *column(int index) const
+    {
+        return (unsigned int)index < columns.size() ? columns[index].c_str() : "";
+    }
+    virtual const char *value(int index) const { return (*row)[index].c_str(); }
+    virtual size_t length(int index) const { return (*row)[index].size(); }
+
+    const vector<string> &columns;
+    const vector<string> *row;
+};
+
+void XDBEngine::query(string selectstmt, const stringList &params, XDBRowVisitor &visitor)
+{
+    vector<vector<string> > results;
+    vector<string> columns;
+    if (params.empty())
+        this->getData(selectstmt, results, columns);
+    else
+        this->getData(selectstmt, params, results, columns);
+    XDBVectorRow row(columns);
+    for (unsigned int i = 0; i < results.size(); i++) {
+        row.row = &results[i];
+        if (!visitor.visit(row))
+            break;
+    }
+}
+
+/**
+ * Reader of engines without their own one, it loads rows by
+ * loadXParamRow() and binds fields again only when they change.
+ */
+class XDBLoadRowReader : public XDBRowReader
+{
+public:
+    XDBLoadRowReader(XDBEngine *_engine, const string &_pname, const string &_parentName) :
+        engine(_engine), pname(_pname), parentName(_parentName), bound(false)
+    {
+    }
+    virtual int load(const string &pkey, const string &parentKey, XDBRowLoader &loader)
+    {
+        stringList rowFields, values;
+        int res;
+        if (parentName.empty())
+            res = engine->loadXParamRow(pname, pkey, rowFields, values);
+        else
+            res = engine->loadXParamRow(pname, pkey, parentName, parentKey, rowFields, values);
+        if (res == 0)
+            return 0;
+        if (!bound || rowFields != fields) {
+            fields.swap(rowFields);
+            loader.bindFields(fields);
+            bound = true;
+        }
+        for (unsigned int i = 0; i < values.size(); i++)
+            loader.loadValue(i, values[i].c_str());
+        return 1;
+    }
+
+protected:
+    XDBEngine *engine;
+    string pname, parentName;
+    bool bound;
+    stringList fields;
+};
+
+std::unique_ptr<XDBRowReader> XDBEngine::rowReader(const string &pname, const string &parentName)
+{
+    return std::unique_ptr<XDBRowReader>(new XDBLoadRowReader(this, pname, parentName));
+}
+
 // impelemtation of SQLiteDBEngine
 
+/**
+ * Row of a stepping SQLite statement.
+ */
+class SQLiteRow : public XDBRow
+{
+public:
+    SQLiteRow(sqlite3_stmt *_stmt) : stmt(_stmt), cols(sqlite3_column_count(_stmt)) {}
+    virtual int size() const { return cols; }
+    virtual const char *column(int index) const { return sqlite3_column_name(stmt, index); }
+    virtual const char *value(int index) const
+    {
+        const char *text = (const char *)sqlite3_column_text(stmt, index);
+        return text == NULL ? "" : text;
+    }
+    virtual size_t length(int index) const
+    {
+        // call it after value(), sqlite computes length on conversion
+        return sqlite3_column_bytes(stmt, index);
+    }
+
+protected:
+    sqlite3_stmt *stmt;
+    int cols;
+};
+
+// maximum number of cached prepared statements
+static const unsigned int STATEMENT_CACHE_SIZE = 256;
+
+// SQL string literal of "value"
+static string sqlLiteral(const string &value)
+{
+    string literal = "'";
+    for (unsigned int i = 0; i < value.size(); i++) {
+        literal += value[i];
+        if (value[i] == '\'')
+            literal += '\'';
+    }
+    return literal + "'";
+}
+
 void cleanTBuffer(void *ptr)
 {
     stringList *clist = (stringList *)((ptr));
@@ -21,11 +178,19 @@ void cleanTBuffer(void *ptr)
 SQLiteDBEngine::SQLiteDBEngine()
 {
     onTransaction = isconnected = false;
+    indexesDeferred = false;
     // init (thread specific) transaction buffer
     pthread_key_create(&transactionBufferTSMKey, cleanTBuffer);
+    pthread_mutex_init(&statementsLock, NULL);
 }
 
-SQLiteDBEngine::~SQLiteDBEngine() { pthread_key_delete(transactionBufferTSMKey); }
+SQLiteDBEngine::~SQLiteDBEngine()
+{
+    stopExecutor();
+    clearStatements();
+    pthread_mutex_destroy(&statementsLock);
+    pthread_key_delete(transactionBufferTSMKey);
+}
 
 void SQLiteDBEngine::connect(string fileName)
 {
@@ -40,13 +205,27 @@ void SQLiteDBEngine::connect(string fileName)
 
 void SQLiteDBEngine::disconnect()
 {
+    ConnectionGuard guard(this);
     if (onTransaction)
         rollbackTransaction();
+    if (!batchLevels.empty())
+        rollbackTo(0);
+    {
+        std::lock_guard<std::mutex> guard(backupsLock);
+        for (unsigned int i = 0; i < backups.size(); i++) {
+            std::shared_ptr<XDBBackupTask> task = backups[i].lock();
+            if (task)
+                task->stop();
+        }
+        backups.clear();
+    }
+    clearStatements();
     sqlite3_close(dbp);
     isconnected = false;
 }
 void SQLiteDBEngine::execute(string command)
 {
+    ConnectionGuard guard(this);
     if (onTransaction) {
 #ifdef SQLDEBUG
         cout << "\nDB q :" << command.c_str();
@@ -70,6 +249,7 @@ void SQLiteDBEngine::execute(string command)
         if (rc != SQLITE_OK) {
             buff << "SQL error: " << zErrMsg;
             sqlite3_free(zErrMsg);
+            rollbackFailedLevel();
             throw Exception(buff.str(), TracePoint("SQLiteDBEngine"));
         }
     }
@@ -77,17 +257,39 @@ void SQLiteDBEngine::execute(string command)
 
 void SQLiteDBEngine::startTransaction()
 {
+    ConnectionGuard guard(this);
 #ifdef SQLDEBUG
     cout << "\nDB q s";
 #endif
+    if (!batchLevels.empty()) {
+        execute("SAVEPOINT " + savepoint(batchLevels.size()));
+        batchLevels.push_back(false);
+        return;
+    }
     onTransaction = true;
 }
 
 void SQLiteDBEngine::commitTransaction()
 {
+    ConnectionGuard guard(this);
 #ifdef SQLDEBUG
     cout << "\nDB q c";
 #endif
+    if (!batchLevels.empty()) {
+        // a batch itself is committed by endBatch()
+        if (batchLevels.back())
+            return;
+        unsigned int level = batchLevels.size() - 1;
+        try {
+            execute("RELEASE " + savepoint(level));
+        } catch (Exception &e) {
+            rollbackTo(level);
+            e.addTracePoint(TracePoint("SQLiteDBEngine"));
+            throw e;
+        }
+        batchLevels.pop_back();
+        return;
+    }
     if (onTransaction == false)
         return;
 
@@ -115,6 +317,7 @@ void SQLiteDBEngine::commitTransaction()
             buff << "SQL error: " << zErrMsg;
             sqlite3_free(zErrMsg);
             sqlite3_exec(dbp, "ROLLBACK TRANSACTION", NULL, 0, NULL);
+            countRollback();
             throw Exception(buff.str(), TracePoint("SQLiteDBEngine"));
         }
     }
@@ -122,9 +325,15 @@ void SQLiteDBEngine::commitTransaction()
 }
 void SQLiteDBEngine::rollbackTransaction()
 {
+    ConnectionGuard guard(this);
 #ifdef SQLDEBUG
     cout << "\nDB q r";
 #endif
+    if (!batchLevels.empty()) {
+        if (!batchLevels.back())
+            rollbackTo(batchLevels.size() - 1);
+        return;
+    }
     if (onTransaction == false)
         return;
 
@@ -136,15 +345,117 @@ void SQLiteDBEngine::rollbackTransaction()
     }
     onTransaction = false;
     sqlite3_exec(dbp, "ROLLBACK TRANSACTION", NULL, 0, NULL);
+    countRollback();
+}
+void SQLiteDBEngine::beginBatch()
+{
+    ConnectionGuard guard(this);
+    if (onTransaction)
+        throw Exception("Batch can't be opened inside a transaction.",
+                        TracePoint("SQLiteDBEngine"));
+    execute("SAVEPOINT " + savepoint(batchLevels.size()));
+    batchLevels.push_back(true);
+}
+
+void SQLiteDBEngine::endBatch(bool commit)
+{
+    ConnectionGuard guard(this);
+    int level = batchLevels.size() - 1;
+    while (level >= 0 && !batchLevels[level])
+        level--;
+    if (level < 0)
+        throw Exception("No batch is open.", TracePoint("SQLiteDBEngine"));
+    if (!commit) {
+        rollbackTo(level);
+        return;
+    }
+    // releasing a savepoint releases savepoints inside it too
+    try {
+        execute("RELEASE " + savepoint(level));
+    } catch (Exception &e) {
+        rollbackTo(level);
+        e.addTracePoint(TracePoint("SQLiteDBEngine"));
+        throw e;
+    }
+    batchLevels.resize(level);
+}
+
+void SQLiteDBEngine::updateOwner()
+{
+    bool open = onTransaction || !batchLevels.empty();
+    bool owned = connectionOwner != std::thread::id();
+    if (open && !owned) {
+        connectionLock.lock();
+        connectionOwner = std::this_thread::get_id();
+    } else if (!open && owned) {
+        connectionOwner = std::thread::id();
+        connectionLock.unlock();
+    }
+}
+
+string SQLiteDBEngine::savepoint(unsigned int level)
+{
+    stringstream buff;
+    buff << "pparam_batch_" << level;
+    return buff.str();
+}
+
+void SQLiteDBEngine::rollbackFailedLevel()
+{
+    if (!batchLevels.empty() && !batchLevels.back()) {
+        // undo the failed transaction, its savepoint stays open for its
+        // rollback/commit.
+        string name = savepoint(batchLevels.size() - 1);
+        sqlite3_exec(dbp, ("ROLLBACK TO " + name).c_str(), NULL, 0, NULL);
+        countRollback();
+    }
 }
+
+void SQLiteDBEngine::rollbackTo(unsigned int level)
+{
+    string name = savepoint(level);
+    sqlite3_exec(dbp, ("ROLLBACK TO " + name + "; RELEASE " + name).c_str(), NULL, 0, NULL);
+    batchLevels.resize(level);
+    countRollback();
+}
+
 void SQLiteDBEngine::saveXParam(string pname, string pkey, string parentName, string parentKey,
                                 stringList fields, stringList values)
 {
+    ConnectionGuard guard(this);
     if (fields.size() != values.size())
         throw Exception("size of 'fields' and 'values' is not equal.",
                         TracePoint("SQLiteDBEngine"));
 
     stringstream buff, buffv;
+    if (!onTransaction) {
+        /* Statement runs now, so it can be a cached one with bound
+         * values; bulk inserts of a table share one statement.
+         */
+        stringList params;
+        buff << "INSERT INTO " << pname << "(" << pname << "_key";
+        buffv << ") VALUES (";
+        if (pkey == "")
+            buffv << "NULL";
+        else {
+            buffv << "?";
+            params.push_back(pkey);
+        }
+        if (!parentName.empty()) {
+            buff << "," << parentName << "_key";
+            buffv << ",?";
+            params.push_back(parentKey);
+        }
+        for (unsigned int i = 0; i < fields.size(); i++) {
+            buff << "," << fields[i];
+            buffv << ",?";
+            params.push_back(values[i]);
+        }
+        buff << buffv.str() << ")";
+        this->executeStatement(buff.str(), params);
+        return;
+    }
+
     buff << "INSERT INTO " << pname << "(" << pname << "_key,";
     buffv << ") VALUES (";
     if (pkey == "")
@@ -213,6 +524,27 @@ void SQLiteDBEngine::removeXParamByParent(string pname, string parentName, strin
     this->execute(buff.str());
 }
 
+void SQLiteDBEngine::removeXParamByValue(string pname, string parentName, string parentKey,
+                                         string fieldName, string value)
+{
+    ConnectionGuard guard(this);
+    stringstream buff;
+    buff << "DELETE FROM " << pname << " WHERE " << parentName << "_key=";
+    /* A value may be equal to a column name, so it's never put in
+     * double quotes.
+     */
+    if (!onTransaction) {
+        stringList params;
+        params.push_back(parentKey);
+        params.push_back(value);
+        buff << "? AND " << fieldName << "=?";
+        this->executeStatement(buff.str(), params);
+        return;
+    }
+    buff << sqlLiteral(parentKey) << " AND " << fieldName << "=" << sqlLiteral(value) << ";";
+    this->execute(buff.str());
+}
+
 void SQLiteDBEngine::createXParamStructure(string pname, string parentName, stringList fields,
                                            vector<DBFieldTypes> fieldTypes)
 {
@@ -230,6 +562,10 @@ void SQLiteDBEngine::createXParamStructure(string pname, string parentName, stri
     buff << ", CONSTRAINT " << pname << "_pkey PRIMARY KEY (" << pname << "_key"
          << (parentName.empty() ? "" : ", " + parentName + "_key") << ") );";
     this->execute(buff.str());
+    // children are mostly looked up by their parent, primary key doesn't
+    // help there because parent key isn't its leftmost column.
+    if (!parentName.empty())
+        this->createXParamIndex(pname, stringList(1, parentName + "_key"));
 }
 void SQLiteDBEngine::createXParamStructure(string pname, stringList fields,
                                            vector<DBFieldTypes> fieldTypes)
@@ -244,40 +580,141 @@ void SQLiteDBEngine::destroyXParamStructure(string pname)
     this->execute(buff.str());
 }
 
+void SQLiteDBEngine::createXParamIndex(string pname, stringList fields, bool unique)
+{
+    if (fields.empty())
+        throw Exception("Index has no field.", TracePoint("SQLiteDBEngine"));
+
+    stringstream buff, name;
+    name << pname;
+    for (unsigned int i = 0; i < fields.size(); i++)
+        name << "_" << fields[i];
+    buff << "CREATE " << (unique ? "UNIQUE " : "") << "INDEX IF NOT EXISTS " << name.str()
+         << "_idx ON " << pname << " (";
+    for (unsigned int i = 0; i < fields.size(); i++)
+        buff << (i == 0 ? "" : ",") << fields[i];
+    buff << ");";
+    if (indexesDeferred)
+        deferredIndexes.push_back(buff.str());
+    else
+        this->execute(buff.str());
+}
+
+void SQLiteDBEngine::deferIndexes(bool defer)
+{
+    indexesDeferred = defer;
+    if (defer)
+        return;
+    stringList indexes;
+    indexes.swap(deferredIndexes);
+    for (unsigned int i = 0; i < indexes.size(); i++)
+        this->execute(indexes[i]);
+}
+
+/**
+ * Loader that keeps fields and values of a row.
+ */
+class XDBRowCopier : public XDBRowLoader
+{
+public:
+    XDBRowCopier(stringList &_fields, stringList &_values) : fields(_fields), values(_values) {}
+    virtual void bindFields(const stringList &_fields) { fields = _fields; }
+    virtual void loadValue(unsigned int index, const char *value)
+    {
+        if (values.size() <= index)
+            values.resize(index + 1);
+        values[index] = value;
+    }
+
+protected:
+    stringList &fields;
+    stringList &values;
+};
+
 int SQLiteDBEngine::loadXParamRow(string pname, string pkey, string parentName, string parentKey,
                                   stringList &fields, stringList &values)
 {
-    string sqls = "SELECT * FROM " + pname + " WHERE " + pname + "_key=\"" + pkey + "\"";
-    if (!parentName.empty())
-        sqls += " AND " + parentName + "_key=\"" + parentKey + "\"\0";
-
-    int res;
-    sqlite3_stmt *stmt;
     fields.clear();
     values.clear();
-    res = sqlite3_prepare_v2(dbp, sqls.c_str(), -1, &stmt, NULL);
-    if (res == SQLITE_OK) {
-        int cols = sqlite3_column_count(stmt);
-        res = sqlite3_step(stmt);
+    XDBRowCopier copier(fields, values);
+    return rowReader(pname, parentName)->load(pkey, parentKey, copier);
+}
+
+class SQLiteDBEngine::RowReader : public XDBRowReader
+{
+public:
+    RowReader(SQLiteDBEngine *_engine, const string &pname, const string &parentName) :
+        engine(_engine), pkeyColumn(pname + "_key"), parentKeyColumn(parentName + "_key"),
+        hasParent(!parentName.empty()), columnCount(-1)
+    {
+        sql = "SELECT * FROM " + pname + " WHERE " + pkeyColumn + "=?";
+        if (hasParent)
+            sql += " AND " + parentKeyColumn + "=?";
+        stmt = engine->prepareStatement(sql);
+    }
+    virtual ~RowReader() { engine->releaseStatement(sql, stmt); }
+
+    virtual int load(const string &pkey, const string &parentKey, XDBRowLoader &loader)
+    {
+        sqlite3_bind_text(stmt, 1, pkey.c_str(), pkey.size(), SQLITE_STATIC);
+        if (hasParent)
+            sqlite3_bind_text(stmt, 2, parentKey.c_str(), parentKey.size(), SQLITE_STATIC);
+        int res = sqlite3_step(stmt);
         if (res != SQLITE_ROW) {
+            sqlite3_reset(stmt);
             if (res != SQLITE_DONE)
                 throw Exception("Error in loading data.", TracePoint("SQLiteDBEngine"));
-            sqlite3_finalize(stmt);
             return 0;
         }
-        for (int i = 0; i < cols; i++) {
-            if ((char *)sqlite3_column_name(stmt, i) == (parentName + "_key") ||
-                (char *)sqlite3_column_name(stmt, i) == (pname + "_key"))
-                continue;
-            fields.push_back((char *)sqlite3_column_name(stmt, i));
-            values.push_back((char *)sqlite3_column_text(stmt, i));
+        try {
+            // statement is prepared again when table changes
+            if (sqlite3_column_count(stmt) != columnCount)
+                bind(loader);
+            for (unsigned int i = 0; i < columns.size(); i++) {
+                const char *text = (const char *)sqlite3_column_text(stmt, columns[i]);
+                loader.loadValue(i, text == NULL ? "" : text);
+            }
+        } catch (Exception &e) {
+            sqlite3_reset(stmt);
+            e.addTracePoint(TracePoint("SQLiteDBEngine"));
+            throw e;
         }
-        sqlite3_finalize(stmt);
+        sqlite3_reset(stmt);
         return 1;
-    } else {
-        throw Exception("Error in loading statement.", TracePoint("SQLiteDBEngine"));
     }
+
+protected:
+    /** Find value columns (all but key columns) of result. */
+    void bind(XDBRowLoader &loader)
+    {
+        columnCount = sqlite3_column_count(stmt);
+        columns.clear();
+        stringList fields;
+        for (int i = 0; i < columnCount; i++) {
+            const char *name = sqlite3_column_name(stmt, i);
+            if (name == pkeyColumn || (hasParent && name == parentKeyColumn))
+                continue;
+            columns.push_back(i);
+            fields.push_back(name);
+        }
+        loader.bindFields(fields);
+    }
+
+    SQLiteDBEngine *engine;
+    string sql, pkeyColumn, parentKeyColumn;
+    bool hasParent;
+    sqlite3_stmt *stmt;
+    int columnCount;
+    /** indexes of value columns in result */
+    vector<int> columns;
+};
+
+std::unique_ptr<XDBRowReader> SQLiteDBEngine::rowReader(const string &pname,
+                                                        const string &parentName)
+{
+    return std::unique_ptr<XDBRowReader>(new RowReader(this, pname, parentName));
 }
+
 int SQLiteDBEngine::loadXParamRow(string pname, string pkey, stringList &fields, stringList &values)
 {
     return this->loadXParamRow(pname, pkey, "", "", fields, values);
@@ -344,6 +781,140 @@ void SQLiteDBEngine::getData(string selectstmt, vector<vector<string> > &results
     }
 }
 
+void SQLiteDBEngine::getData(string selectstmt, const stringList &params,
+                             vector<vector<string> > &results, vector<string> &columns)
+{
+#ifdef SQLDEBUG
+    cout << "\n SELECT :: " << selectstmt.c_str() << std::endl;
+#endif
+    sqlite3_stmt *stmt = prepareStatement(selectstmt, params);
+    int cols = sqlite3_column_count(stmt);
+    columns.clear();
+    for (int i = 0; i < cols; i++)
+        columns.push_back(sqlite3_column_name(stmt, i));
+    while (true) {
+        int res = sqlite3_step(stmt);
+        if (res != SQLITE_ROW) {
+            if (res == SQLITE_DONE)
+                break;
+            releaseStatement(selectstmt, stmt);
+            throw Exception("Error in loading data.", TracePoint("SQLiteDBEngine"));
+        }
+        vector<string> vrow;
+        for (int i = 0; i < cols; i++) {
+            const char *text = (const char *)sqlite3_column_text(stmt, i);
+            vrow.push_back(text == NULL ? "" : text);
+        }
+        results.push_back(vrow);
+    }
+    releaseStatement(selectstmt, stmt);
+}
+
+sqlite3_stmt *SQLiteDBEngine::prepareStatement(const string &sql)
+{
+    sqlite3_stmt *stmt = NULL;
+    pthread_mutex_lock(&statementsLock);
+    std::map<string, sqlite3_stmt *>::iterator iter = statements.find(sql);
+    if (iter != statements.end()) {
+        stmt = iter->second;
+        statements.erase(iter);
+    }
+    pthread_mutex_unlock(&statementsLock);
+    if (stmt != NULL)
+        return stmt;
+
+    if (sqlite3_prepare_v2(dbp, sql.c_str(), -1, &stmt, NULL) != SQLITE_OK) {
+        string err = sqlite3_errmsg(dbp);
+        sqlite3_finalize(stmt);
+        throw Exception("Error in loading statement: " + err, TracePoint("SQLiteDBEngine"));
+    }
+    return stmt;
+}
+
+sqlite3_stmt *SQLiteDBEngine::prepareStatement(const string &sql, const stringList &params)
+{
+    sqlite3_stmt *stmt = prepareStatement(sql);
+    if (sqlite3_bind_parameter_count(stmt) != (int)params.size()) {
+        releaseStatement(sql, stmt);
+        throw Exception("Number of parameters doesn't match the statement.",
+                        TracePoint("SQLiteDBEngine"));
+    }
+    for (unsigned int i = 0; i < params.size(); i++)
+        sqlite3_bind_text(stmt, i + 1, params[i].c_str(), params[i].size(), SQLITE_TRANSIENT);
+    return stmt;
+}
+
+void SQLiteDBEngine::query(string selectstmt, const stringList &params, XDBRowVisitor &visitor)
+{
+#ifdef SQLDEBUG
+    cout << "\n SELECT :: " << selectstmt.c_str() << std::endl;
+#endif
+    sqlite3_stmt *stmt = prepareStatement(selectstmt, params);
+    SQLiteRow row(stmt);
+    try {
+        while (true) {
+            int res = sqlite3_step(stmt);
+            if (res == SQLITE_DONE)
+                break;
+            if (res != SQLITE_ROW)
+                throw Exception("Error in loading data.", TracePoint("SQLiteDBEngine"));
+            if (!visitor.visit(row))
+                break;
+        }
+    } catch (...) {
+        releaseStatement(selectstmt, stmt);
+        throw;
+    }
+    releaseStatement(selectstmt, stmt);
+}
+
+void SQLiteDBEngine::releaseStatement(const string &sql, sqlite3_stmt *stmt)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    pthread_mutex_lock(&statementsLock);
+    // another thread may have released same statement meanwhile
+    if (statements.size() < STATEMENT_CACHE_SIZE && !statements.count(sql)) {
+        statements[sql] = stmt;
+        stmt = NULL;
+    }
+    pthread_mutex_unlock(&statementsLock);
+    if (stmt != NULL)
+        sqlite3_finalize(stmt);
+}
+
+void SQLiteDBEngine::executeStatement(const string &sql, const stringList &params)
+{
+#ifdef SQLDEBUG
+    cout << "\nDB X :" << sql.c_str();
+#endif
+    sqlite3_stmt *stmt;
+    try {
+        stmt = prepareStatement(sql, params);
+    } catch (Exception &e) {
+        rollbackFailedLevel();
+        e.addTracePoint(TracePoint("SQLiteDBEngine"));
+        throw e;
+    }
+    int rc = sqlite3_step(stmt);
+    string err = (rc == SQLITE_DONE) ? "" : sqlite3_errmsg(dbp);
+    releaseStatement(sql, stmt);
+    if (rc != SQLITE_DONE) {
+        rollbackFailedLevel();
+        throw Exception("SQL error: " + err, TracePoint("SQLiteDBEngine"));
+    }
+}
+
+void SQLiteDBEngine::clearStatements()
+{
+    pthread_mutex_lock(&statementsLock);
+    for (std::map<string, sqlite3_stmt *>::iterator iter = statements.begin();
+         iter != statements.end(); ++iter)
+        sqlite3_finalize(iter->second);
+    statements.clear();
+    pthread_mutex_unlock(&statementsLock);
+}
+
 string SQLiteDBEngine::DBTypetoString(DBFieldTypes t)
 {
     switch (t) {
@@ -369,29 +940,587 @@ string SQLiteDBEngine::DBTypetoString(DBFieldTypes t)
 
 bool SQLiteDBEngine::backup(string dest)
 {
-    int rc;                  /* Function return code */
-    sqlite3 *pFile;          /* Database connection opened on zFilename */
-    sqlite3_backup *pBackup; /* Backup handle used to copy data */
-
-    rc = sqlite3_open(dest.c_str(), &pFile);
-    if (rc == SQLITE_OK) {
-        pBackup = sqlite3_backup_init(pFile, "main", this->dbp, "main");
-        if (pBackup) {
-            do {
-                rc = sqlite3_backup_step(pBackup, 5);
-                if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
-                    sqlite3_sleep(10);
-                }
-            } while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
-            (void)sqlite3_backup_finish(pBackup);
+    try {
+        backupAsync(dest)->wait();
+    } catch (Exception &e) {
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<XDBBackupTask> SQLiteDBEngine::backupAsync(string dest,
+                                                           const XDBBackupOptions &options)
+{
+    if (!isconnected)
+        throw Exception("Database is not connected.", TracePoint("SQLiteDBEngine"));
+    if (options.pagesPerStep == 0)
+        throw Exception("Pages per step can't be zero.", TracePoint("SQLiteDBEngine"));
+
+    sqlite3 *source = NULL;
+    const char *fileName = sqlite3_db_filename(dbp, "main");
+    if (fileName != NULL && fileName[0] != '\0') {
+        if (sqlite3_open_v2(fileName, &source, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+            string msg = sqlite3_errmsg(source);
+            sqlite3_close(source);
+            throw Exception("Can't open database for backup: " + msg,
+                            TracePoint("SQLiteDBEngine"));
         }
-        rc = sqlite3_errcode(pFile);
+        sqlite3_busy_timeout(source, 100);
     }
-    (void)sqlite3_close(pFile);
-    return rc == SQLITE_OK;
+    std::shared_ptr<XDBBackupTask> task(
+        new XDBBackupTask(source ? source : dbp, source != NULL, dest, options));
+    if (source == NULL) {
+        std::lock_guard<std::mutex> guard(backupsLock);
+        // forget finished ones
+        for (unsigned int i = 0; i < backups.size();)
+            if (backups[i].expired() || backups[i].lock()->isDone()) {
+                backups[i] = backups.back();
+                backups.pop_back();
+            } else
+                i++;
+        backups.push_back(task);
+    }
+    task->worker = std::thread(&XDBBackupTask::run, task.get());
+    return task;
 }
 
 void SQLiteDBEngine::cleanup() { this->execute("VACUUM"); }
 
+// implementation of XDBBatch
+
+XDBBatch::XDBBatch(XDBEngine *_engine) :
+    engine(_engine), open(false), exceptions(std::uncaught_exceptions())
+{
+    engine->beginBatch();
+    open = true;
+}
+
+XDBBatch::~XDBBatch() noexcept(false)
+{
+    if (!open)
+        return;
+    if (std::uncaught_exceptions() > exceptions) {
+        open = false;
+        try {
+            engine->endBatch(false);
+        } catch (Exception &e) {
+            // nothing to do while unwinding
+        }
+        return;
+    }
+    commit();
+}
+
+void XDBBatch::commit()
+{
+    if (!open)
+        throw Exception("Batch is closed.", TracePoint("XDBBatch"));
+    open = false;
+    try {
+        engine->endBatch(true);
+    } catch (Exception &e) {
+        e.addTracePoint(TracePoint("XDBBatch"));
+        throw e;
+    }
+}
+
+void XDBBatch::rollback()
+{
+    if (!open)
+        throw Exception("Batch is closed.", TracePoint("XDBBatch"));
+    open = false;
+    engine->endBatch(false);
+}
+
+// implementation of XDBEngine
+
+XDBEngine::~XDBEngine() { stopExecutor(); }
+
+XDBExecutor *XDBEngine::executor()
+{
+    std::lock_guard<std::mutex> guard(asyncExecutorLock);
+    if (!asyncExecutor)
+        asyncExecutor.reset(new XDBExecutor(this));
+    return asyncExecutor.get();
+}
+
+void XDBEngine::stopExecutor()
+{
+    std::unique_ptr<XDBExecutor> stopped;
+    {
+        std::lock_guard<std::mutex> guard(asyncExecutorLock);
+        stopped = std::move(asyncExecutor);
+    }
+    // destructor runs queued operations, they may need executor() too.
+}
+
+// implementation of XDBExecutor
+
+XDBExecutor::XDBExecutor(XDBEngine *_engine, size_t _maxBatch) :
+    engine(_engine), maxBatch(_maxBatch ? _maxBatch : 1), stopping(false)
+{
+    workerThread = std::thread(&XDBExecutor::worker, this);
+}
+
+XDBExecutor::~XDBExecutor()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    queueCond.notify_all();
+    workerThread.join();
+}
+
+std::future<void> XDBExecutor::submit(std::function<void()> task, bool write)
+{
+    Task newTask;
+    newTask.run = task;
+    newTask.write = write;
+    std::future<void> future = newTask.done.get_future();
+    if (engine->isOnTransaction()) {
+        // worker would wait for the transaction that caller keeps open
+        try {
+            newTask.run();
+            newTask.done.set_value();
+        } catch (...) {
+            newTask.done.set_exception(std::current_exception());
+        }
+        return future;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (stopping)
+            throw Exception("Executor is stopped.", TracePoint("XDBExecutor"));
+        queue.push_back(std::move(newTask));
+    }
+    queueCond.notify_one();
+    return future;
+}
+
+size_t XDBExecutor::pending()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return queue.size();
+}
+
+void XDBExecutor::worker()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        queueCond.wait(guard, [this]() { return stopping || !queue.empty(); });
+        if (queue.empty())
+            break;
+        vector<Task> tasks;
+        do {
+            tasks.push_back(std::move(queue.front()));
+            queue.pop_front();
+        } while (tasks[0].write && !queue.empty() && queue.front().write
+                 && tasks.size() < maxBatch);
+        guard.unlock();
+        if (tasks[0].write)
+            runWrites(tasks);
+        else {
+            try {
+                tasks[0].run();
+                tasks[0].done.set_value();
+            } catch (...) {
+                tasks[0].done.set_exception(std::current_exception());
+            }
+        }
+        guard.lock();
+    }
+}
+
+void XDBExecutor::runWrites(vector<Task> &tasks)
+{
+    vector<std::exception_ptr> errors(tasks.size());
+    bool batched = false;
+    if (tasks.size() > 1) {
+        try {
+            engine->beginBatch();
+            batched = true;
+        } catch (Exception &e) {
+            // engine is on a transaction, each write commits by itself
+        }
+    }
+    for (unsigned int i = 0; i < tasks.size(); i++) {
+        try {
+            tasks[i].run();
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    }
+    if (batched) {
+        try {
+            engine->endBatch(true);
+        } catch (...) {
+            std::exception_ptr error = std::current_exception();
+            for (unsigned int i = 0; i < errors.size(); i++)
+                if (!errors[i])
+                    errors[i] = error;
+        }
+    }
+    for (unsigned int i = 0; i < tasks.size(); i++) {
+        if (errors[i])
+            tasks[i].done.set_exception(errors[i]);
+        else
+            tasks[i].done.set_value();
+    }
+}
+
+// implementation of XDBBackupTask
+
+XDBBackupTask::XDBBackupTask(sqlite3 *_source, bool _ownsSource, const string &_dest,
+                             const XDBBackupOptions &_options) :
+    source(_source),
+    ownsSource(_ownsSource), dest(_dest), options(_options), canceled(false), finished(false)
+{
+    done = result.get_future().share();
+}
+
+XDBBackupTask::~XDBBackupTask() { stop(); }
+
+void XDBBackupTask::cancel()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    canceled = true;
+    cancelCond.notify_all();
+}
+
+void XDBBackupTask::stop()
+{
+    cancel();
+    std::lock_guard<std::mutex> guard(workerLock);
+    if (worker.joinable())
+        worker.join();
+}
+
+XDBBackupProgress XDBBackupTask::getProgress()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return progress;
+}
+
+void XDBBackupTask::sleep(long ms)
+{
+    if (ms <= 0)
+        return;
+    std::unique_lock<std::mutex> guard(lock);
+    cancelCond.wait_for(guard, std::chrono::milliseconds(ms), [this] { return (bool)canceled; });
+}
+
+void XDBBackupTask::run()
+{
+    string temp = dest + ".tmp";
+    sqlite3 *file = NULL;
+    sqlite3_backup *handle = NULL;
+    try {
+        if (sqlite3_open(temp.c_str(), &file) != SQLITE_OK)
+            throw Exception("Can't open backup file: " + string(sqlite3_errmsg(file)),
+                            TracePoint("SQLiteDBEngine"));
+        handle = sqlite3_backup_init(file, "main", source, "main");
+        if (handle == NULL)
+            throw Exception("Can't start backup: " + string(sqlite3_errmsg(file)),
+                            TracePoint("SQLiteDBEngine"));
+
+        long long pageSize = 0;
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(source, "PRAGMA page_size", -1, &stmt, NULL) == SQLITE_OK) {
+            if (sqlite3_step(stmt) == SQLITE_ROW)
+                pageSize = sqlite3_column_int64(stmt, 0);
+            sqlite3_finalize(stmt);
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        long long copied = 0;
+        int last = -1;
+        while (true) {
+            if (canceled)
+                throw Exception("Backup is canceled.", TracePoint("SQLiteDBEngine"));
+            int rc = sqlite3_backup_step(handle, options.pagesPerStep);
+            if (rc != SQLITE_OK && rc != SQLITE_DONE && rc != SQLITE_BUSY && rc != SQLITE_LOCKED)
+                throw Exception("Backup failed: " + string(sqlite3_errstr(rc)),
+                                TracePoint("SQLiteDBEngine"));
+
+            XDBBackupProgress current;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                progress.remaining = sqlite3_backup_remaining(handle);
+                progress.total = sqlite3_backup_pagecount(handle);
+                if (last >= 0 && progress.remaining > last) {
+                    // source was changed by another connection, copy
+                    // started over
+                    ++progress.restarts;
+                    last = -1;
+                }
+                copied += (last < 0 ? progress.total : last) - progress.remaining;
+                last = progress.remaining;
+                current = progress;
+            }
+            if (options.progress)
+                options.progress(current);
+            if (rc == SQLITE_DONE)
+                break;
+
+            long delay = (rc == SQLITE_OK) ? options.stepDelay : std::max(options.stepDelay, 10);
+            if (options.bytesPerSecond && pageSize) {
+                // sleep until copied bytes fit in the rate
+                long long due = copied * pageSize * 1000 / (long long)options.bytesPerSecond;
+                long long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                        std::chrono::steady_clock::now() - start)
+                                        .count();
+                delay = std::max(delay, (long)(due - elapsed));
+            }
+            sleep(delay);
+        }
+        int rc = sqlite3_backup_finish(handle);
+        handle = NULL;
+        if (rc != SQLITE_OK)
+            throw Exception("Backup failed: " + string(sqlite3_errmsg(file)),
+                            TracePoint("SQLiteDBEngine"));
+        if (sqlite3_close(file) != SQLITE_OK)
+            throw Exception("Can't close backup file.", TracePoint("SQLiteDBEngine"));
+        file = NULL;
+        if (rename(temp.c_str(), dest.c_str()) != 0)
+            throw Exception("Can't rename backup file to " + dest + ".",
+                            TracePoint("SQLiteDBEngine"));
+        result.set_value();
+    } catch (Exception &e) {
+        if (handle != NULL)
+            sqlite3_backup_finish(handle);
+        if (file != NULL)
+            sqlite3_close(file);
+        unlink(temp.c_str());
+        e.addTracePoint(TracePoint("XDBBackupTask"));
+        result.set_exception(std::make_exception_ptr(e));
+    }
+    if (ownsSource)
+        sqlite3_close(source);
+    finished = true;
+}
+
+// implementation of XDBExpr
+
+XDBExpr XDBExpr::equal(const string &field, const string &value)
+{
+    return XDBExpr(EQ, field, stringList(1, value));
+}
+
+XDBExpr XDBExpr::notEqual(const string &field, const string &value)
+{
+    return XDBExpr(NE, field, stringList(1, value));
+}
+
+XDBExpr XDBExpr::greaterThan(const string &field, const string &value)
+{
+    return XDBExpr(GT, field, stringList(1, value));
+}
+
+XDBExpr XDBExpr::greaterThanOrEqual(const string &field, const string &value)
+{
+    return XDBExpr(GE, field, stringList(1, value));
+}
+
+XDBExpr XDBExpr::lessThan(const string &field, const string &value)
+{
+    return XDBExpr(LT, field, stringList(1, value));
+}
+
+XDBExpr XDBExpr::lessThanOrEqual(const string &field, const string &value)
+{
+    return XDBExpr(LE, field, stringList(1, value));
+}
+
+XDBExpr XDBExpr::like(const string &field, const string &pattern)
+{
+    return XDBExpr(LIKE, field, stringList(1, pattern));
+}
+
+XDBExpr XDBExpr::in(const string &field, const stringList &values)
+{
+    return XDBExpr(IN, field, values);
+}
+
+XDBExpr XDBExpr::between(const string &field, const string &startv, const string &endv)
+{
+    stringList values;
+    values.push_back(startv);
+    values.push_back(endv);
+    return XDBExpr(BETWEEN, field, values);
+}
+
+XDBExpr XDBExpr::operator!() const
+{
+    if (type == EMPTY)
+        return *this;
+    if (type == NOT)
+        return operands[0];
+    XDBExpr expr(NOT, "", stringList());
+    expr.operands.push_back(*this);
+    return expr;
+}
+
+XDBExpr XDBExpr::combine(Type _type, const XDBExpr &expr) const
+{
+    if (expr.type == EMPTY)
+        return *this;
+    if (type == EMPTY)
+        return expr;
+    XDBExpr result(_type, "", stringList());
+    // flatten chains of same operator: (a AND b) AND c -> a AND b AND c
+    if (type == _type)
+        result.operands = operands;
+    else
+        result.operands.push_back(*this);
+    if (expr.type == _type)
+        result.operands.insert(result.operands.end(), expr.operands.begin(), expr.operands.end());
+    else
+        result.operands.push_back(expr);
+    return result;
+}
+
+string XDBExpr::compile(stringList &params) const
+{
+    stringstream buff;
+    switch (type) {
+    case EMPTY:
+        return "1";
+    case EQ:
+        buff << field << "=?";
+        break;
+    case NE:
+        buff << field << "<>?";
+        break;
+    case GT:
+        buff << field << ">?";
+        break;
+    case GE:
+        buff << field << ">=?";
+        break;
+    case LT:
+        buff << field << "<?";
+        break;
+    case LE:
+        buff << field << "<=?";
+        break;
+    case LIKE:
+        buff << field << " LIKE ?";
+        break;
+    case BETWEEN:
+        buff << field << " BETWEEN ? AND ?";
+        break;
+    case IN:
+        // "x IN ()" isn't valid SQL, and matches nothing anyway.
+        if (values.empty())
+            return "0";
+        buff << field << " IN (";
+        for (unsigned int i = 0; i < values.size(); i++)
+            buff << (i == 0 ? "?" : ",?");
+        buff << ")";
+        break;
+    case NOT:
+        return "NOT (" + operands[0].compile(params) + ")";
+    case AND:
+    case OR:
+        for (unsigned int i = 0; i < operands.size(); i++)
+            buff << (i == 0 ? "(" : (type == AND ? " AND " : " OR ")) << operands[i].compile(params);
+        buff << ")";
+        return buff.str();
+    }
+    params.insert(params.end(), values.begin(), values.end());
+    return buff.str();
+}
+
+// implementation of XDBPageCursor
+
+XDBPageCursor XDBPageCursor::endCursor()
+{
+    XDBPageCursor cursor;
+    cursor.started = cursor.end = true;
+    return cursor;
+}
+
+XDBExpr XDBPageCursor::condition(const string &orderColumn, const string &keyColumn) const
+{
+    if (!started || end)
+        return XDBExpr();
+    XDBExpr afterKey = descending ? XDBExpr::lessThan(keyColumn, key)
+                                  : XDBExpr::greaterThan(keyColumn, key);
+    if (orderColumn.empty())
+        return afterKey;
+    XDBExpr afterValue = descending ? XDBExpr::lessThan(orderColumn, value)
+                                    : XDBExpr::greaterThan(orderColumn, value);
+    return afterValue || (XDBExpr::equal(orderColumn, value) && afterKey);
+}
+
+static const char hexDigits[] = "0123456789abcdef";
+
+string XDBPageCursor::token() const
+{
+    if (!started)
+        return "";
+    if (end)
+        return "-";
+    // length prefixed fields, hex encoded
+    stringstream buff;
+    buff << (descending ? 'd' : 'a') << orderBy.size() << ':' << orderBy << value.size() << ':'
+         << value << key;
+    string raw = buff.str(), result;
+    for (unsigned int i = 0; i < raw.size(); i++) {
+        result += hexDigits[(unsigned char)raw[i] >> 4];
+        result += hexDigits[(unsigned char)raw[i] & 0xf];
+    }
+    return result;
+}
+
+/**
+ * Read "<length>:<string>" at "pos" of "raw".
+ */
+static bool readField(const string &raw, size_t &pos, string &field)
+{
+    size_t colon = raw.find(':', pos);
+    if (colon == string::npos || colon == pos)
+        return false;
+    size_t length = 0;
+    for (size_t i = pos; i < colon; i++) {
+        if (raw[i] < '0' || raw[i] > '9')
+            return false;
+        length = length * 10 + (raw[i] - '0');
+    }
+    if (length > raw.size() - colon - 1)
+        return false;
+    field = raw.substr(colon + 1, length);
+    pos = colon + 1 + length;
+    return true;
+}
+
+XDBPageCursor XDBPageCursor::fromToken(const string &token)
+{
+    if (token.empty())
+        return XDBPageCursor();
+    if (token == "-")
+        return endCursor();
+    string raw;
+    bool valid = token.size() % 2 == 0;
+    for (unsigned int i = 0; valid && i < token.size(); i += 2) {
+        const char *high = strchr(hexDigits, token[i]);
+        const char *low = strchr(hexDigits, token[i + 1]);
+        valid = token[i] && token[i + 1] && high && low;
+        if (valid)
+            raw += (char)(((high - hexDigits) << 4) | (low - hexDigits));
+    }
+    XDBPageCursor cursor;
+    size_t pos = 1;
+    valid = valid && !raw.empty() && (raw[0] == 'a' || raw[0] == 'd')
+            && readField(raw, pos, cursor.orderBy) && readField(raw, pos, cursor.value);
+    if (!valid)
+        throw Exception("Invalid page token.", TracePoint("XDBPageCursor"));
+    cursor.key = raw.substr(pos);
+    cursor.descending = raw[0] == 'd';
+    cursor.started = true;
+    return cursor;
+}
+
 } // namespace pparam
 // end namespace pparam
@@ -0,0 +1,1188 @@
+#include "xdblog.hpp"
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::stringstream;
+
+namespace pparam
+{
+// implementation of LogDBEngine
+
+/* Segment file is a sequence of frames:
+ *   magic (4 bytes), length of body (4), checksum of body (4), body
+ * Body is a sequence of records:
+ *   length of rest of record (4), type (1), fields
+ * Strings are written as their length (4) and bytes, numbers in native
+ * byte order.
+ */
+static const uint32_t FRAME_MAGIC = 0x474c5050;
+static const size_t FRAME_HEADER = 12;
+// frames of compaction are cut at this size
+static const size_t IMAGE_FRAME_SIZE = 1 << 20;
+
+enum LogRecordType {
+    RECORD_CREATE = 1,
+    RECORD_DROP,
+    RECORD_PUT,
+    RECORD_DELETE,
+    // in compacted segments, forget everything before
+    RECORD_RESET
+};
+
+static const char *CHECKPOINT_FILE = "index.ckp";
+static const char *CHECKPOINT_MAGIC = "pparam-logdb-index 1\n";
+
+static void putU32(string &buff, uint32_t value) { buff.append((const char *)&value, 4); }
+
+static void putU64(string &buff, uint64_t value) { buff.append((const char *)&value, 8); }
+
+static void putString(string &buff, const string &str)
+{
+    putU32(buff, str.size());
+    buff += str;
+}
+
+static uint32_t checksum(const char *data, size_t size)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Reads fields of a record or checkpoint, throws if data is short.
+ */
+class LogReader
+{
+public:
+    LogReader(const string &_data, size_t _pos = 0) : data(_data), pos(_pos) {}
+    unsigned char u8()
+    {
+        need(1);
+        return data[pos++];
+    }
+    uint32_t u32()
+    {
+        uint32_t value;
+        need(4);
+        memcpy(&value, data.data() + pos, 4);
+        pos += 4;
+        return value;
+    }
+    uint64_t u64()
+    {
+        uint64_t value;
+        need(8);
+        memcpy(&value, data.data() + pos, 8);
+        pos += 8;
+        return value;
+    }
+    string str()
+    {
+        size_t size = u32();
+        need(size);
+        pos += size;
+        return data.substr(pos - size, size);
+    }
+    bool atEnd() { return pos == data.size(); }
+
+protected:
+    void need(size_t size)
+    {
+        if (data.size() - pos < size)
+            throw Exception("Corrupted log record.", TracePoint("LogDBEngine"));
+    }
+
+    const string &data;
+    size_t pos;
+};
+
+static bool readFully(int fd, char *buff, size_t size, unsigned long long offset)
+{
+    while (size > 0) {
+        ssize_t n = pread(fd, buff, size, offset);
+        if (n <= 0)
+            return false;
+        buff += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const char *buff, size_t size, unsigned long long offset)
+{
+    while (size > 0) {
+        ssize_t n = pwrite(fd, buff, size, offset);
+        if (n <= 0)
+            return false;
+        buff += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static void syncDirectory(const string &directory)
+{
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+LogDBEngine::LogDBEngine(size_t _segmentSize, bool _syncWrites, double _compactRatio) :
+    XDBBufferedEngine("LogDBEngine"), activeSegment(0),
+    segmentSize(_segmentSize ? _segmentSize : 1), syncWrites(_syncWrites),
+    compactRatio(_compactRatio), isconnected(false), anonymousSeq(0), stopCompactor(false)
+{
+}
+
+LogDBEngine::~LogDBEngine()
+{
+    stopExecutor();
+    if (isconnected) {
+        try {
+            disconnect();
+        } catch (Exception &e) {
+            // nothing to do in destructor
+        }
+    }
+}
+
+void LogDBEngine::connect(string connectionString)
+{
+    if (isconnected)
+        throw Exception("Engine is connected already.", TracePoint("LogDBEngine"));
+    struct stat st;
+    if (stat(connectionString.c_str(), &st) != 0
+        && mkdir(connectionString.c_str(), 0755) != 0)
+        throw Exception("Can't create directory '" + connectionString + "'.",
+                        TracePoint("LogDBEngine"));
+    {
+        ScopedLock guard(&lock, true);
+        directory = connectionString;
+        try {
+            recover();
+        } catch (Exception &e) {
+            for (auto iter = segments.begin(); iter != segments.end(); ++iter)
+                close(iter->second.fd);
+            segments.clear();
+            tables.clear();
+            e.addTracePoint(TracePoint("LogDBEngine"));
+            throw e;
+        }
+        isconnected = true;
+    }
+    stopCompactor = false;
+    compactorThread = std::thread(&LogDBEngine::compactor, this);
+}
+
+void LogDBEngine::disconnect()
+{
+    if (isOnTransaction())
+        rollbackTransaction();
+    {
+        std::lock_guard<std::mutex> guard(compactorLock);
+        stopCompactor = true;
+    }
+    compactorCond.notify_all();
+    if (compactorThread.joinable())
+        compactorThread.join();
+
+    ScopedLock guard(&lock, true);
+    if (!isconnected)
+        return;
+    try {
+        writeCheckpoint();
+    } catch (Exception &e) {
+        // next connect() scans segments instead
+    }
+    for (auto iter = segments.begin(); iter != segments.end(); ++iter)
+        close(iter->second.fd);
+    segments.clear();
+    tables.clear();
+    isconnected = false;
+}
+
+void LogDBEngine::execute(string command)
+{
+    throw Exception("LogDBEngine doesn't run SQL statements.", TracePoint("LogDBEngine"));
+}
+
+void LogDBEngine::saveXParam(string pname, string pkey, string parentName, string parentKey,
+                             stringList fields, stringList values)
+{
+    if (fields.size() != values.size())
+        throw Exception("size of 'fields' and 'values' is not equal.",
+                        TracePoint("LogDBEngine"));
+
+    perform([=](Frame &frame) {
+        Table &t = table(pname);
+        if (t.parentName != parentName)
+            throw Exception("Parent of '" + pname + "' is not '" + parentName + "'.",
+                            TracePoint("LogDBEngine"));
+        stringList row(t.columns.size());
+        for (unsigned int i = 0; i < fields.size(); i++)
+            row[columnIndex(t, fields[i])] = values[i];
+        string key = pkey;
+        string pkey2 = parentName.empty() ? "" : parentKey;
+        if (key.empty()) {
+            // rows without key (single members of sets) are never addressed by key
+            stringstream buff;
+            buff << '\1' << ++anonymousSeq;
+            key = buff.str();
+        } else if (t.rows.count(rowKey(key, pkey2)))
+            throw Exception("UNIQUE constraint failed: " + pname, TracePoint("LogDBEngine"));
+        putRow(frame, t, key, pkey2, row);
+    });
+}
+
+void LogDBEngine::saveXParam(string pname, string pkey, stringList fields, stringList values)
+{
+    saveXParam(pname, pkey, "", "", fields, values);
+}
+
+void LogDBEngine::updateXParam(string pname, string pkey, string parentName, string parentKey,
+                               stringList fields, stringList values)
+{
+    if (fields.size() != values.size())
+        throw Exception("size of 'fields' and 'values' is not equal.",
+                        TracePoint("LogDBEngine"));
+
+    perform([=](Frame &frame) {
+        Table &t = table(pname);
+        vector<int> columns;
+        for (unsigned int i = 0; i < fields.size(); i++)
+            columns.push_back(columnIndex(t, fields[i]));
+        vector<string> keys = findRows(t, pkey, parentName, parentKey);
+        for (unsigned int i = 0; i < keys.size(); i++) {
+            Row row = t.rows.find(keys[i])->second;
+            stringList current = readRow(t, row, &frame);
+            for (unsigned int j = 0; j < columns.size(); j++)
+                current[columns[j]] = values[j];
+            putRow(frame, t, row.pkey, row.parentKey, current);
+        }
+    });
+}
+
+void LogDBEngine::updateXParam(string pname, string pkey, stringList fields, stringList values)
+{
+    updateXParam(pname, pkey, "", "", fields, values);
+}
+
+void LogDBEngine::removeXParam(string pname, string pkey, string parentName, string parentKey)
+{
+    perform([=](Frame &frame) {
+        Table &t = table(pname);
+        vector<string> keys = findRows(t, pkey, parentName, parentKey);
+        for (unsigned int i = 0; i < keys.size(); i++)
+            eraseRow(frame, t, keys[i]);
+    });
+}
+
+void LogDBEngine::removeXParam(string pname, string pkey) { this->removeXParam(pname, pkey, "", ""); }
+
+void LogDBEngine::removeXParamByParent(string pname, string parentName, string parentKey)
+{
+    perform([=](Frame &frame) {
+        Table &t = table(pname);
+        if (t.parentName != parentName)
+            throw Exception("Parent of '" + pname + "' is not '" + parentName + "'.",
+                            TracePoint("LogDBEngine"));
+        auto iter = t.children.find(parentKey);
+        if (iter == t.children.end())
+            return;
+        std::map<unsigned long long, string> keys = iter->second;
+        for (auto kiter = keys.begin(); kiter != keys.end(); ++kiter)
+            eraseRow(frame, t, kiter->second);
+    });
+}
+
+void LogDBEngine::removeXParamByValue(string pname, string parentName, string parentKey,
+                                      string fieldName, string value)
+{
+    perform([=](Frame &frame) {
+        Table &t = table(pname);
+        if (t.parentName != parentName)
+            throw Exception("Parent of '" + pname + "' is not '" + parentName + "'.",
+                            TracePoint("LogDBEngine"));
+        int column = columnIndex(t, fieldName);
+        auto iter = t.children.find(parentKey);
+        if (iter == t.children.end())
+            return;
+        vector<string> keys;
+        for (auto kiter = iter->second.begin(); kiter != iter->second.end(); ++kiter)
+            if (readRow(t, t.rows.find(kiter->second)->second, &frame)[column] == value)
+                keys.push_back(kiter->second);
+        for (unsigned int i = 0; i < keys.size(); i++)
+            eraseRow(frame, t, keys[i]);
+    });
+}
+
+void LogDBEngine::createXParamStructure(string pname, string parentName, stringList fields,
+                                        vector<DBFieldTypes> fieldTypes)
+{
+    if (fields.size() != fieldTypes.size())
+        throw Exception("size of 'fields' and 'datatypes' list is not equal.",
+                        TracePoint("LogDBEngine"));
+
+    perform([=](Frame &frame) {
+        if (tables.count(pname))
+            return;
+        string record(1, (char)RECORD_CREATE);
+        putString(record, pname);
+        putString(record, parentName);
+        putU32(record, fields.size());
+        for (unsigned int i = 0; i < fields.size(); i++) {
+            putString(record, fields[i]);
+            record += (char)fieldTypes[i];
+        }
+        Table &t = tables[pname];
+        t.name = pname;
+        t.parentName = parentName;
+        t.columns = fields;
+        t.columnTypes = fieldTypes;
+        t.location = append(frame, record);
+        addLive(t.location, 1);
+        frame.undo.push_back([this, pname]() {
+            addLive(tables[pname].location, -1);
+            tables.erase(pname);
+        });
+    });
+}
+
+void LogDBEngine::createXParamStructure(string pname, stringList fields,
+                                        vector<DBFieldTypes> fieldTypes)
+{
+    this->createXParamStructure(pname, "", fields, fieldTypes);
+}
+
+void LogDBEngine::destroyXParamStructure(string pname)
+{
+    perform([=](Frame &frame) {
+        std::map<string, Table>::iterator iter = tables.find(pname);
+        if (iter == tables.end())
+            return;
+        string record(1, (char)RECORD_DROP);
+        putString(record, pname);
+        append(frame, record);
+        std::shared_ptr<Table> saved = std::make_shared<Table>(std::move(iter->second));
+        tables.erase(iter);
+        addLive(saved->location, -1);
+        for (auto riter = saved->rows.begin(); riter != saved->rows.end(); ++riter)
+            addLive(riter->second.location, -1);
+        frame.undo.push_back([this, pname, saved]() {
+            addLive(saved->location, 1);
+            for (auto riter = saved->rows.begin(); riter != saved->rows.end(); ++riter)
+                addLive(riter->second.location, 1);
+            tables[pname] = std::move(*saved);
+        });
+    });
+}
+
+void LogDBEngine::createXParamIndex(string pname, stringList fields, bool unique)
+{
+    /* Rows are hashed by key and by parent key, that's all lookups we
+     * have; just check that index is meaningful.
+     */
+    perform([=](Frame &frame) {
+        Table &t = table(pname);
+        for (unsigned int i = 0; i < fields.size(); i++)
+            columnIndex(t, fields[i], true);
+    });
+}
+
+int LogDBEngine::loadXParamRow(string pname, string pkey, string parentName, string parentKey,
+                               stringList &fields, stringList &values)
+{
+    ScopedLock guard(&lock, false);
+    fields.clear();
+    values.clear();
+    Table &t = table(pname);
+    vector<string> keys = findRows(t, pkey, parentName, parentKey);
+    if (keys.empty())
+        return 0;
+    fields = t.columns;
+    values = readRow(t, t.rows.find(keys[0])->second);
+    return 1;
+}
+
+int LogDBEngine::loadXParamRow(string pname, string pkey, stringList &fields, stringList &values)
+{
+    return this->loadXParamRow(pname, pkey, "", "", fields, values);
+}
+
+int LogDBEngine::loadXParamValueListByParent(string pname, string parentName, string parentKey,
+                                             string fieldName, stringList &values)
+{
+    ScopedLock guard(&lock, false);
+    values.clear();
+    Table &t = table(pname);
+    if (t.parentName != parentName)
+        throw Exception("Parent of '" + pname + "' is not '" + parentName + "'.",
+                        TracePoint("LogDBEngine"));
+    int column = columnIndex(t, fieldName, true);
+    auto iter = t.children.find(parentKey);
+    if (iter == t.children.end())
+        return 0;
+    for (auto kiter = iter->second.begin(); kiter != iter->second.end(); ++kiter) {
+        const Row &row = t.rows.find(kiter->second)->second;
+        if (column == KEY_COLUMN)
+            values.push_back(row.pkey[0] == '\1' ? "" : row.pkey);
+        else if (column == PARENT_KEY_COLUMN)
+            values.push_back(row.parentKey);
+        else
+            values.push_back(readRow(t, row)[column]);
+    }
+    return values.size();
+}
+
+void LogDBEngine::getData(string selectstmt, vector<vector<string> > &results,
+                          vector<string> &columns)
+{
+    throw Exception("LogDBEngine doesn't run SQL statements.", TracePoint("LogDBEngine"));
+}
+
+bool LogDBEngine::backup(string dest)
+{
+    struct stat st;
+    if (stat(dest.c_str(), &st) != 0 && mkdir(dest.c_str(), 0755) != 0)
+        return false;
+    // remove old database, its segments would be replayed after ours
+    DIR *dir = opendir(dest.c_str());
+    if (dir == NULL)
+        return false;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        string name = entry->d_name;
+        if ((name.size() > 4 && name.compare(name.size() - 4, 4, ".seg") == 0)
+            || name == CHECKPOINT_FILE)
+            unlink((dest + "/" + name).c_str());
+    }
+    closedir(dir);
+
+    string path = dest + "/00000001.seg", tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    try {
+        ScopedLock guard(&lock, false);
+        Image image;
+        takeImage(image);
+        vector<Location> tableLocations;
+        vector<vector<Location> > locations;
+        writeImage(fd, 1, image, tableLocations, locations);
+    } catch (Exception &e) {
+        close(fd);
+        unlink(tmp.c_str());
+        return false;
+    }
+    close(fd);
+    if (rename(tmp.c_str(), path.c_str()) != 0)
+        return false;
+    syncDirectory(dest);
+    return true;
+}
+
+void LogDBEngine::cleanup() { compact(); }
+
+void LogDBEngine::compact()
+{
+    std::lock_guard<std::mutex> cguard(compactLock);
+    Image image;
+    unsigned int target;
+    {
+        ScopedLock guard(&lock, true);
+        if (!isconnected)
+            return;
+        // seal active segment, so everything is compacted
+        if (segments[activeSegment].size > 0)
+            rollSegment();
+        if (segments.size() < 2)
+            return;
+        target = activeSegment - 1;
+        takeImage(image);
+    }
+
+    string path = segmentPath(target), tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw Exception("Can't create '" + tmp + "'.", TracePoint("LogDBEngine"));
+    vector<Location> tableLocations;
+    vector<vector<Location> > locations;
+    unsigned long long size;
+    try {
+        // sealed segments never change, no lock is needed to read them
+        size = writeImage(fd, target, image, tableLocations, locations);
+    } catch (Exception &e) {
+        close(fd);
+        unlink(tmp.c_str());
+        e.addTracePoint(TracePoint("LogDBEngine"));
+        throw e;
+    }
+
+    ScopedLock guard(&lock, true);
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        close(fd);
+        unlink(tmp.c_str());
+        throw Exception("Can't rename '" + tmp + "'.", TracePoint("LogDBEngine"));
+    }
+    syncDirectory(directory);
+    /* Compacted segment starts with a reset record, so older segments are
+     * ignored by recovery even if we crash before deleting them.
+     */
+    for (auto iter = segments.begin(); iter != segments.end() && iter->first <= target;) {
+        close(iter->second.fd);
+        if (iter->first < target)
+            unlink(segmentPath(iter->first).c_str());
+        iter = segments.erase(iter);
+    }
+    Segment &segment = segments[target];
+    segment.fd = fd;
+    segment.size = size;
+
+    // move rows that weren't changed meanwhile to their new records
+    for (unsigned int i = 0; i < image.tables.size(); i++) {
+        std::map<string, Table>::iterator titer = tables.find(image.tables[i].name);
+        if (titer == tables.end())
+            continue;
+        Table &t = titer->second;
+        if (t.location == image.tables[i].location)
+            t.location = tableLocations[i];
+        for (unsigned int j = 0; j < image.rows[i].size(); j++) {
+            auto riter = t.rows.find(image.rows[i][j].first);
+            if (riter != t.rows.end() && riter->second.location == image.rows[i][j].second)
+                riter->second.location = locations[i][j];
+        }
+    }
+    recount();
+}
+
+double LogDBEngine::garbageRatio()
+{
+    ScopedLock guard(&lock, false);
+    unsigned long long size = 0, live = 0;
+    for (auto iter = segments.begin(); iter != segments.end(); ++iter) {
+        if (iter->first == activeSegment)
+            continue;
+        size += iter->second.size;
+        live += iter->second.live;
+    }
+    return size ? 1.0 - (double)live / size : 0;
+}
+
+void LogDBEngine::apply(const vector<Operation> &ops)
+{
+    if (!isconnected)
+        throw Exception("Database is not connected.", TracePoint("LogDBEngine"));
+    Frame frame;
+    frame.segment = activeSegment;
+    frame.base = segments[activeSegment].size + FRAME_HEADER;
+    try {
+        for (unsigned int i = 0; i < ops.size(); i++)
+            ops[i](frame);
+        if (!frame.body.empty())
+            writeFrame(frame.body);
+    } catch (Exception &e) {
+        for (UndoLog::reverse_iterator iter = frame.undo.rbegin(); iter != frame.undo.rend();
+             ++iter)
+            (*iter)();
+        countRollback();
+        e.addTracePoint(TracePoint("LogDBEngine"));
+        throw e;
+    }
+    if (segments[activeSegment].size >= segmentSize) {
+        rollSegment();
+        compactorCond.notify_all();
+    }
+}
+
+LogDBEngine::Table &LogDBEngine::table(const string &pname)
+{
+    std::map<string, Table>::iterator iter = tables.find(pname);
+    if (iter == tables.end())
+        throw Exception("no such table: " + pname, TracePoint("LogDBEngine"));
+    return iter->second;
+}
+
+LogDBEngine::Location LogDBEngine::append(Frame &frame, const string &record)
+{
+    Location location;
+    location.segment = frame.segment;
+    location.offset = frame.base + frame.body.size();
+    location.length = record.size() + 4;
+    putU32(frame.body, record.size());
+    frame.body += record;
+    return location;
+}
+
+string LogDBEngine::readRecord(const Location &location, const Frame *frame)
+{
+    if (frame != NULL && location.segment == frame->segment && location.offset >= frame->base)
+        return frame->body.substr(location.offset - frame->base, location.length);
+    std::map<unsigned int, Segment>::iterator iter = segments.find(location.segment);
+    string record(location.length, '\0');
+    if (iter == segments.end()
+        || !readFully(iter->second.fd, &record[0], record.size(), location.offset))
+        throw Exception("Can't read log record.", TracePoint("LogDBEngine"));
+    return record;
+}
+
+stringList LogDBEngine::readRow(const Table &table, const Row &row, const Frame *frame)
+{
+    string record = readRecord(row.location, frame);
+    LogReader reader(record, 4);
+    if (reader.u8() != RECORD_PUT)
+        throw Exception("Corrupted log record.", TracePoint("LogDBEngine"));
+    reader.str(); // table
+    reader.str(); // key
+    reader.str(); // parent key
+    stringList values(reader.u32());
+    for (unsigned int i = 0; i < values.size(); i++)
+        values[i] = reader.str();
+    values.resize(table.columns.size());
+    return values;
+}
+
+void LogDBEngine::putRow(Frame &frame, Table &table, const string &pkey,
+                         const string &parentKey, const stringList &values)
+{
+    string record(1, (char)RECORD_PUT);
+    putString(record, table.name);
+    putString(record, pkey);
+    putString(record, parentKey);
+    putU32(record, values.size());
+    for (unsigned int i = 0; i < values.size(); i++)
+        putString(record, values[i]);
+    Location location = append(frame, record);
+
+    string key = rowKey(pkey, parentKey), pname = table.name;
+    auto iter = table.rows.find(key);
+    if (iter != table.rows.end()) {
+        Location old = iter->second.location;
+        indexRow(table, pkey, parentKey, location);
+        frame.undo.push_back([this, pname, key, old]() {
+            Row &row = tables[pname].rows.find(key)->second;
+            addLive(row.location, -1);
+            row.location = old;
+            addLive(old, 1);
+        });
+    } else {
+        indexRow(table, pkey, parentKey, location);
+        frame.undo.push_back([this, pname, key]() { unindexRow(tables[pname], key); });
+    }
+}
+
+void LogDBEngine::eraseRow(Frame &frame, Table &table, const string &key)
+{
+    auto iter = table.rows.find(key);
+    if (iter == table.rows.end())
+        return;
+    string record(1, (char)RECORD_DELETE);
+    putString(record, table.name);
+    putString(record, iter->second.pkey);
+    putString(record, iter->second.parentKey);
+    append(frame, record);
+
+    Row saved = iter->second;
+    string pname = table.name;
+    unindexRow(table, key);
+    frame.undo.push_back([this, pname, key, saved]() {
+        Table &t = tables[pname];
+        t.children[saved.parentKey][saved.seq] = key;
+        t.rows.emplace(key, saved);
+        addLive(saved.location, 1);
+    });
+}
+
+void LogDBEngine::indexRow(Table &table, const string &pkey, const string &parentKey,
+                           const Location &location)
+{
+    string key = rowKey(pkey, parentKey);
+    auto iter = table.rows.find(key);
+    if (iter != table.rows.end()) {
+        // row keeps its place among children of its parent
+        addLive(iter->second.location, -1);
+        iter->second.location = location;
+    } else {
+        Row row;
+        row.pkey = pkey;
+        row.parentKey = parentKey;
+        row.location = location;
+        row.seq = ++table.seq;
+        table.children[parentKey][row.seq] = key;
+        table.rows.emplace(key, std::move(row));
+    }
+    addLive(location, 1);
+}
+
+void LogDBEngine::unindexRow(Table &table, const string &key)
+{
+    auto iter = table.rows.find(key);
+    if (iter == table.rows.end())
+        return;
+    addLive(iter->second.location, -1);
+    auto citer = table.children.find(iter->second.parentKey);
+    citer->second.erase(iter->second.seq);
+    if (citer->second.empty())
+        table.children.erase(citer);
+    table.rows.erase(iter);
+}
+
+void LogDBEngine::addLive(const Location &location, int sign)
+{
+    std::map<unsigned int, Segment>::iterator iter = segments.find(location.segment);
+    if (iter != segments.end())
+        iter->second.live += sign * (long long)location.length;
+}
+
+string LogDBEngine::segmentPath(unsigned int id)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%08u.seg", id);
+    return directory + name;
+}
+
+void LogDBEngine::rollSegment()
+{
+    unsigned int id = activeSegment + 1;
+    string path = segmentPath(id);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw Exception("Can't create '" + path + "'.", TracePoint("LogDBEngine"));
+    if (syncWrites)
+        syncDirectory(directory);
+    segments[id].fd = fd;
+    activeSegment = id;
+}
+
+void LogDBEngine::writeFrame(const string &body)
+{
+    Segment &segment = segments[activeSegment];
+    string frame;
+    frame.reserve(FRAME_HEADER + body.size());
+    putU32(frame, FRAME_MAGIC);
+    putU32(frame, body.size());
+    putU32(frame, checksum(body.data(), body.size()));
+    frame += body;
+    if (!writeFully(segment.fd, frame.data(), frame.size(), segment.size)
+        || (syncWrites && fdatasync(segment.fd) != 0)) {
+        if (ftruncate(segment.fd, segment.size) != 0) {
+            // recovery drops the broken frame
+        }
+        throw Exception("Can't write to log segment.", TracePoint("LogDBEngine"));
+    }
+    segment.size += frame.size();
+}
+
+void LogDBEngine::replaySegment(unsigned int id, unsigned long long from, bool last)
+{
+    Segment &segment = segments[id];
+    struct stat st;
+    if (fstat(segment.fd, &st) != 0)
+        throw Exception("Can't read '" + segmentPath(id) + "'.", TracePoint("LogDBEngine"));
+    unsigned long long offset = from, size = st.st_size;
+    while (offset < size) {
+        char header[FRAME_HEADER];
+        uint32_t magic, length, sum;
+        string body;
+        bool valid = size - offset >= FRAME_HEADER
+                     && readFully(segment.fd, header, FRAME_HEADER, offset);
+        if (valid) {
+            memcpy(&magic, header, 4);
+            memcpy(&length, header + 4, 4);
+            memcpy(&sum, header + 8, 4);
+            valid = magic == FRAME_MAGIC && length <= size - offset - FRAME_HEADER;
+        }
+        if (valid) {
+            body.resize(length);
+            valid = readFully(segment.fd, &body[0], length, offset + FRAME_HEADER)
+                    && checksum(body.data(), length) == sum;
+        }
+        if (!valid) {
+            if (!last)
+                throw Exception("Segment '" + segmentPath(id) + "' is corrupted.",
+                                TracePoint("LogDBEngine"));
+            // frame was cut by a crash, it was never committed
+            if (ftruncate(segment.fd, offset) != 0)
+                throw Exception("Can't truncate '" + segmentPath(id) + "'.",
+                                TracePoint("LogDBEngine"));
+            break;
+        }
+        size_t pos = 0;
+        while (pos < body.size()) {
+            LogReader reader(body, pos);
+            Location location;
+            location.segment = id;
+            location.offset = offset + FRAME_HEADER + pos;
+            location.length = reader.u32() + 4;
+            if (location.length > body.size() - pos)
+                throw Exception("Segment '" + segmentPath(id) + "' is corrupted.",
+                                TracePoint("LogDBEngine"));
+            replayRecord(body.substr(pos, location.length), location);
+            pos += location.length;
+        }
+        offset += FRAME_HEADER + length;
+    }
+    segment.size = offset;
+}
+
+void LogDBEngine::replayRecord(const string &record, const Location &location)
+{
+    LogReader reader(record, 4);
+    unsigned char type = reader.u8();
+    if (type == RECORD_RESET) {
+        tables.clear();
+        return;
+    }
+    string pname = reader.str();
+    if (type == RECORD_CREATE) {
+        Table &t = tables[pname];
+        t = Table();
+        t.name = pname;
+        t.parentName = reader.str();
+        unsigned int ncolumns = reader.u32();
+        for (unsigned int i = 0; i < ncolumns; i++) {
+            t.columns.push_back(reader.str());
+            t.columnTypes.push_back((DBFieldTypes)reader.u8());
+        }
+        t.location = location;
+        return;
+    }
+    if (type == RECORD_DROP) {
+        tables.erase(pname);
+        return;
+    }
+    std::map<string, Table>::iterator iter = tables.find(pname);
+    if (iter == tables.end())
+        return;
+    string pkey = reader.str(), parentKey = reader.str();
+    if (type == RECORD_PUT) {
+        indexRow(iter->second, pkey, parentKey, location);
+        if (!pkey.empty() && pkey[0] == '\1')
+            anonymousSeq = std::max(anonymousSeq, strtoull(pkey.c_str() + 1, NULL, 10));
+    } else if (type == RECORD_DELETE)
+        unindexRow(iter->second, rowKey(pkey, parentKey));
+    else
+        throw Exception("Corrupted log record.", TracePoint("LogDBEngine"));
+}
+
+void LogDBEngine::recover()
+{
+    tables.clear();
+    segments.clear();
+    anonymousSeq = 0;
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL)
+        throw Exception("Can't open directory '" + directory + "'.", TracePoint("LogDBEngine"));
+    vector<unsigned int> ids;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0)
+            // unfinished compaction
+            unlink((directory + "/" + name).c_str());
+        else if (name.size() == 12 && name.compare(8, 4, ".seg") == 0)
+            ids.push_back(strtoul(name.c_str(), NULL, 10));
+    }
+    closedir(dir);
+    std::sort(ids.begin(), ids.end());
+    for (unsigned int i = 0; i < ids.size(); i++) {
+        string path = segmentPath(ids[i]);
+        int fd = open(path.c_str(), O_RDWR);
+        if (fd < 0)
+            throw Exception("Can't open '" + path + "'.", TracePoint("LogDBEngine"));
+        segments[ids[i]].fd = fd;
+    }
+    if (ids.empty()) {
+        activeSegment = 0;
+        rollSegment();
+        unlink((directory + "/" + CHECKPOINT_FILE).c_str());
+        return;
+    }
+    activeSegment = ids.back();
+
+    bool loaded = loadCheckpoint();
+    // checkpoint is stale after next write
+    unlink((directory + "/" + CHECKPOINT_FILE).c_str());
+    if (!loaded) {
+        tables.clear();
+        anonymousSeq = 0;
+        for (unsigned int i = 0; i < ids.size(); i++)
+            replaySegment(ids[i], 0, i + 1 == ids.size());
+    }
+    recount();
+}
+
+/* Checkpoint file is CHECKPOINT_MAGIC and a body in record encoding:
+ *   segments (id, size), anonymousSeq, tables (schema, location, rows)
+ * followed by checksum of body.
+ */
+static void putLocation(string &buff, unsigned int segment, unsigned long long offset,
+                        unsigned int length)
+{
+    putU32(buff, segment);
+    putU64(buff, offset);
+    putU32(buff, length);
+}
+
+void LogDBEngine::writeCheckpoint()
+{
+    string body;
+    putU32(body, segments.size());
+    for (auto iter = segments.begin(); iter != segments.end(); ++iter) {
+        putU32(body, iter->first);
+        putU64(body, iter->second.size);
+    }
+    putU64(body, anonymousSeq);
+    putU32(body, tables.size());
+    for (auto iter = tables.begin(); iter != tables.end(); ++iter) {
+        const Table &t = iter->second;
+        putString(body, t.name);
+        putString(body, t.parentName);
+        putU32(body, t.columns.size());
+        for (unsigned int i = 0; i < t.columns.size(); i++) {
+            putString(body, t.columns[i]);
+            body += (char)t.columnTypes[i];
+        }
+        putLocation(body, t.location.segment, t.location.offset, t.location.length);
+        // rows in insertion order, so loading keeps order of children
+        vector<const Row *> rows;
+        for (auto riter = t.rows.begin(); riter != t.rows.end(); ++riter)
+            rows.push_back(&riter->second);
+        std::sort(rows.begin(), rows.end(),
+                  [](const Row *a, const Row *b) { return a->seq < b->seq; });
+        putU32(body, rows.size());
+        for (unsigned int i = 0; i < rows.size(); i++) {
+            putString(body, rows[i]->pkey);
+            putString(body, rows[i]->parentKey);
+            putLocation(body, rows[i]->location.segment, rows[i]->location.offset,
+                        rows[i]->location.length);
+        }
+    }
+    string data = CHECKPOINT_MAGIC + body;
+    putU32(data, checksum(body.data(), body.size()));
+
+    string path = directory + "/" + CHECKPOINT_FILE, tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw Exception("Can't create '" + tmp + "'.", TracePoint("LogDBEngine"));
+    bool written = writeFully(fd, data.data(), data.size(), 0) && fsync(fd) == 0;
+    close(fd);
+    if (!written || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        throw Exception("Can't write '" + path + "'.", TracePoint("LogDBEngine"));
+    }
+}
+
+bool LogDBEngine::loadCheckpoint()
+{
+    string path = directory + "/" + CHECKPOINT_FILE;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    string data;
+    bool valid = fstat(fd, &st) == 0;
+    if (valid) {
+        data.resize(st.st_size);
+        valid = readFully(fd, &data[0], data.size(), 0);
+    }
+    close(fd);
+    string magic = CHECKPOINT_MAGIC;
+    if (!valid || data.size() < magic.size() + 4 || data.compare(0, magic.size(), magic) != 0)
+        return false;
+    string body = data.substr(magic.size(), data.size() - magic.size() - 4);
+    uint32_t sum;
+    memcpy(&sum, data.data() + data.size() - 4, 4);
+    if (checksum(body.data(), body.size()) != sum)
+        return false;
+
+    try {
+        LogReader reader(body);
+        // segments must be the ones checkpoint was written for
+        std::map<unsigned int, unsigned long long> sizes;
+        unsigned int nsegments = reader.u32();
+        for (unsigned int i = 0; i < nsegments; i++) {
+            unsigned int id = reader.u32();
+            sizes[id] = reader.u64();
+        }
+        if (sizes.size() != segments.size())
+            return false;
+        for (auto iter = segments.begin(); iter != segments.end(); ++iter) {
+            if (!sizes.count(iter->first) || fstat(iter->second.fd, &st) != 0
+                || (unsigned long long)st.st_size < sizes[iter->first])
+                return false;
+        }
+        anonymousSeq = reader.u64();
+        unsigned int ntables = reader.u32();
+        for (unsigned int i = 0; i < ntables; i++) {
+            string pname = reader.str();
+            Table &t = tables[pname];
+            t.name = pname;
+            t.parentName = reader.str();
+            unsigned int ncolumns = reader.u32();
+            for (unsigned int j = 0; j < ncolumns; j++) {
+                t.columns.push_back(reader.str());
+                t.columnTypes.push_back((DBFieldTypes)reader.u8());
+            }
+            t.location.segment = reader.u32();
+            t.location.offset = reader.u64();
+            t.location.length = reader.u32();
+            unsigned int nrows = reader.u32();
+            t.rows.reserve(nrows);
+            for (unsigned int j = 0; j < nrows; j++) {
+                string pkey = reader.str(), parentKey = reader.str();
+                Location location;
+                location.segment = reader.u32();
+                location.offset = reader.u64();
+                location.length = reader.u32();
+                indexRow(t, pkey, parentKey, location);
+            }
+        }
+        if (!reader.atEnd())
+            return false;
+        // replay writes after checkpoint, if any
+        for (auto iter = sizes.begin(); iter != sizes.end(); ++iter)
+            replaySegment(iter->first, iter->second, iter->first == activeSegment);
+    } catch (Exception &e) {
+        tables.clear();
+        return false;
+    }
+    return true;
+}
+
+void LogDBEngine::recount()
+{
+    for (auto iter = segments.begin(); iter != segments.end(); ++iter)
+        iter->second.live = 0;
+    for (auto iter = tables.begin(); iter != tables.end(); ++iter) {
+        addLive(iter->second.location, 1);
+        for (auto riter = iter->second.rows.begin(); riter != iter->second.rows.end(); ++riter)
+            addLive(riter->second.location, 1);
+    }
+}
+
+void LogDBEngine::takeImage(Image &image)
+{
+    for (auto iter = tables.begin(); iter != tables.end(); ++iter) {
+        const Table &t = iter->second;
+        Table schema;
+        schema.name = t.name;
+        schema.parentName = t.parentName;
+        schema.columns = t.columns;
+        schema.columnTypes = t.columnTypes;
+        schema.location = t.location;
+        image.tables.push_back(std::move(schema));
+
+        // rows in insertion order, so children keep their order
+        std::map<unsigned long long, std::pair<string, Location> > ordered;
+        for (auto riter = t.rows.begin(); riter != t.rows.end(); ++riter)
+            ordered[riter->second.seq] = std::make_pair(riter->first, riter->second.location);
+        vector<std::pair<string, Location> > rows;
+        rows.reserve(ordered.size());
+        for (auto oiter = ordered.begin(); oiter != ordered.end(); ++oiter)
+            rows.push_back(std::move(oiter->second));
+        image.rows.push_back(std::move(rows));
+    }
+    for (auto iter = segments.begin(); iter != segments.end(); ++iter)
+        image.fds[iter->first] = iter->second.fd;
+}
+
+unsigned long long LogDBEngine::writeImage(int fd, unsigned int segment, const Image &image,
+                                           vector<Location> &tableLocations,
+                                           vector<vector<Location> > &locations)
+{
+    Frame frame;
+    frame.segment = segment;
+    frame.base = FRAME_HEADER;
+    unsigned long long size = 0;
+    auto flush = [&]() {
+        string data;
+        putU32(data, FRAME_MAGIC);
+        putU32(data, frame.body.size());
+        putU32(data, checksum(frame.body.data(), frame.body.size()));
+        data += frame.body;
+        if (!writeFully(fd, data.data(), data.size(), size))
+            throw Exception("Can't write log segment.", TracePoint("LogDBEngine"));
+        size += data.size();
+        frame.body.clear();
+        frame.base = size + FRAME_HEADER;
+    };
+
+    append(frame, string(1, (char)RECORD_RESET));
+    for (unsigned int i = 0; i < image.tables.size(); i++) {
+        const Table &t = image.tables[i];
+        string record(1, (char)RECORD_CREATE);
+        putString(record, t.name);
+        putString(record, t.parentName);
+        putU32(record, t.columns.size());
+        for (unsigned int j = 0; j < t.columns.size(); j++) {
+            putString(record, t.columns[j]);
+            record += (char)t.columnTypes[j];
+        }
+        tableLocations.push_back(append(frame, record));
+    }
+    flush();
+
+    for (unsigned int i = 0; i < image.rows.size(); i++) {
+        locations.push_back(vector<Location>());
+        for (unsigned int j = 0; j < image.rows[i].size(); j++) {
+            const Location &old = image.rows[i][j].second;
+            std::map<unsigned int, int>::const_iterator iter = image.fds.find(old.segment);
+            string record(old.length, '\0');
+            if (iter == image.fds.end()
+                || !readFully(iter->second, &record[0], record.size(), old.offset))
+                throw Exception("Can't read log record.", TracePoint("LogDBEngine"));
+            // records are copied as they are, without their length
+            locations[i].push_back(append(frame, record.substr(4)));
+            if (frame.body.size() >= IMAGE_FRAME_SIZE)
+                flush();
+        }
+    }
+    if (!frame.body.empty())
+        flush();
+    if (fsync(fd) != 0)
+        throw Exception("Can't write log segment.", TracePoint("LogDBEngine"));
+    return size;
+}
+
+void LogDBEngine::compactor()
+{
+    std::unique_lock<std::mutex> guard(compactorLock);
+    while (!stopCompactor) {
+        compactorCond.wait_for(guard, std::chrono::seconds(1));
+        if (stopCompactor)
+            break;
+        guard.unlock();
+        try {
+            unsigned long long sealed = 0;
+            {
+                ScopedLock lguard(&lock, false);
+                for (auto iter = segments.begin(); iter != segments.end(); ++iter)
+                    if (iter->first != activeSegment)
+                        sealed += iter->second.size;
+            }
+            if (sealed >= segmentSize && garbageRatio() > compactRatio)
+                compact();
+        } catch (Exception &e) {
+            // try again later
+        }
+        guard.lock();
+    }
+}
+
+} // namespace pparam
+// end namespace pparam
@@ -0,0 +1,454 @@
+#include "xdbmemory.hpp"
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <stdio.h>
+#include <sys/stat.h>
+
+using std::stringstream;
+
+namespace pparam
+{
+// implementation of MemoryDBEngine
+
+MemoryDBEngine::MemoryDBEngine() :
+    XDBBufferedEngine("MemoryDBEngine"), isconnected(false), anonymousSeq(0)
+{
+}
+
+MemoryDBEngine::~MemoryDBEngine() { stopExecutor(); }
+
+void MemoryDBEngine::connect(string connectionString)
+{
+    fileName = (connectionString == ":memory:") ? "" : connectionString;
+    struct stat st;
+    if (!fileName.empty() && stat(fileName.c_str(), &st) == 0) {
+        ScopedLock guard(&lock, true);
+        tables.clear();
+        loadSnapshot(fileName);
+    }
+    isconnected = true;
+}
+
+void MemoryDBEngine::disconnect()
+{
+    if (isOnTransaction())
+        rollbackTransaction();
+    ScopedLock guard(&lock, true);
+    if (!fileName.empty())
+        writeSnapshot(fileName);
+    tables.clear();
+    isconnected = false;
+}
+
+void MemoryDBEngine::execute(string command)
+{
+    throw Exception("MemoryDBEngine doesn't run SQL statements.", TracePoint("MemoryDBEngine"));
+}
+
+void MemoryDBEngine::saveXParam(string pname, string pkey, string parentName, string parentKey,
+                                stringList fields, stringList values)
+{
+    if (fields.size() != values.size())
+        throw Exception("size of 'fields' and 'values' is not equal.",
+                        TracePoint("MemoryDBEngine"));
+
+    perform([=](UndoLog &undo) {
+        Table &t = table(pname);
+        if (t.parentName != parentName)
+            throw Exception("Parent of '" + pname + "' is not '" + parentName + "'.",
+                            TracePoint("MemoryDBEngine"));
+        Row row;
+        row.pkey = pkey;
+        row.parentKey = parentName.empty() ? "" : parentKey;
+        row.values.assign(t.columns.size(), "");
+        for (unsigned int i = 0; i < fields.size(); i++)
+            row.values[columnIndex(t, fields[i])] = values[i];
+        insertRow(pname, row, undo);
+    });
+}
+
+void MemoryDBEngine::saveXParam(string pname, string pkey, stringList fields, stringList values)
+{
+    saveXParam(pname, pkey, "", "", fields, values);
+}
+
+void MemoryDBEngine::updateXParam(string pname, string pkey, string parentName, string parentKey,
+                                  stringList fields, stringList values)
+{
+    if (fields.size() != values.size())
+        throw Exception("size of 'fields' and 'values' is not equal.",
+                        TracePoint("MemoryDBEngine"));
+
+    perform([=](UndoLog &undo) {
+        Table &t = table(pname);
+        vector<int> columns;
+        for (unsigned int i = 0; i < fields.size(); i++)
+            columns.push_back(columnIndex(t, fields[i]));
+        vector<string> keys = findRows(t, pkey, parentName, parentKey);
+        for (unsigned int i = 0; i < keys.size(); i++)
+            for (unsigned int j = 0; j < columns.size(); j++)
+                setValue(pname, keys[i], columns[j], values[j], undo);
+    });
+}
+
+void MemoryDBEngine::updateXParam(string pname, string pkey, stringList fields, stringList values)
+{
+    updateXParam(pname, pkey, "", "", fields, values);
+}
+
+void MemoryDBEngine::removeXParam(string pname, string pkey, string parentName, string parentKey)
+{
+    perform([=](UndoLog &undo) {
+        vector<string> keys = findRows(table(pname), pkey, parentName, parentKey);
+        for (unsigned int i = 0; i < keys.size(); i++)
+            eraseRow(pname, keys[i], undo);
+    });
+}
+
+void MemoryDBEngine::removeXParam(string pname, string pkey)
+{
+    this->removeXParam(pname, pkey, "", "");
+}
+
+void MemoryDBEngine::removeXParamByParent(string pname, string parentName, string parentKey)
+{
+    perform([=](UndoLog &undo) {
+        Table &t = table(pname);
+        if (t.parentName != parentName)
+            throw Exception("Parent of '" + pname + "' is not '" + parentName + "'.",
+                            TracePoint("MemoryDBEngine"));
+        auto iter = t.children.find(parentKey);
+        if (iter == t.children.end())
+            return;
+        std::map<unsigned long long, string> keys = iter->second;
+        for (auto kiter = keys.begin(); kiter != keys.end(); ++kiter)
+            eraseRow(pname, kiter->second, undo);
+    });
+}
+
+void MemoryDBEngine::removeXParamByValue(string pname, string parentName, string parentKey,
+                                         string fieldName, string value)
+{
+    perform([=](UndoLog &undo) {
+        Table &t = table(pname);
+        if (t.parentName != parentName)
+            throw Exception("Parent of '" + pname + "' is not '" + parentName + "'.",
+                            TracePoint("MemoryDBEngine"));
+        int column = columnIndex(t, fieldName);
+        auto iter = t.children.find(parentKey);
+        if (iter == t.children.end())
+            return;
+        vector<string> keys;
+        for (auto kiter = iter->second.begin(); kiter != iter->second.end(); ++kiter)
+            if (t.rows.find(kiter->second)->second.values[column] == value)
+                keys.push_back(kiter->second);
+        for (unsigned int i = 0; i < keys.size(); i++)
+            eraseRow(pname, keys[i], undo);
+    });
+}
+
+void MemoryDBEngine::createXParamStructure(string pname, string parentName, stringList fields,
+                                           vector<DBFieldTypes> fieldTypes)
+{
+    if (fields.size() != fieldTypes.size())
+        throw Exception("size of 'fields' and 'datatypes' list is not equal.",
+                        TracePoint("MemoryDBEngine"));
+
+    perform([=](UndoLog &undo) {
+        if (tables.count(pname))
+            return;
+        Table &t = tables[pname];
+        t.name = pname;
+        t.parentName = parentName;
+        t.columns = fields;
+        t.columnTypes = fieldTypes;
+        undo.push_back([this, pname]() { tables.erase(pname); });
+    });
+}
+
+void MemoryDBEngine::createXParamStructure(string pname, stringList fields,
+                                           vector<DBFieldTypes> fieldTypes)
+{
+    this->createXParamStructure(pname, "", fields, fieldTypes);
+}
+
+void MemoryDBEngine::destroyXParamStructure(string pname)
+{
+    perform([=](UndoLog &undo) {
+        std::map<string, Table>::iterator iter = tables.find(pname);
+        if (iter == tables.end())
+            return;
+        std::shared_ptr<Table> saved = std::make_shared<Table>(std::move(iter->second));
+        tables.erase(iter);
+        undo.push_back([this, pname, saved]() { tables[pname] = std::move(*saved); });
+    });
+}
+
+void MemoryDBEngine::createXParamIndex(string pname, stringList fields, bool unique)
+{
+    /* Rows are hashed by key and by parent key, that's all lookups we
+     * have; just check that index is meaningful.
+     */
+    perform([=](UndoLog &undo) {
+        Table &t = table(pname);
+        for (unsigned int i = 0; i < fields.size(); i++)
+            columnIndex(t, fields[i], true);
+    });
+}
+
+int MemoryDBEngine::loadXParamRow(string pname, string pkey, string parentName, string parentKey,
+                                  stringList &fields, stringList &values)
+{
+    ScopedLock guard(&lock, false);
+    fields.clear();
+    values.clear();
+    Table &t = table(pname);
+    vector<string> keys = findRows(t, pkey, parentName, parentKey);
+    if (keys.empty())
+        return 0;
+    fields = t.columns;
+    values = t.rows.find(keys[0])->second.values;
+    return 1;
+}
+
+int MemoryDBEngine::loadXParamRow(string pname, string pkey, stringList &fields,
+                                  stringList &values)
+{
+    return this->loadXParamRow(pname, pkey, "", "", fields, values);
+}
+
+int MemoryDBEngine::loadXParamValueListByParent(string pname, string parentName, string parentKey,
+                                                string fieldName, stringList &values)
+{
+    ScopedLock guard(&lock, false);
+    values.clear();
+    Table &t = table(pname);
+    if (t.parentName != parentName)
+        throw Exception("Parent of '" + pname + "' is not '" + parentName + "'.",
+                        TracePoint("MemoryDBEngine"));
+    int column = columnIndex(t, fieldName, true);
+    auto iter = t.children.find(parentKey);
+    if (iter == t.children.end())
+        return 0;
+    for (auto kiter = iter->second.begin(); kiter != iter->second.end(); ++kiter) {
+        const Row &row = t.rows.find(kiter->second)->second;
+        if (column == KEY_COLUMN)
+            values.push_back(row.pkey);
+        else if (column == PARENT_KEY_COLUMN)
+            values.push_back(row.parentKey);
+        else
+            values.push_back(row.values[column]);
+    }
+    return values.size();
+}
+
+void MemoryDBEngine::getData(string selectstmt, vector<vector<string> > &results,
+                             vector<string> &columns)
+{
+    throw Exception("MemoryDBEngine doesn't run SQL statements.", TracePoint("MemoryDBEngine"));
+}
+
+bool MemoryDBEngine::backup(string dest)
+{
+    ScopedLock guard(&lock, false);
+    try {
+        writeSnapshot(dest);
+    } catch (Exception &e) {
+        return false;
+    }
+    return true;
+}
+
+void MemoryDBEngine::cleanup()
+{
+    // rebuild hash tables to drop tombstones of removed rows
+    ScopedLock guard(&lock, true);
+    for (auto iter = tables.begin(); iter != tables.end(); ++iter) {
+        XHashMap<string, Row> rows(iter->second.rows);
+        iter->second.rows.swap(rows);
+        XHashMap<string, std::map<unsigned long long, string> > children(iter->second.children);
+        iter->second.children.swap(children);
+    }
+}
+
+void MemoryDBEngine::apply(const vector<Operation> &ops)
+{
+    UndoLog undo;
+    try {
+        for (unsigned int i = 0; i < ops.size(); i++)
+            ops[i](undo);
+    } catch (Exception &e) {
+        for (UndoLog::reverse_iterator iter = undo.rbegin(); iter != undo.rend(); ++iter)
+            (*iter)();
+        countRollback();
+        e.addTracePoint(TracePoint("MemoryDBEngine"));
+        throw e;
+    }
+}
+
+MemoryDBEngine::Table &MemoryDBEngine::table(const string &pname)
+{
+    std::map<string, Table>::iterator iter = tables.find(pname);
+    if (iter == tables.end())
+        throw Exception("no such table: " + pname, TracePoint("MemoryDBEngine"));
+    return iter->second;
+}
+
+void MemoryDBEngine::insertRow(const string &pname, Row row, UndoLog &undo)
+{
+    Table &t = table(pname);
+    string key;
+    if (row.pkey.empty()) {
+        // rows without key (single members of sets) are never addressed by key
+        stringstream buff;
+        buff << '\1' << ++anonymousSeq;
+        key = rowKey(buff.str(), row.parentKey);
+    } else {
+        key = rowKey(row.pkey, row.parentKey);
+        if (t.rows.count(key))
+            throw Exception("UNIQUE constraint failed: " + pname, TracePoint("MemoryDBEngine"));
+    }
+    row.seq = ++t.seq;
+    t.children[row.parentKey][row.seq] = key;
+    t.rows.emplace(key, std::move(row));
+    undo.push_back([this, pname, key]() {
+        UndoLog ignore;
+        eraseRow(pname, key, ignore);
+    });
+}
+
+void MemoryDBEngine::eraseRow(const string &pname, const string &key, UndoLog &undo)
+{
+    Table &t = table(pname);
+    auto iter = t.rows.find(key);
+    if (iter == t.rows.end())
+        return;
+    std::shared_ptr<Row> saved = std::make_shared<Row>(std::move(iter->second));
+    t.rows.erase(iter);
+    auto citer = t.children.find(saved->parentKey);
+    citer->second.erase(saved->seq);
+    if (citer->second.empty())
+        t.children.erase(citer);
+    undo.push_back([this, pname, key, saved]() {
+        Table &t = table(pname);
+        t.children[saved->parentKey][saved->seq] = key;
+        t.rows.emplace(key, *saved);
+    });
+}
+
+void MemoryDBEngine::setValue(const string &pname, const string &key, int column,
+                              const string &value, UndoLog &undo)
+{
+    string &cell = table(pname).rows.find(key)->second.values[column];
+    string old = cell;
+    cell = value;
+    undo.push_back([this, pname, key, column, old]() {
+        table(pname).rows.find(key)->second.values[column] = old;
+    });
+}
+
+/* Snapshot file is a sequence of tokens, strings are written as
+ * "<length>:<bytes>" and numbers as "<number> ", so any byte is allowed
+ * in names and values.
+ */
+static const char *SNAPSHOT_MAGIC = "pparam-memdb 1\n";
+
+static void writeString(std::ostream &out, const string &str)
+{
+    out << str.size() << ':' << str;
+}
+
+static string readString(std::istream &in)
+{
+    size_t size;
+    char sep;
+    if (!(in >> size) || !in.get(sep) || sep != ':')
+        throw Exception("Bad snapshot file.", TracePoint("MemoryDBEngine"));
+    string str(size, '\0');
+    if (size && !in.read(&str[0], size))
+        throw Exception("Bad snapshot file.", TracePoint("MemoryDBEngine"));
+    return str;
+}
+
+static size_t readNumber(std::istream &in)
+{
+    size_t num;
+    if (!(in >> num))
+        throw Exception("Bad snapshot file.", TracePoint("MemoryDBEngine"));
+    return num;
+}
+
+void MemoryDBEngine::writeSnapshot(const string &dest)
+{
+    string tmp = dest + ".tmp";
+    {
+        std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+        out << SNAPSHOT_MAGIC << tables.size() << ' ';
+        for (auto iter = tables.begin(); iter != tables.end(); ++iter) {
+            const Table &t = iter->second;
+            writeString(out, iter->first);
+            writeString(out, t.parentName);
+            out << t.columns.size() << ' ';
+            for (unsigned int i = 0; i < t.columns.size(); i++) {
+                writeString(out, t.columns[i]);
+                out << t.columnTypes[i] << ' ';
+            }
+            // rows in insertion order, so loading keeps order of children
+            vector<const Row *> rows;
+            for (auto riter = t.rows.begin(); riter != t.rows.end(); ++riter)
+                rows.push_back(&riter->second);
+            std::sort(rows.begin(), rows.end(),
+                      [](const Row *a, const Row *b) { return a->seq < b->seq; });
+            out << rows.size() << ' ';
+            for (unsigned int i = 0; i < rows.size(); i++) {
+                writeString(out, rows[i]->pkey);
+                writeString(out, rows[i]->parentKey);
+                for (unsigned int j = 0; j < rows[i]->values.size(); j++)
+                    writeString(out, rows[i]->values[j]);
+            }
+        }
+        out.flush();
+        if (!out)
+            throw Exception("Can't write snapshot to '" + tmp + "'.",
+                            TracePoint("MemoryDBEngine"));
+    }
+    if (rename(tmp.c_str(), dest.c_str()) != 0)
+        throw Exception("Can't write snapshot to '" + dest + "'.", TracePoint("MemoryDBEngine"));
+}
+
+void MemoryDBEngine::loadSnapshot(const string &src)
+{
+    std::ifstream in(src.c_str(), std::ios::binary);
+    string magic(SNAPSHOT_MAGIC);
+    string header(magic.size(), '\0');
+    if (!in.read(&header[0], header.size()) || header != magic)
+        throw Exception("'" + src + "' is not a snapshot file.", TracePoint("MemoryDBEngine"));
+
+    UndoLog ignore;
+    size_t ntables = readNumber(in);
+    for (size_t i = 0; i < ntables; i++) {
+        string pname = readString(in);
+        Table &t = tables[pname];
+        t.name = pname;
+        t.parentName = readString(in);
+        size_t ncolumns = readNumber(in);
+        for (size_t j = 0; j < ncolumns; j++) {
+            t.columns.push_back(readString(in));
+            t.columnTypes.push_back((DBFieldTypes)readNumber(in));
+        }
+        size_t nrows = readNumber(in);
+        t.rows.reserve(nrows);
+        for (size_t j = 0; j < nrows; j++) {
+            Row row;
+            row.pkey = readString(in);
+            row.parentKey = readString(in);
+            for (size_t k = 0; k < ncolumns; k++)
+                row.values.push_back(readString(in));
+            insertRow(pname, row, ignore);
+        }
+    }
+}
+
+} // namespace pparam
+// end namespace pparam
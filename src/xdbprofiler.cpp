@@ -0,0 +1,524 @@
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+#include "xdbprofiler.hpp"
+
+namespace pparam
+{
+// implementation of XDBLatencyHistogram
+
+XDBLatencyHistogram::XDBLatencyHistogram() { reset(); }
+
+int XDBLatencyHistogram::bucketOf(unsigned long long value)
+{
+    if (value < SUB_BUCKETS)
+        return (int)value;
+    int exp = 63 - __builtin_clzll(value);
+    return (exp - 3) * SUB_BUCKETS + (int)((value >> (exp - 4)) & (SUB_BUCKETS - 1));
+}
+
+unsigned long long XDBLatencyHistogram::lowerBound(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    int exp = bucket / SUB_BUCKETS + 3;
+    return (unsigned long long)(SUB_BUCKETS + bucket % SUB_BUCKETS) << (exp - 4);
+}
+
+void XDBLatencyHistogram::record(unsigned long long value)
+{
+    counts[bucketOf(value)]++;
+    if (total == 0 || value < minValue)
+        minValue = value;
+    if (value > maxValue)
+        maxValue = value;
+    total++;
+    sum += value;
+}
+
+void XDBLatencyHistogram::merge(const XDBLatencyHistogram &histogram)
+{
+    if (histogram.total == 0)
+        return;
+    for (int i = 0; i < BUCKETS; i++)
+        counts[i] += histogram.counts[i];
+    if (total == 0 || histogram.minValue < minValue)
+        minValue = histogram.minValue;
+    if (histogram.maxValue > maxValue)
+        maxValue = histogram.maxValue;
+    total += histogram.total;
+    sum += histogram.sum;
+}
+
+void XDBLatencyHistogram::reset()
+{
+    memset(counts, 0, sizeof(counts));
+    total = sum = minValue = maxValue = 0;
+}
+
+unsigned long long XDBLatencyHistogram::percentile(double percent) const
+{
+    if (total == 0)
+        return 0;
+    unsigned long long rank = (unsigned long long)(percent / 100 * total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > total)
+        rank = total;
+    unsigned long long seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            // highest value of bucket, but not beyond recorded values
+            unsigned long long value = (i + 1 < BUCKETS) ? lowerBound(i + 1) - 1 : maxValue;
+            if (value > maxValue)
+                value = maxValue;
+            if (value < minValue)
+                value = minValue;
+            return value;
+        }
+    }
+    return maxValue;
+}
+
+// implementation of XDBProfiler
+
+const string XDBProfiler::operationString[XDBProfiler::MAX_OPERATION] = {
+    "save", "update", "remove", "load_row", "load_by_parent", "get_data", "execute", "commit"};
+
+XDBProfiler::XDBProfiler(XDBEngine *_engine, bool _enabled) :
+    engine(_engine), enabled(_enabled), slowThreshold(0), slowLogSize(100)
+{
+}
+
+XDBProfiler::~XDBProfiler() { stopExecutor(); }
+
+unsigned long long XDBProfiler::bytesOf(const stringList &values)
+{
+    unsigned long long bytes = 0;
+    for (const string &value : values)
+        bytes += value.size();
+    return bytes;
+}
+
+void XDBProfiler::measure(Operation operation, const string &table, const string &detail,
+                          const std::function<void(Volume &)> &run)
+{
+    Volume volume;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        run(volume);
+    } catch (...) {
+        record(operation, table, detail, std::chrono::steady_clock::now() - start, volume, true);
+        throw;
+    }
+    record(operation, table, detail, std::chrono::steady_clock::now() - start, volume, false);
+}
+
+void XDBProfiler::record(Operation operation, const string &table, const string &detail,
+                         std::chrono::nanoseconds latency, const Volume &volume, bool failed)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    XDBOperationStats &stats = counters[std::make_pair((int)operation, table)];
+    if (stats.count == 0) {
+        stats.operation = operationString[operation];
+        stats.table = table;
+    }
+    stats.count++;
+    if (failed)
+        stats.errors++;
+    stats.rows += volume.rows;
+    stats.bytes += volume.bytes;
+    stats.latency.record(latency.count());
+
+    if (slowThreshold.count() <= 0 || latency < slowThreshold)
+        return;
+    XDBSlowQuery query;
+    query.time = std::chrono::system_clock::now();
+    query.operation = operationString[operation];
+    query.table = table;
+    query.detail = detail;
+    query.latency = latency;
+    query.failed = failed;
+    slowLog.push_back(query);
+    while (slowLog.size() > slowLogSize)
+        slowLog.pop_front();
+}
+
+void XDBProfiler::execute(string command)
+{
+    if (!enabled)
+        return engine->execute(command);
+    measure(EXECUTE, "", command, [&](Volume &) { engine->execute(command); });
+}
+
+void XDBProfiler::commitTransaction()
+{
+    if (!enabled)
+        return engine->commitTransaction();
+    measure(COMMIT, "", "", [&](Volume &) { engine->commitTransaction(); });
+}
+
+void XDBProfiler::endBatch(bool commit)
+{
+    if (!enabled || !commit)
+        return engine->endBatch(commit);
+    measure(COMMIT, "", "batch", [&](Volume &) { engine->endBatch(commit); });
+}
+
+void XDBProfiler::saveXParam(string pname, string pkey, string parentName, string parentKey,
+                             stringList fields, stringList values)
+{
+    if (!enabled)
+        return engine->saveXParam(pname, pkey, parentName, parentKey, fields, values);
+    measure(SAVE, pname, pkey, [&](Volume &volume) {
+        engine->saveXParam(pname, pkey, parentName, parentKey, fields, values);
+        volume.rows = 1;
+        volume.bytes = bytesOf(values);
+    });
+}
+
+void XDBProfiler::saveXParam(string pname, string pkey, stringList fields, stringList values)
+{
+    if (!enabled)
+        return engine->saveXParam(pname, pkey, fields, values);
+    measure(SAVE, pname, pkey, [&](Volume &volume) {
+        engine->saveXParam(pname, pkey, fields, values);
+        volume.rows = 1;
+        volume.bytes = bytesOf(values);
+    });
+}
+
+void XDBProfiler::updateXParam(string pname, string pkey, string parentName, string parentKey,
+                               stringList fields, stringList values)
+{
+    if (!enabled)
+        return engine->updateXParam(pname, pkey, parentName, parentKey, fields, values);
+    measure(UPDATE, pname, pkey, [&](Volume &volume) {
+        engine->updateXParam(pname, pkey, parentName, parentKey, fields, values);
+        volume.rows = 1;
+        volume.bytes = bytesOf(values);
+    });
+}
+
+void XDBProfiler::updateXParam(string pname, string pkey, stringList fields, stringList values)
+{
+    if (!enabled)
+        return engine->updateXParam(pname, pkey, fields, values);
+    measure(UPDATE, pname, pkey, [&](Volume &volume) {
+        engine->updateXParam(pname, pkey, fields, values);
+        volume.rows = 1;
+        volume.bytes = bytesOf(values);
+    });
+}
+
+void XDBProfiler::removeXParam(string pname, string pkey, string parentName, string parentKey)
+{
+    if (!enabled)
+        return engine->removeXParam(pname, pkey, parentName, parentKey);
+    measure(REMOVE, pname, pkey, [&](Volume &volume) {
+        engine->removeXParam(pname, pkey, parentName, parentKey);
+        volume.rows = 1;
+    });
+}
+
+void XDBProfiler::removeXParam(string pname, string pkey)
+{
+    if (!enabled)
+        return engine->removeXParam(pname, pkey);
+    measure(REMOVE, pname, pkey, [&](Volume &volume) {
+        engine->removeXParam(pname, pkey);
+        volume.rows = 1;
+    });
+}
+
+void XDBProfiler::removeXParamByParent(string pname, string parentName, string parentKey)
+{
+    if (!enabled)
+        return engine->removeXParamByParent(pname, parentName, parentKey);
+    measure(REMOVE, pname, parentName + "=" + parentKey,
+            [&](Volume &) { engine->removeXParamByParent(pname, parentName, parentKey); });
+}
+
+void XDBProfiler::removeXParamByValue(string pname, string parentName, string parentKey,
+                                      string fieldName, string value)
+{
+    if (!enabled)
+        return engine->removeXParamByValue(pname, parentName, parentKey, fieldName, value);
+    measure(REMOVE, pname, fieldName + "=" + value, [&](Volume &) {
+        engine->removeXParamByValue(pname, parentName, parentKey, fieldName, value);
+    });
+}
+
+int XDBProfiler::loadXParamRow(string pname, string pkey, string parentName, string parentKey,
+                               stringList &fields, stringList &values)
+{
+    if (!enabled)
+        return engine->loadXParamRow(pname, pkey, parentName, parentKey, fields, values);
+    int count = 0;
+    measure(LOAD_ROW, pname, pkey, [&](Volume &volume) {
+        count = engine->loadXParamRow(pname, pkey, parentName, parentKey, fields, values);
+        volume.rows = count;
+        volume.bytes = bytesOf(values);
+    });
+    return count;
+}
+
+int XDBProfiler::loadXParamRow(string pname, string pkey, stringList &fields, stringList &values)
+{
+    if (!enabled)
+        return engine->loadXParamRow(pname, pkey, fields, values);
+    int count = 0;
+    measure(LOAD_ROW, pname, pkey, [&](Volume &volume) {
+        count = engine->loadXParamRow(pname, pkey, fields, values);
+        volume.rows = count;
+        volume.bytes = bytesOf(values);
+    });
+    return count;
+}
+
+int XDBProfiler::loadXParamValueListByParent(string pname, string parentName, string parentKey,
+                                             string fieldName, stringList &values)
+{
+    if (!enabled)
+        return engine->loadXParamValueListByParent(pname, parentName, parentKey, fieldName,
+                                                   values);
+    int count = 0;
+    measure(LOAD_BY_PARENT, pname, parentName + "=" + parentKey, [&](Volume &volume) {
+        count = engine->loadXParamValueListByParent(pname, parentName, parentKey, fieldName,
+                                                    values);
+        volume.rows = count;
+        volume.bytes = bytesOf(values);
+    });
+    return count;
+}
+
+void XDBProfiler::getData(string selectstmt, vector<vector<string> > &results,
+                          vector<string> &columns)
+{
+    if (!enabled)
+        return engine->getData(selectstmt, results, columns);
+    measure(GET_DATA, "", selectstmt, [&](Volume &volume) {
+        engine->getData(selectstmt, results, columns);
+        volume.rows = results.size();
+        for (const vector<string> &row : results)
+            volume.bytes += bytesOf(row);
+    });
+}
+
+void XDBProfiler::getData(string selectstmt, const stringList &params,
+                          vector<vector<string> > &results, vector<string> &columns)
+{
+    if (!enabled)
+        return engine->getData(selectstmt, params, results, columns);
+    measure(GET_DATA, "", selectstmt, [&](Volume &volume) {
+        engine->getData(selectstmt, params, results, columns);
+        volume.rows = results.size();
+        for (const vector<string> &row : results)
+            volume.bytes += bytesOf(row);
+    });
+}
+
+void XDBProfiler::query(string selectstmt, const stringList &params, XDBRowVisitor &visitor)
+{
+    if (!enabled)
+        return engine->query(selectstmt, params, visitor);
+    measure(GET_DATA, "", selectstmt, [&](Volume &volume) {
+        XDBRowFunction counter([&](const XDBRow &row) {
+            volume.rows++;
+            for (int i = 0; i < row.size(); i++)
+                volume.bytes += row.length(i);
+            return visitor.visit(row);
+        });
+        engine->query(selectstmt, params, counter);
+    });
+}
+
+void XDBProfiler::setSlowThreshold(std::chrono::nanoseconds threshold, size_t logSize)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    slowThreshold = threshold;
+    slowLogSize = logSize;
+    while (slowLog.size() > slowLogSize)
+        slowLog.pop_front();
+}
+
+vector<XDBOperationStats> XDBProfiler::stats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    vector<XDBOperationStats> result;
+    for (auto &counter : counters)
+        result.push_back(counter.second);
+    return result;
+}
+
+XDBOperationStats XDBProfiler::total(Operation operation)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    XDBOperationStats result;
+    result.operation = operationString[operation];
+    for (auto &counter : counters) {
+        if (counter.first.first != operation)
+            continue;
+        const XDBOperationStats &stats = counter.second;
+        result.count += stats.count;
+        result.errors += stats.errors;
+        result.rows += stats.rows;
+        result.bytes += stats.bytes;
+        result.latency.merge(stats.latency);
+    }
+    return result;
+}
+
+vector<XDBSlowQuery> XDBProfiler::slowQueries()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return vector<XDBSlowQuery>(slowLog.begin(), slowLog.end());
+}
+
+void XDBProfiler::resetStats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    counters.clear();
+    slowLog.clear();
+}
+
+static string formatTime(const std::chrono::system_clock::time_point &time)
+{
+    std::time_t rawtime = std::chrono::system_clock::to_time_t(time);
+    char buffer[30];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", std::localtime(&rawtime));
+    return buffer;
+}
+
+string XDBProfiler::report()
+{
+    vector<XDBOperationStats> operations = stats();
+    vector<XDBSlowQuery> queries = slowQueries();
+    std::ostringstream out;
+
+    out << std::left << std::setw(16) << "operation" << std::setw(20) << "table" << std::right
+        << std::setw(10) << "count" << std::setw(8) << "errors" << std::setw(10) << "rows"
+        << std::setw(12) << "bytes" << std::setw(10) << "mean(us)" << std::setw(10) << "p50"
+        << std::setw(10) << "p90" << std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+    out << std::fixed << std::setprecision(1);
+    for (const XDBOperationStats &stats : operations) {
+        const XDBLatencyHistogram &latency = stats.latency;
+        out << std::left << std::setw(16) << stats.operation << std::setw(20)
+            << (stats.table.empty() ? "-" : stats.table) << std::right << std::setw(10)
+            << stats.count << std::setw(8) << stats.errors << std::setw(10) << stats.rows
+            << std::setw(12) << stats.bytes << std::setw(10) << latency.mean() / 1000
+            << std::setw(10) << latency.percentile(50) / 1000.0 << std::setw(10)
+            << latency.percentile(90) / 1000.0 << std::setw(10)
+            << latency.percentile(99) / 1000.0 << std::setw(10) << latency.max() / 1000.0
+            << "\n";
+    }
+    if (queries.empty())
+        return out.str();
+
+    out << "\nslow queries:\n";
+    for (const XDBSlowQuery &query : queries) {
+        out << formatTime(query.time) << "  " << std::setw(10) << query.latency.count() / 1000.0
+            << " us  " << query.operation;
+        if (!query.table.empty())
+            out << " " << query.table;
+        if (!query.detail.empty())
+            out << " " << query.detail;
+        if (query.failed)
+            out << " (failed)";
+        out << "\n";
+    }
+    return out.str();
+}
+
+void XDBProfiler::snapshot(XDBProfilerParam &param)
+{
+    vector<XDBOperationStats> operations = stats();
+    vector<XDBSlowQuery> queries = slowQueries();
+
+    param.operations.clear();
+    param.slowQueries.clear();
+    for (const XDBOperationStats &stats : operations) {
+        XDBOperationParam operation;
+        operation = stats;
+        param.operations.addT(operation);
+    }
+    for (const XDBSlowQuery &query : queries) {
+        XDBSlowQueryParam slowQuery;
+        slowQuery = query;
+        param.slowQueries.addT(slowQuery);
+    }
+}
+
+// implementation of XDBOperationParam
+
+XDBOperationParam::XDBOperationParam() :
+    XMixParam("operation"), operation("operation"), table("table"), count("count", 0, -1),
+    errors("errors", 0, -1), rows("rows", 0, -1), bytes("bytes", 0, -1), mean("mean", 0, -1),
+    p50("p50", 0, -1), p90("p90", 0, -1), p99("p99", 0, -1), max("max", 0, -1)
+{
+    addParam(&operation);
+    addParam(&table);
+    addParam(&count);
+    addParam(&errors);
+    addParam(&rows);
+    addParam(&bytes);
+    addParam(&mean);
+    addParam(&p50);
+    addParam(&p90);
+    addParam(&p99);
+    addParam(&max);
+}
+
+XDBOperationParam &XDBOperationParam::operator=(const XDBOperationStats &stats)
+{
+    operation = stats.operation;
+    table = stats.table;
+    count = (XULLong)stats.count;
+    errors = (XULLong)stats.errors;
+    rows = (XULLong)stats.rows;
+    bytes = (XULLong)stats.bytes;
+    mean = (XFloat)(stats.latency.mean() / 1000);
+    p50 = (XULLong)(stats.latency.percentile(50) / 1000);
+    p90 = (XULLong)(stats.latency.percentile(90) / 1000);
+    p99 = (XULLong)(stats.latency.percentile(99) / 1000);
+    max = (XULLong)(stats.latency.max() / 1000);
+    return *this;
+}
+
+// implementation of XDBSlowQueryParam
+
+XDBSlowQueryParam::XDBSlowQueryParam() :
+    XMixParam("query"), time("time"), operation("operation"), table("table"),
+    latency("latency", 0, -1), failed("failed", Bool::NO), detail("detail")
+{
+    addParam(&time);
+    addParam(&operation);
+    addParam(&table);
+    addParam(&latency);
+    addParam(&failed);
+    addParam(&detail);
+}
+
+XDBSlowQueryParam &XDBSlowQueryParam::operator=(const XDBSlowQuery &query)
+{
+    time = formatTime(query.time);
+    operation = query.operation;
+    table = query.table;
+    latency = (XULLong)(query.latency.count() / 1000);
+    failed = query.failed;
+    detail = query.detail;
+    return *this;
+}
+
+// implementation of XDBProfilerParam
+
+XDBProfilerParam::XDBProfilerParam(const string &pname) : XMixParam(pname)
+{
+    addParam(&operations);
+    addParam(&slowQueries);
+}
+
+} // namespace pparam
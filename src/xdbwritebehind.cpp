@@ -0,0 +1,582 @@
+#include "xdbwritebehind.hpp"
+#include <chrono>
+#include <exception>
+
+using std::stringstream;
+
+namespace pparam
+{
+// implementation of XDBWriteBehind
+
+// message of a write failed on the writer thread, which must not let any exception escape.
+static string failureOf(std::exception_ptr error)
+{
+    try {
+        std::rethrow_exception(error);
+    } catch (Exception &e) {
+        return e.what();
+    } catch (std::exception &e) {
+        return e.what();
+    } catch (...) {
+        return "Unknown error on writing to database.";
+    }
+}
+
+void XDBWriteBehind::cleanTransaction(void *ptr)
+{
+    // transaction of an exited thread that never committed.
+    delete (Group *)ptr;
+}
+
+XDBWriteBehind::XDBWriteBehind(XDBEngine *_engine, size_t _queueSize, size_t _batchSize,
+                               unsigned int _delay) :
+    engine(_engine),
+    queueSize(_queueSize ? _queueSize : 1), batchSize(_batchSize ? _batchSize : 1), delay(_delay),
+    queuedOps(0), queuedSeq(0), committedSeq(0), flushRequested(false), stopping(false)
+{
+    pthread_key_create(&transactionTSMKey, cleanTransaction);
+    writerThread = std::thread(&XDBWriteBehind::writer, this);
+}
+
+XDBWriteBehind::~XDBWriteBehind()
+{
+    stopExecutor();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    queueCond.notify_all();
+    spaceCond.notify_all();
+    writerThread.join();
+    Group *group = (Group *)pthread_getspecific(transactionTSMKey);
+    delete group;
+    pthread_key_delete(transactionTSMKey);
+}
+
+void XDBWriteBehind::connect(string connectionString) { engine->connect(connectionString); }
+
+void XDBWriteBehind::disconnect()
+{
+    flush();
+    std::lock_guard<std::mutex> guard(engineLock);
+    engine->disconnect();
+}
+
+void XDBWriteBehind::execute(string command)
+{
+    Operation op;
+    op.type = Operation::EXECUTE;
+    op.pkey = command;
+    enqueue(op);
+}
+
+void XDBWriteBehind::startTransaction()
+{
+    Group *group = (Group *)pthread_getspecific(transactionTSMKey);
+    if (group == NULL)
+        pthread_setspecific(transactionTSMKey, new Group);
+    else if (!group->levels.empty())
+        group->levels.push_back(std::make_pair(group->ops.size(), false));
+}
+
+void XDBWriteBehind::commitTransaction()
+{
+    Group *group = (Group *)pthread_getspecific(transactionTSMKey);
+    if (group == NULL)
+        return;
+    if (!group->levels.empty()) {
+        // a batch itself is committed by endBatch()
+        if (!group->levels.back().second)
+            group->levels.pop_back();
+        return;
+    }
+    pthread_setspecific(transactionTSMKey, NULL);
+    if (group->ops.empty()) {
+        delete group;
+        return;
+    }
+    enqueue(group);
+}
+
+void XDBWriteBehind::rollbackTransaction()
+{
+    Group *group = (Group *)pthread_getspecific(transactionTSMKey);
+    if (group != NULL && !group->levels.empty()) {
+        if (!group->levels.back().second) {
+            group->ops.resize(group->levels.back().first);
+            group->levels.pop_back();
+            countRollback();
+        }
+        return;
+    }
+    if (group != NULL)
+        countRollback();
+    pthread_setspecific(transactionTSMKey, NULL);
+    delete group;
+}
+
+void XDBWriteBehind::beginBatch()
+{
+    Group *group = (Group *)pthread_getspecific(transactionTSMKey);
+    if (group == NULL) {
+        group = new Group;
+        pthread_setspecific(transactionTSMKey, group);
+    } else if (group->levels.empty())
+        throw Exception("Batch can't be opened inside a transaction.",
+                        TracePoint("XDBWriteBehind"));
+    group->levels.push_back(std::make_pair(group->ops.size(), true));
+}
+
+void XDBWriteBehind::endBatch(bool commit)
+{
+    Group *group = (Group *)pthread_getspecific(transactionTSMKey);
+    int level = (group == NULL) ? -1 : (int)group->levels.size() - 1;
+    while (level >= 0 && !group->levels[level].second)
+        level--;
+    if (level < 0)
+        throw Exception("No batch is open.", TracePoint("XDBWriteBehind"));
+    if (!commit) {
+        group->ops.resize(group->levels[level].first);
+        countRollback();
+    }
+    group->levels.resize(level);
+    if (level == 0)
+        commitTransaction();
+}
+
+void XDBWriteBehind::saveXParam(string pname, string pkey, string parentName, string parentKey,
+                                stringList fields, stringList values)
+{
+    if (fields.size() != values.size())
+        throw Exception("size of 'fields' and 'values' is not equal.",
+                        TracePoint("XDBWriteBehind"));
+    Operation op;
+    op.type = Operation::SAVE;
+    op.pname = pname;
+    op.pkey = pkey;
+    op.parentName = parentName;
+    op.parentKey = parentKey;
+    op.fields = std::move(fields);
+    op.values = std::move(values);
+    enqueue(op);
+}
+
+void XDBWriteBehind::saveXParam(string pname, string pkey, stringList fields, stringList values)
+{
+    saveXParam(pname, pkey, "", "", fields, values);
+}
+
+void XDBWriteBehind::updateXParam(string pname, string pkey, string parentName, string parentKey,
+                                  stringList fields, stringList values)
+{
+    if (fields.size() != values.size())
+        throw Exception("size of 'fields' and 'values' is not equal.",
+                        TracePoint("XDBWriteBehind"));
+    Operation op;
+    op.type = Operation::UPDATE;
+    op.pname = pname;
+    op.pkey = pkey;
+    op.parentName = parentName;
+    op.parentKey = parentKey;
+    op.fields = std::move(fields);
+    op.values = std::move(values);
+    enqueue(op);
+}
+
+void XDBWriteBehind::updateXParam(string pname, string pkey, stringList fields, stringList values)
+{
+    updateXParam(pname, pkey, "", "", fields, values);
+}
+
+void XDBWriteBehind::removeXParam(string pname, string pkey, string parentName, string parentKey)
+{
+    Operation op;
+    op.type = Operation::REMOVE;
+    op.pname = pname;
+    op.pkey = pkey;
+    op.parentName = parentName;
+    op.parentKey = parentKey;
+    enqueue(op);
+}
+
+void XDBWriteBehind::removeXParam(string pname, string pkey) { removeXParam(pname, pkey, "", ""); }
+
+void XDBWriteBehind::removeXParamByParent(string pname, string parentName, string parentKey)
+{
+    Operation op;
+    op.type = Operation::REMOVE_BY_PARENT;
+    op.pname = pname;
+    op.parentName = parentName;
+    op.parentKey = parentKey;
+    enqueue(op);
+}
+
+void XDBWriteBehind::removeXParamByValue(string pname, string parentName, string parentKey,
+                                         string fieldName, string value)
+{
+    Operation op;
+    op.type = Operation::REMOVE_BY_VALUE;
+    op.pname = pname;
+    op.parentName = parentName;
+    op.parentKey = parentKey;
+    op.fields.push_back(fieldName);
+    op.values.push_back(value);
+    enqueue(op);
+}
+
+void XDBWriteBehind::createXParamStructure(string pname, string parentName, stringList fields,
+                                           vector<DBFieldTypes> fieldTypes)
+{
+    if (fields.size() != fieldTypes.size())
+        throw Exception("size of 'fields' and 'datatypes' list is not equal.",
+                        TracePoint("XDBWriteBehind"));
+    Operation op;
+    op.type = Operation::CREATE;
+    op.pname = pname;
+    op.parentName = parentName;
+    op.fields = std::move(fields);
+    op.fieldTypes = std::move(fieldTypes);
+    enqueue(op);
+}
+
+void XDBWriteBehind::createXParamStructure(string pname, stringList fields,
+                                           vector<DBFieldTypes> fieldTypes)
+{
+    createXParamStructure(pname, "", fields, fieldTypes);
+}
+
+void XDBWriteBehind::destroyXParamStructure(string pname)
+{
+    Operation op;
+    op.type = Operation::DESTROY;
+    op.pname = pname;
+    enqueue(op);
+}
+
+void XDBWriteBehind::createXParamIndex(string pname, stringList fields, bool unique)
+{
+    Operation op;
+    op.type = Operation::INDEX;
+    op.pname = pname;
+    op.fields = std::move(fields);
+    // uniqueness rides in "pkey", index has no key.
+    op.pkey = unique ? "1" : "";
+    enqueue(op);
+}
+
+int XDBWriteBehind::loadXParamRow(string pname, string pkey, string parentName, string parentKey,
+                                  stringList &fields, stringList &values)
+{
+    hasPendingWrites(pname);
+    return engine->loadXParamRow(pname, pkey, parentName, parentKey, fields, values);
+}
+
+int XDBWriteBehind::loadXParamRow(string pname, string pkey, stringList &fields,
+                                  stringList &values)
+{
+    return loadXParamRow(pname, pkey, "", "", fields, values);
+}
+
+int XDBWriteBehind::loadXParamValueListByParent(string pname, string parentName, string parentKey,
+                                                string fieldName, stringList &values)
+{
+    hasPendingWrites(pname);
+    return engine->loadXParamValueListByParent(pname, parentName, parentKey, fieldName, values);
+}
+
+int XDBWriteBehind::loadXParamKeyListByParent(string pname, string parentName, string parentKey,
+                                              stringList &values)
+{
+    hasPendingWrites(pname);
+    return engine->loadXParamKeyListByParent(pname, parentName, parentKey, values);
+}
+
+void XDBWriteBehind::getData(string selectstmt, vector<vector<string> > &results,
+                             vector<string> &columns)
+{
+    unsigned long long target;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        target = queuedSeq;
+    }
+    waitFor(target);
+    engine->getData(selectstmt, results, columns);
+}
+
+void XDBWriteBehind::getData(string selectstmt, const stringList &params,
+                             vector<vector<string> > &results, vector<string> &columns)
+{
+    unsigned long long target;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        target = queuedSeq;
+    }
+    waitFor(target);
+    engine->getData(selectstmt, params, results, columns);
+}
+
+void XDBWriteBehind::query(string selectstmt, const stringList &params, XDBRowVisitor &visitor)
+{
+    unsigned long long target;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        target = queuedSeq;
+    }
+    waitFor(target);
+    engine->query(selectstmt, params, visitor);
+}
+
+bool XDBWriteBehind::backup(string dest)
+{
+    flush();
+    std::lock_guard<std::mutex> guard(engineLock);
+    return engine->backup(dest);
+}
+
+void XDBWriteBehind::deferIndexes(bool defer)
+{
+    if (!defer) {
+        // indexes queued so far must be built after the writes queued before them
+        unsigned long long target;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            target = queuedSeq;
+        }
+        waitFor(target);
+    }
+    std::lock_guard<std::mutex> guard(engineLock);
+    engine->deferIndexes(defer);
+}
+
+void XDBWriteBehind::cleanup()
+{
+    flush();
+    std::lock_guard<std::mutex> guard(engineLock);
+    engine->cleanup();
+}
+
+bool XDBWriteBehind::isOnTransaction() { return pthread_getspecific(transactionTSMKey) != NULL; }
+
+string XDBWriteBehind::DBTypetoString(DBFieldTypes t) { return engine->DBTypetoString(t); }
+
+bool XDBWriteBehind::isConnected() { return engine->isConnected(); }
+
+void XDBWriteBehind::flush()
+{
+    unsigned long long target;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        target = queuedSeq;
+    }
+    waitFor(target);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (!errors.empty())
+        throw Exception(takeErrors(), TracePoint("XDBWriteBehind"));
+}
+
+std::future<void> XDBWriteBehind::sync()
+{
+    Group *group = new Group;
+    group->barrier = std::make_shared<std::promise<void> >();
+    std::future<void> result = group->barrier->get_future();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        flushRequested = true;
+    }
+    enqueue(group);
+    return result;
+}
+
+size_t XDBWriteBehind::pending()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    size_t count = 0;
+    for (auto iter = pendingTables.begin(); iter != pendingTables.end(); ++iter)
+        count += iter->second;
+    return count;
+}
+
+void XDBWriteBehind::enqueue(Operation &op)
+{
+    Group *group = (Group *)pthread_getspecific(transactionTSMKey);
+    if (group != NULL) {
+        group->ops.push_back(std::move(op));
+        return;
+    }
+    group = new Group;
+    group->ops.push_back(std::move(op));
+    enqueue(group);
+}
+
+void XDBWriteBehind::enqueue(Group *group)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    // Oversized groups are accepted when queue is empty, else they never fit.
+    spaceCond.wait(guard, [this, group]() {
+        return stopping || queuedOps == 0 || queuedOps + group->ops.size() <= queueSize;
+    });
+    if (stopping) {
+        guard.unlock();
+        delete group;
+        throw Exception("Write-behind queue is stopped.", TracePoint("XDBWriteBehind"));
+    }
+    queue.push_back(group);
+    queuedOps += group->ops.size();
+    for (unsigned int i = 0; i < group->ops.size(); i++) {
+        const Operation &op = group->ops[i];
+        pendingTables[op.type == Operation::EXECUTE ? "" : op.pname]++;
+    }
+    ++queuedSeq;
+    guard.unlock();
+    queueCond.notify_one();
+}
+
+void XDBWriteBehind::apply(const Operation &op)
+{
+    switch (op.type) {
+    case Operation::EXECUTE:
+        engine->execute(op.pkey);
+        break;
+    case Operation::SAVE:
+        engine->saveXParam(op.pname, op.pkey, op.parentName, op.parentKey, op.fields, op.values);
+        break;
+    case Operation::UPDATE:
+        engine->updateXParam(op.pname, op.pkey, op.parentName, op.parentKey, op.fields,
+                             op.values);
+        break;
+    case Operation::REMOVE:
+        engine->removeXParam(op.pname, op.pkey, op.parentName, op.parentKey);
+        break;
+    case Operation::REMOVE_BY_PARENT:
+        engine->removeXParamByParent(op.pname, op.parentName, op.parentKey);
+        break;
+    case Operation::REMOVE_BY_VALUE:
+        engine->removeXParamByValue(op.pname, op.parentName, op.parentKey, op.fields[0],
+                                    op.values[0]);
+        break;
+    case Operation::CREATE:
+        engine->createXParamStructure(op.pname, op.parentName, op.fields, op.fieldTypes);
+        break;
+    case Operation::DESTROY:
+        engine->destroyXParamStructure(op.pname);
+        break;
+    case Operation::INDEX:
+        engine->createXParamIndex(op.pname, op.fields, !op.pkey.empty());
+        break;
+    }
+}
+
+void XDBWriteBehind::writer()
+{
+    while (true) {
+        vector<Group *> batch;
+        size_t ops = 0;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            queueCond.wait(guard, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty())
+                break; // stopping and drained
+            // group commit: wait for more writes, but not longer than delay
+            queueCond.wait_for(guard, std::chrono::milliseconds(delay), [this]() {
+                return stopping || flushRequested || queuedOps >= batchSize;
+            });
+            while (!queue.empty() && (batch.empty() || ops < batchSize)) {
+                batch.push_back(queue.front());
+                ops += queue.front()->ops.size();
+                queue.pop_front();
+            }
+            queuedOps -= ops;
+        }
+        spaceCond.notify_all();
+
+        stringList failures;
+        {
+            std::lock_guard<std::mutex> guard(engineLock);
+            try {
+                engine->startTransaction();
+                for (unsigned int i = 0; i < batch.size(); i++)
+                    for (unsigned int j = 0; j < batch[i]->ops.size(); j++)
+                        apply(batch[i]->ops[j]);
+                engine->commitTransaction();
+            } catch (...) {
+                engine->rollbackTransaction();
+                // Retry groups one by one, so a bad one doesn't drop others.
+                for (unsigned int i = 0; i < batch.size(); i++) {
+                    try {
+                        engine->startTransaction();
+                        for (unsigned int j = 0; j < batch[i]->ops.size(); j++)
+                            apply(batch[i]->ops[j]);
+                        engine->commitTransaction();
+                    } catch (...) {
+                        engine->rollbackTransaction();
+                        failures.push_back(failureOf(std::current_exception()));
+                    }
+                }
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            errors.insert(errors.end(), failures.begin(), failures.end());
+            for (unsigned int i = 0; i < batch.size(); i++) {
+                Group *group = batch[i];
+                for (unsigned int j = 0; j < group->ops.size(); j++) {
+                    const Operation &op = group->ops[j];
+                    auto iter = pendingTables.find(op.type == Operation::EXECUTE ? "" : op.pname);
+                    if (iter != pendingTables.end() && --iter->second == 0)
+                        pendingTables.erase(iter);
+                }
+                if (group->barrier) {
+                    if (errors.empty()) {
+                        group->barrier->set_value();
+                    } else {
+                        group->barrier->set_exception(std::make_exception_ptr(
+                            Exception(takeErrors(), TracePoint("XDBWriteBehind"))));
+                    }
+                }
+                delete group;
+            }
+            committedSeq += batch.size();
+            if (queue.empty())
+                flushRequested = false;
+        }
+        doneCond.notify_all();
+    }
+}
+
+void XDBWriteBehind::waitFor(unsigned long long target)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    if (committedSeq >= target)
+        return;
+    flushRequested = true;
+    queueCond.notify_one();
+    doneCond.wait(guard, [this, target]() { return committedSeq >= target; });
+}
+
+string XDBWriteBehind::takeErrors()
+{
+    stringstream buff;
+    buff << errors.size() << " queued write(s) failed:";
+    for (unsigned int i = 0; i < errors.size(); i++)
+        buff << "\n" << errors[i];
+    errors.clear();
+    return buff.str();
+}
+
+bool XDBWriteBehind::hasPendingWrites(const string &pname)
+{
+    unsigned long long target;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!pendingTables.count(pname) && !pendingTables.count(""))
+            return false;
+        target = queuedSeq;
+    }
+    waitFor(target);
+    return true;
+}
+
+} // namespace pparam
+// end namespace pparam
@@ -283,5 +283,76 @@ Parser::operator bool() const { return document != nullptr; }
 
 Parser::~Parser() { delete document; }
 
+/* Implementation of "Reader" class */
+
+Reader::Reader(const std::string &filePath) : current(nullptr), done(false)
+{
+    reader = xmlReaderForFile(filePath.c_str(), NULL, 0);
+    if (reader == NULL)
+        throw_error("Can't open document");
+    int ret;
+    while ((ret = xmlTextReaderRead(reader)) == 1)
+        if (xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT)
+            break;
+    if (ret != 1) {
+        xmlFreeTextReader(reader);
+        throw_error("Can't parse document");
+    }
+    rootName = (const char *)xmlTextReaderConstName(reader);
+    done = xmlTextReaderIsEmptyElement(reader);
+}
+
+Reader::~Reader()
+{
+    if (current)
+        Node::free_wrappers(current->get_node());
+    xmlFreeTextReader(reader);
+}
+
+std::string Reader::get_root_name() const { return rootName; }
+
+Element *Reader::next_child()
+{
+    if (done)
+        return nullptr;
+    int ret;
+    if (current) {
+        Node::free_wrappers(current->get_node());
+        current = nullptr;
+        // skip subtree of current child, reader frees it.
+        ret = xmlTextReaderNext(reader);
+    } else
+        ret = xmlTextReaderRead(reader);
+    while (ret == 1) {
+        int depth = xmlTextReaderDepth(reader);
+        if (depth == 0)
+            // end of root
+            break;
+        if (depth == 1 && xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT) {
+            xmlNode *node = xmlTextReaderExpand(reader);
+            if (node == NULL)
+                throw_error("Can't parse document");
+            Node::create_wrapper(node);
+            current = static_cast<Element *>(node->_private);
+            return current;
+        }
+        ret = xmlTextReaderNext(reader);
+    }
+    if (ret == -1)
+        throw_error("Can't parse document");
+    done = true;
+    return nullptr;
+}
+
+long Reader::bytes_read() const { return xmlTextReaderByteConsumed(reader); }
+
+void Reader::throw_error(const std::string &what) const
+{
+    xmlErrorPtr error = xmlGetLastError();
+    if (error)
+        throw Exception(what + " : " + std::string(error->message), TracePoint("xml"));
+    throw Exception(what + ".", TracePoint("xml"));
+}
+
 } // namespace xml
 } // namespace pparam
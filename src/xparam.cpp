@@ -10,24 +10,85 @@
 namespace pparam
 {
 
-XParam::XParam()
+XParam::XParam() : parentParam(NULL), fingerprintCache(0), fingerprintValid(false)
 {
     pname = "__UNDEFINED__";
     version = "";
     runtime = false;
 }
 
+XParam::XParam(const XParam &_xp) :
+    pname(_xp.pname), version(_xp.version), runtime(_xp.runtime), parentParam(NULL),
+    fingerprintCache(0), fingerprintValid(false)
+{
+}
+
 XParam::XParam(XParam &&_xp) :
-    pname(std::move(_xp.pname)), version(std::move(_xp.version)), runtime(_xp.runtime)
+    pname(std::move(_xp.pname)), version(std::move(_xp.version)), runtime(_xp.runtime),
+    parentParam(NULL), fingerprintCache(0), fingerprintValid(false)
 {
 }
 
-XParam::XParam(const string &_pname) : pname(_pname)
+XParam::XParam(const string &_pname) :
+    pname(_pname), parentParam(NULL), fingerprintCache(0), fingerprintValid(false)
 {
     version = "";
     runtime = false;
 }
 
+uint64_t XParam::fingerprint() const
+{
+    if (fingerprintValid.load(std::memory_order_acquire))
+        return fingerprintCache;
+    bool cacheable = true;
+    uint64_t hash = computeFingerprint(cacheable);
+    if (cacheable) {
+        fingerprintCache = hash;
+        fingerprintValid.store(true, std::memory_order_release);
+    }
+    return hash;
+}
+
+vector<XParamChange> XParam::diff(const XParam &base) const
+{
+    vector<XParamChange> changes;
+    addChanges(base, pname, changes);
+    return changes;
+}
+
+void XParam::addChanges(const XParam &base, const string &path,
+                        vector<XParamChange> &changes) const
+{
+    if (fingerprint() != base.fingerprint())
+        changes.push_back({XParamChange::MODIFIED, path});
+}
+
+uint64_t XParam::computeFingerprint(bool &cacheable) const
+{
+    cacheable = false;
+    return hashCombine(hashString(pname), hashString(value()));
+}
+
+uint64_t XParam::hashBytes(const char *data, size_t size)
+{
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t XParam::hashCombine(uint64_t seed, uint64_t value)
+{
+    /* mix of splitmix64, so equal children in other places differ */
+    uint64_t hash = seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
 void XParam::loadXmlStr(const string &xstr, XParam::XmlParser *parser)
 {
     XmlParser *_parser = (parser == NULL) ? new XmlParser : parser;
@@ -157,6 +218,8 @@ bool XParam::is_myNode(const XmlNode *node)
  */
 XSingleParam::XSingleParam(const string &_pname) : XParam(_pname) {}
 
+XSingleParam::XSingleParam(const XSingleParam &_xsp) : XParam(_xsp) {}
+
 XSingleParam::XSingleParam(XSingleParam &&_xsp) : XParam(std::move(_xsp)) {}
 
 XParam &XSingleParam::operator=(const XmlNode *node)
@@ -189,12 +252,23 @@ bool XSingleParam::operator==(const XParam &parameter)
                         TracePoint("pparam"));
     if (pname != singleParameter->get_pname())
         return false;
+    /* cached fingerprints are cheaper than values */
+    if (fingerprintValid && singleParameter->fingerprintValid &&
+        (fingerprintCache != singleParameter->fingerprintCache))
+        return false;
     if (value() != singleParameter->value())
         return false;
 
     return true;
 }
 
+uint64_t XSingleParam::computeFingerprint(bool &cacheable) const
+{
+    if (!tracksChanges())
+        cacheable = false;
+    return hashCombine(hashString(pname), hashValue());
+}
+
 bool XSingleParam::operator!=(const XParam &parameter) { return !(*this == parameter); }
 
 string XSingleParam::_xml(bool show_runtime, const int &indent, const string &endl) const
@@ -212,6 +286,11 @@ string XSingleParam::_xml(bool show_runtime, const int &indent, const string &en
 
 XTextParam::XTextParam(const string &_pname) : XSingleParam(_pname), cdata(false), val("") {}
 
+XTextParam::XTextParam(const XTextParam &_xtp) :
+    XSingleParam(_xtp), cdata(_xtp.cdata), val(_xtp.val)
+{
+}
+
 XTextParam::XTextParam(XTextParam &&_xtp) :
     XSingleParam(std::move(_xtp)), cdata(std::move(_xtp.cdata)), val(std::move(_xtp.val))
 {
@@ -220,6 +299,7 @@ XTextParam::XTextParam(XTextParam &&_xtp) :
 XTextParam &XTextParam::operator=(const XTextParam &vtp)
 {
     val = vtp.val;
+    changed();
 
     return *this;
 }
@@ -258,19 +338,36 @@ XParam &XTextParam::operator=(const XParam &xp)
         throw e;
     }
     val = xtp->val;
+    changed();
 
     return *this;
 }
 
 string XTextParam::value() const { return cdata ? "<![CDATA[" + val + "]]>" : val; }
 
-void XTextParam::reset() { val = ""; }
+void XTextParam::reset()
+{
+    val = "";
+    changed();
+}
 
-void XTextParam::set_cdata(const bool _cdata) { cdata = _cdata; }
+void XTextParam::set_cdata(const bool _cdata)
+{
+    cdata = _cdata;
+    changed();
+}
 
-void XTextParam::set_value(const string &str) { val = str; }
+void XTextParam::set_value(const string &str)
+{
+    val = str;
+    changed();
+}
 
-void XTextParam::set_value(const char *str) { val.assign(str); }
+void XTextParam::set_value(const char *str)
+{
+    val.assign(str);
+    changed();
+}
 
 string XTextParam::get_value() const { return val; }
 
@@ -278,6 +375,11 @@ bool XTextParam::empty() const { return val.empty(); }
 
 const char *XTextParam::c_str() { return val.c_str(); }
 
+uint64_t XTextParam::hashValue() const
+{
+    return cdata ? XSingleParam::hashValue() : hashString(val);
+}
+
 XTextParam::~XTextParam() {}
 
 /* Implementation of "XFloatParam" Class
@@ -289,6 +391,11 @@ XFloatParam::XFloatParam(const string &_pname, const XParam::XFloat &_min,
 {
 }
 
+XFloatParam::XFloatParam(const XFloatParam &_xfp) :
+    XSingleParam(_xfp), min(_xfp.min), max(_xfp.max), val(_xfp.val)
+{
+}
+
 XFloatParam::XFloatParam(XFloatParam &&_xfp) :
     XSingleParam(std::move(_xfp)), min(_xfp.min), max(_xfp.max), val(_xfp.min)
 {
@@ -309,6 +416,7 @@ XParam &XFloatParam::operator=(const XParam::XFloat &value)
         throw Exception(pname + " value is out of range !", TracePoint("pparam"));
     }
     val = value;
+    changed();
     return (*this);
 }
 
@@ -333,6 +441,7 @@ XParam &XFloatParam::operator=(const XParam &xp)
     min = xip->min;
     max = xip->max;
     val = xip->val;
+    changed();
     return *this;
 }
 
@@ -345,4 +454,12 @@ string XFloatParam::value() const
     return stringOutput;
 }
 
+uint64_t XFloatParam::hashValue() const
+{
+    /* same text as value() */
+    char stringValue[330];
+    int size = snprintf(stringValue, sizeof(stringValue), "%f", val);
+    return hashBytes(stringValue, size);
+}
+
 } // namespace pparam
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+#include "xthreadpool.hpp"
+
+namespace pparam
+{
+// implementation of XThreadPool
+
+XThreadPool::XThreadPool(unsigned int threads) : stopping(false)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    workers.reserve(threads);
+    for (unsigned int i = 0; i < threads; i++)
+        workers.emplace_back(&XThreadPool::work, this);
+}
+
+XThreadPool::~XThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+size_t XThreadPool::chunkSize(size_t count, size_t chunk) const
+{
+    if (chunk)
+        return chunk;
+    size_t chunks = (size_t)(workers.size() + 1) * 4;
+    return std::max((size_t)1, (count + chunks - 1) / chunks);
+}
+
+/**
+ * State of a loop, it's shared with helper tasks, so helpers that start
+ * after loop is done find no chunk and return.
+ */
+struct XParallelLoop {
+    size_t count, chunk, chunks;
+    std::atomic<size_t> next;
+    std::atomic<bool> failed;
+    size_t completed;
+    std::exception_ptr error;
+    const std::function<void(size_t, size_t)> *body;
+    std::mutex lock;
+    std::condition_variable done;
+
+    /** Run chunks until there is no one left. */
+    void run()
+    {
+        for (;;) {
+            size_t index = next++;
+            if (index >= chunks)
+                return;
+            std::exception_ptr thrown;
+            if (!failed) {
+                try {
+                    size_t first = index * chunk;
+                    (*body)(first, std::min(count, first + chunk));
+                } catch (...) {
+                    thrown = std::current_exception();
+                }
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            if (thrown && !error) {
+                error = thrown;
+                failed = true;
+            }
+            if (++completed == chunks)
+                done.notify_all();
+        }
+    }
+};
+
+void XThreadPool::parallelFor(size_t count, size_t chunk,
+                              const std::function<void(size_t, size_t)> &body)
+{
+    if (count == 0)
+        return;
+    chunk = chunkSize(count, chunk);
+    size_t chunks = (count + chunk - 1) / chunk;
+    if (chunks == 1 || workers.empty()) {
+        body(0, count);
+        return;
+    }
+
+    auto loop = std::make_shared<XParallelLoop>();
+    loop->count = count;
+    loop->chunk = chunk;
+    loop->chunks = chunks;
+    loop->next = 0;
+    loop->failed = false;
+    loop->completed = 0;
+    loop->body = &body;
+
+    size_t helpers = std::min(chunks - 1, workers.size());
+    for (size_t i = 0; i < helpers; i++)
+        submit([loop]() { loop->run(); });
+    loop->run();
+
+    std::unique_lock<std::mutex> guard(loop->lock);
+    loop->done.wait(guard, [&loop]() { return loop->completed == loop->chunks; });
+    if (loop->error)
+        std::rethrow_exception(loop->error);
+}
+
+XThreadPool &XThreadPool::shared()
+{
+    static XThreadPool pool;
+    return pool;
+}
+
+void XThreadPool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        tasks.push_back(std::move(task));
+    }
+    ready.notify_one();
+}
+
+void XThreadPool::work()
+{
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+} // namespace pparam